@@ -0,0 +1,34 @@
+import json
+import os
+import subprocess
+import time
+
+from mbed_host_tests import BaseHostTest, event_callback
+
+
+class BenchmarkTests(BaseHostTest):
+    """
+    Benchmark results
+
+    Collects the "bench" values ("<name>=<value>") sent by the benchmark
+    suites and appends them, with the commit they were measured on, to a
+    JSON lines file, M66_BENCH_OUTPUT or benchmark.jsonl by default.
+    """
+
+    name = "m66_benchmark"
+
+    def __init__(self):
+        BaseHostTest.__init__(self)
+        self.output = os.environ.get("M66_BENCH_OUTPUT", "benchmark.jsonl")
+        try:
+            self.commit = subprocess.check_output(["git", "rev-parse", "--short", "HEAD"]).decode().strip()
+        except (OSError, subprocess.CalledProcessError):
+            self.commit = "unknown"
+
+    @event_callback("bench")
+    def __bench(self, key, value, timestamp):
+        name, _, number = value.partition("=")
+        self.log("bench: %s = %s" % (name, number))
+        with open(self.output, "a") as f:
+            f.write(json.dumps({"commit": self.commit, "time": int(time.time()),
+                                "name": name, "value": int(number)}) + "\n")
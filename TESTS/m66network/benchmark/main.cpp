@@ -0,0 +1,180 @@
+/*!
+ * Micro-benchmarks of the parser hot paths, no modem needed. The modem side
+ * is fed with M66Replay, the results go to the host as "bench" values and
+ * are collected per commit by TESTS/host_tests/benchmark.py.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include "utest/utest.h"
+#include "unity/unity.h"
+#include "greentea-client/test_env.h"
+
+#include "M66ATParser.h"
+#include "M66Replay.h"
+#include "MyBuffer.h"
+#include "config.h"
+
+using namespace utest::v1;
+
+#define BENCH_ROUNDS 200
+
+M66ATParser parser(GSM_UART_TX, GSM_UART_RX, GSM_PWRKEY, GSM_POWER);
+M66Replay modem(parser);
+
+// what the modem says between data transfers, without +RECEIVE (that needs its payload)
+static const char lineMix[] =
+    "\r\nOK\r\n"
+    "\r\n+CREG: 0,1\r\n"
+    "\r\n+CSQ: 18,0\r\n"
+    "\r\n0, CONNECT OK\r\n"
+    "\r\nSEND OK\r\n"
+    "\r\nRECV FROM:10.0.0.1:7\r\n"
+    "\r\n+QISTATE:0, \"TCP\", \"10.0.0.1\", \"7\", \"CONNECTED\"\r\n"
+    "\r\nCall Ready\r\n"
+    "\r\nERROR\r\n"
+    "\r\n+QIRDI: 0,1,0,1,12,12\r\n";
+
+static void report(const char *name, uint64_t elapsedUs, uint32_t count) {
+    char value[64];
+    snprintf(value, sizeof(value), "%s=%d", name, (int) (count ? elapsedUs * 1000 / count : 0));
+    greentea_send_kv("bench", value);
+}
+
+void benchBuffer() {
+    static char storage[512];
+    MyBuffer<char> buffer(storage, sizeof(storage));
+    Timer timer;
+    uint32_t bytes = 0;
+    // the bytes read are summed, so the reads are not optimised away and come back in order
+    uint32_t sum = 0;
+
+    timer.start();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (int i = 0; i < 256; i++) buffer.put((char) i);
+        while (buffer.available()) sum = sum * 31 + (uint8_t) buffer.get();
+        bytes += 256;
+    }
+    timer.stop();
+
+    uint32_t expected = 0;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (int i = 0; i < 256; i++) expected = expected * 31 + (uint8_t) i;
+    }
+
+    TEST_ASSERT_EQUAL(0, buffer.available());
+    TEST_ASSERT_EQUAL_UINT32(expected, sum);
+    report("mybuffer_ns_per_byte", timer.read_high_resolution_us(), bytes);
+}
+
+void benchLines() {
+    char line[128];
+    Timer timer;
+    uint32_t lines = 0;
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        TEST_ASSERT_EQUAL(sizeof(lineMix) - 1, modem.inject(lineMix, sizeof(lineMix) - 1));
+
+        timer.start();
+        while (parser.readable()) {
+            if (parser.readline(line, sizeof(line) - 1, M66Deadline(1000))) {
+                parser.checkURC(line);
+                lines++;
+            }
+        }
+        timer.stop();
+    }
+    parser.clearLinkStatus(0);
+
+    TEST_ASSERT_EQUAL(BENCH_ROUNDS * 10, (int) lines);
+    report("readline_urc_ns_per_line", timer.read_high_resolution_us(), lines);
+}
+
+static void benchPackets(int size, int readSize) {
+    char data[400], header[32], buffer[512];
+    Timer timer;
+    uint32_t bytes = 0;
+
+    memset(data, 'x', sizeof(data));
+    const size_t headerLength = (size_t) snprintf(header, sizeof(header), "\r\n+RECEIVE: 0, %d\r\n", size);
+    parser.setTimeout(0);
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        modem.inject(header, headerLength);
+        TEST_ASSERT_EQUAL(size, (int) modem.inject(data, (size_t) size));
+
+        // the line, the allocation of the packet and the copies out of it
+        timer.start();
+        parser.process();
+        int r;
+        while ((r = parser.recv(0, buffer, (uint32_t) readSize)) > 0) bytes += r;
+        timer.stop();
+    }
+
+    TEST_ASSERT_EQUAL(BENCH_ROUNDS * size, (int) bytes);
+    char name[48];
+    snprintf(name, sizeof(name), "packet_%d_read_%d_ns_per_byte", size, readSize);
+    report(name, timer.read_high_resolution_us(), bytes);
+}
+
+void benchPacketsSmall() {
+    benchPackets(16, 16);
+    benchPackets(16, 512);
+}
+
+void benchPacketsLarge() {
+    benchPackets(384, 16);
+    benchPackets(384, 128);
+    benchPackets(384, 512);
+}
+
+void benchTx() {
+    Timer timer;
+
+    // nothing reaches the UART while the replayer is in use
+    modem.inject("", 0);
+    timer.start();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        parser.tx("AT+QISEND=%d,%d", i % 6, 512);
+    }
+    timer.stop();
+
+    report("tx_ns_per_command", timer.read_high_resolution_us(), BENCH_ROUNDS);
+}
+
+utest::v1::status_t greentea_failure_handler(const Case *const source, const failure_t reason) {
+    greentea_case_failure_abort_handler(source, reason);
+    return STATUS_CONTINUE;
+}
+
+Case cases[] = {
+    Case("Bench MyBuffer-0", benchBuffer, greentea_failure_handler),
+    Case("Bench Lines-0", benchLines, greentea_failure_handler),
+    Case("Bench Packets-0", benchPacketsSmall, greentea_failure_handler),
+    Case("Bench Packets-1", benchPacketsLarge, greentea_failure_handler),
+    Case("Bench Tx-0", benchTx, greentea_failure_handler),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases) {
+    GREENTEA_SETUP(60, "m66_benchmark");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+int main() {
+    Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+    Harness::run(specification);
+}
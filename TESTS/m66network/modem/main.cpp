@@ -21,6 +21,7 @@
 #include "greentea-client/test_env.h"
 
 #include "M66Interface.h"
+#include "M66Http.h"
 #include "config.h"
 
 using namespace utest::v1;
@@ -52,6 +53,15 @@ void modemICCID() {
     TEST_ASSERT_NOT_NULL(modem.get_iccid());
 }
 
+void modemStats() {
+    M66Stats stats;
+    modem.getStats(&stats);
+
+    // the modem has been started and queried by now
+    TEST_ASSERT_TRUE_MESSAGE(stats.commands > 0, "commands not counted");
+    TEST_ASSERT_TRUE_MESSAGE(stats.commands >= stats.timeouts + stats.errors, "inconsistent counters");
+}
+
 #if defined(CELL_APN) && defined(CELL_USER) && defined(CELL_PWD)
 
 void modemConnect() {
@@ -60,6 +70,68 @@ void modemConnect() {
                               "modem connect failed");
 }
 
+void modemDNSCache() {
+    SocketAddress address;
+    Timer timer;
+
+    TEST_ASSERT_EQUAL_MESSAGE(NSAPI_ERROR_OK, modem.gethostbyname("www.arm.com", &address, NSAPI_UNSPEC),
+                              "dns lookup failed");
+
+    // the second lookup must be answered from the cache, without a modem round trip
+    timer.start();
+    TEST_ASSERT_EQUAL_MESSAGE(NSAPI_ERROR_OK, modem.gethostbyname("www.arm.com", &address, NSAPI_UNSPEC),
+                              "cached dns lookup failed");
+    TEST_ASSERT_TRUE_MESSAGE(timer.read_ms() < 100, "dns lookup not cached");
+}
+
+static size_t httpReceived;
+
+static bool httpSink(const char *data, size_t length) {
+    httpReceived += length;
+    return true;
+}
+
+void modemHTTPOffload() {
+    M66Http http(&modem);
+    char chunk[64];
+
+    // the body is larger than the chunk, it has to arrive in pieces
+    httpReceived = 0;
+    int ret = http.get("http://www.arm.com/", chunk, sizeof(chunk), httpSink);
+    TEST_ASSERT_TRUE_MESSAGE(ret > (int) sizeof(chunk), "http get failed");
+    TEST_ASSERT_EQUAL_MESSAGE(ret, (int) httpReceived, "http body incomplete");
+}
+
+void modemTLSHandshake() {
+    mbed_stats_heap_t before, after;
+    Timer timer;
+    TCPSocket socket;
+    const int tls = 1;
+
+    TEST_ASSERT_EQUAL_MESSAGE(NSAPI_ERROR_OK, socket.open(&modem), "socket open failed");
+    TEST_ASSERT_EQUAL_MESSAGE(NSAPI_ERROR_OK, socket.setsockopt(M66_SOCKET_LEVEL, M66_TLS, &tls, sizeof(tls)),
+                              "tls option failed");
+
+    // what the handshake costs the MCU, to compare with mbedTLS on the same target
+    mbed_stats_heap_get(&before);
+    timer.start();
+    TEST_ASSERT_EQUAL_MESSAGE(NSAPI_ERROR_OK, socket.connect("www.arm.com", 443), "tls connect failed");
+    timer.stop();
+    mbed_stats_heap_get(&after);
+
+    greentea_send_kv("tls_handshake_ms", timer.read_ms());
+    greentea_send_kv("tls_heap_bytes", (int) (after.current_size - before.current_size));
+
+    char request[] = "HEAD / HTTP/1.1\r\nHost: www.arm.com\r\n\r\n";
+    TEST_ASSERT_EQUAL_MESSAGE((int) sizeof(request) - 1, socket.send(request, sizeof(request) - 1),
+                              "tls send failed");
+
+    char response[64];
+    TEST_ASSERT_TRUE_MESSAGE(socket.recv(response, sizeof(response)) > 0, "tls recv failed");
+
+    TEST_ASSERT_EQUAL_MESSAGE(NSAPI_ERROR_OK, socket.close(), "socket close failed");
+}
+
 void modemHTTP() {
 
     int ret;
@@ -105,9 +177,13 @@ Case cases[] = {
     Case("Modem Reset-4", resetModem, greentea_failure_handler),
     Case("Modem get IMEI", modemIMEI, greentea_failure_handler),
     Case("Modem get ICCID", modemICCID, greentea_failure_handler),
+    Case("Modem Stats-0", modemStats, greentea_failure_handler),
     Case("Modem PowerDown", powerDown, greentea_failure_handler),
 #if defined(CELL_APN) && defined(CELL_USER) && defined(CELL_PWD)
     Case("Connect-0", modemConnect, greentea_failure_handler),
+    Case("DNS Cache-0", modemDNSCache, greentea_failure_handler),
+    Case("HTTP Offload-0", modemHTTPOffload, greentea_failure_handler),
+    Case("TLS Handshake-0", modemTLSHandshake, greentea_failure_handler),
     Case("HTTP Connect-0", modemHTTP, greentea_failure_handler),
 #else
 #warning "CONNECTIONS NOT TESTED: set CELL_APN, CELL_USER, CELL_PWD in config.h"
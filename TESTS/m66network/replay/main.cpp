@@ -0,0 +1,648 @@
+/*!
+ * Replays recorded modem sessions into the parser, no modem needed.
+ * The recordings are made with tools/m66capture.py, see session.txt.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include "utest/utest.h"
+#include "unity/unity.h"
+#include "greentea-client/test_env.h"
+
+#include "M66ATParser.h"
+#include "M66Replay.h"
+#include "M66Clock.h"
+#include "config.h"
+#include "recordings.h"
+
+using namespace utest::v1;
+
+#define BULK_PACKETS     64
+#define BULK_PACKET_SIZE 200
+
+M66ATParser parser(GSM_UART_TX, GSM_UART_RX, GSM_PWRKEY, GSM_POWER);
+
+static uint8_t capture[(4 + 4 + BULK_PACKET_SIZE) * (BULK_PACKETS + 1) + 64];
+
+static size_t record(size_t offset, char type, const void *data, size_t length, uint16_t delayUs = 0) {
+    capture[offset++] = (uint8_t) type;
+    capture[offset++] = (uint8_t) length;
+    capture[offset++] = (uint8_t) delayUs;
+    capture[offset++] = (uint8_t) (delayUs >> 8);
+    memcpy(capture + offset, data, length);
+    return offset + length;
+}
+
+static void replaySessionAt(uint32_t speed) {
+    M66Replay replay(parser);
+    char buffer[16];
+
+    TEST_ASSERT_TRUE(replay.start(session, sizeof(session), speed));
+    parser.setTimeout(2000);
+
+    TEST_ASSERT_TRUE_MESSAGE(parser.open("TCP", 0, "10.0.0.1", 80), "open failed");
+    // the +RECEIVE between AT+QISEND and the prompt must not break the send
+    TEST_ASSERT_TRUE_MESSAGE(parser.send(0, "hello", 5), "send failed");
+    TEST_ASSERT_EQUAL(3, parser.recv(0, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_MEMORY("abc", buffer, 3);
+
+    // the data arriving just before the CLOSED is not lost
+    TEST_ASSERT_EQUAL(4, parser.recv(0, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_MEMORY("pong", buffer, 4);
+    TEST_ASSERT_EQUAL(0, parser.recv(0, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(LINK_CLOSED, parser.linkStatus(0));
+
+    TEST_ASSERT_TRUE_MESSAGE(replay.wait(1000), "replay incomplete");
+}
+
+void replaySession() {
+    replaySessionAt(4);
+}
+
+void replaySessionVirtual() {
+    M66VirtualClock clock;
+    Timer real;
+    real.start();
+
+    // the recorded delays and all timeouts pass in virtual time
+    M66Clock::use(&clock);
+    replaySessionAt(1);
+    M66Clock::use(NULL);
+
+    TEST_ASSERT_TRUE_MESSAGE(clock.now() >= 2400, "recorded delays skipped");
+    TEST_ASSERT_TRUE_MESSAGE(real.read_ms() < 1000, "virtual time ran in real time");
+}
+
+#if M66_STATIC_PACKETS
+void replayHeapFree() {
+    mbed_stats_heap_t before, after;
+
+    // every packet of the session goes through the packet store, nothing through the heap
+    mbed_stats_heap_get(&before);
+    replaySessionAt(4);
+    mbed_stats_heap_get(&after);
+
+    TEST_ASSERT_EQUAL_MESSAGE(before.alloc_cnt, after.alloc_cnt, "the parser allocated");
+}
+
+void packetStoreFull() {
+    static const int packets = M66_PACKET_STORE_SIZE / 1000 + 2;
+    char chunk[BULK_PACKET_SIZE];
+    size_t offset = 4;
+
+    // more 1000 byte packets than the store holds, each in records of BULK_PACKET_SIZE
+    memcpy(capture, "M66C", 4);
+    offset = record(offset, 'R', "\r\n0, CONNECT OK\r\n", 17);
+    memset(chunk, 'x', sizeof(chunk));
+    for (int i = 0; i < packets; i++) {
+        offset = record(offset, 'R', "\r\n+RECEIVE: 0, 1000\r\n", 21);
+        for (int left = 1000; left > 0; left -= BULK_PACKET_SIZE) {
+            offset = record(offset, 'R', chunk, MIN(left, BULK_PACKET_SIZE));
+        }
+    }
+
+    M66Replay replay(parser);
+    TEST_ASSERT_TRUE(replay.start(capture, offset, 0));
+    parser.setTimeout(0);
+    while (!replay.wait(0)) parser.process();
+    parser.process();
+
+    // the packets that fit are delivered, then the stream ends instead of skipping the gap
+    int received = 0, r;
+    while ((r = parser.recv(0, chunk, sizeof(chunk))) > 0) received += r;
+    TEST_ASSERT_EQUAL(M66_PACKET_STORE_SIZE / 1028 * 1000, received);
+    TEST_ASSERT_TRUE(parser.dataLost(0));
+    TEST_ASSERT_EQUAL(LINK_FAILED, parser.linkStatus(0));
+
+    parser.clearLinkStatus(0);
+    TEST_ASSERT_FALSE(parser.dataLost(0));
+}
+#endif
+
+void virtualTimeout() {
+    M66VirtualClock clock;
+    M66Replay replay(parser);
+    Timer real;
+    real.start();
+
+    // a lost OK costs the whole timeout, but only in virtual time
+    M66Clock::use(&clock);
+    replay.inject("", 0);
+    const bool answered = parser.tx("AT") && parser.rx("OK", M66Deadline(10000));
+    M66Clock::use(NULL);
+
+    TEST_ASSERT_FALSE(answered);
+    TEST_ASSERT_TRUE(clock.now() >= 10000);
+    TEST_ASSERT_TRUE_MESSAGE(real.read_ms() < 1000, "virtual time ran in real time");
+}
+
+void commandDeadline() {
+    M66VirtualClock clock;
+    M66Replay replay(parser);
+
+    TEST_ASSERT_EQUAL(75000, M66ATParser::commandTimeout("AT+QIOPEN=0,\"TCP\",\"10.0.0.1\",\"80\""));
+    TEST_ASSERT_EQUAL(300, M66ATParser::commandTimeout("AT+CREG?"));
+    TEST_ASSERT_EQUAL(M66_COMMAND_TIMEOUT_MS, M66ATParser::commandTimeout("AT+CREG=0"));
+
+    // a lost answer to a fast command costs its own deadline, scan() and rx() share it
+    M66Stats before, after;
+    parser.getStats(&before);
+    M66Clock::use(&clock);
+    replay.inject("", 0);
+    int bearer = -1, status = -1;
+    const bool answered = parser.tx("AT+CREG?") && parser.scan("+CREG: %d,%d", &bearer, &status) == 2
+                          && parser.rx("OK");
+    M66Clock::use(NULL);
+    parser.getStats(&after);
+
+    TEST_ASSERT_FALSE(answered);
+    TEST_ASSERT_TRUE(clock.now() >= 300);
+    TEST_ASSERT_TRUE(clock.now() < 400);
+#if M66_STATS
+    // counted for the command, not only in the total
+    TEST_ASSERT_TRUE(after.byCommand[CMD_REGISTRATION].timeouts > before.byCommand[CMD_REGISTRATION].timeouts);
+    TEST_ASSERT_EQUAL(before.byCommand[CMD_OPEN].timeouts, after.byCommand[CMD_OPEN].timeouts);
+#endif
+}
+
+void retryBudget() {
+    M66VirtualClock clock;
+    M66Replay replay(parser);
+
+    M66Clock::use(&clock);
+    M66Retry connect(RETRY_CONNECT);
+    TEST_ASSERT_TRUE(connect.next());
+    clock.advance(M66_RETRY_CONNECT_BUDGET_MS - 1000);
+
+    // what is left of the connect budget, not the budget of the attach policy
+    M66Retry attach(RETRY_ATTACH, &connect);
+    TEST_ASSERT_TRUE(attach.remainingMs() <= 1000);
+    TEST_ASSERT_TRUE(attach.clamp(75000) <= 1000);
+
+    // a lost answer to AT+CGATT=1 ends with the connect budget, not after its 75 s
+    replay.inject("", 0);
+    const bool attached = parser.command(connect, CMD_ATTACH, NULL, 0);
+    const bool expired = connect.expired();
+    M66Clock::use(NULL);
+
+    TEST_ASSERT_FALSE(attached);
+    TEST_ASSERT_TRUE(expired);
+    TEST_ASSERT_TRUE(clock.now() < M66_RETRY_CONNECT_BUDGET_MS + 1000);
+}
+
+void batchBudget() {
+    static const M66Step steps[] = {{CMD_FOREGROUND, NULL, 0}, {CMD_APN, NULL, 0}};
+    M66VirtualClock clock;
+    M66Replay replay(parser);
+
+    M66Clock::use(&clock);
+    M66Retry connect(RETRY_CONNECT);
+    TEST_ASSERT_TRUE(connect.next());
+    clock.advance(M66_RETRY_CONNECT_BUDGET_MS - 1000);
+
+    // nothing answers, the command line and the commands one at a time end with the connect budget
+    replay.inject("", 0);
+    const bool done = parser.batch(connect, steps, 2, "apn", "user", "pass");
+    const bool expired = connect.expired();
+    M66Clock::use(NULL);
+
+    TEST_ASSERT_FALSE(done);
+    TEST_ASSERT_TRUE(expired);
+    TEST_ASSERT_TRUE(clock.now() < M66_RETRY_CONNECT_BUDGET_MS + 1000);
+}
+
+void typedResponse() {
+    static const char command[] = "AT+QILOCIP\r\n";
+    static const char tooLong[] = "\r\n10.0.0.1000000000000001\r\n";
+    static const char address[] = "\r\n10.0.0.1\r\n";
+    size_t offset = 4;
+
+    memcpy(capture, "M66C", 4);
+    offset = record(offset, 'T', command, sizeof(command) - 1);
+    offset = record(offset, 'R', tooLong, sizeof(tooLong) - 1);
+    offset = record(offset, 'T', command, sizeof(command) - 1);
+    offset = record(offset, 'R', address, sizeof(address) - 1);
+
+    M66Replay replay(parser);
+    TEST_ASSERT_TRUE(replay.start(capture, offset, 0));
+
+    // an address longer than its buffer is refused, not written past the end
+    TEST_ASSERT_NULL(parser.getIPAddress());
+    const char *ip = parser.getIPAddress();
+    TEST_ASSERT_NOT_NULL(ip);
+    TEST_ASSERT_EQUAL_STRING("10.0.0.1", ip);
+    TEST_ASSERT_TRUE(replay.wait(1000));
+}
+
+static char sent[256];
+static size_t sentLength = 0;
+
+static void transmitted(char c) {
+    if (sentLength < sizeof(sent) - 1) sent[sentLength++] = c;
+    sent[sentLength] = '\0';
+}
+
+#if M66_BATCH_COMMANDS
+void batchCommands() {
+    // _send() writes the line with puts() and then "\r\n" with puts(), each adds a '\n'
+    static const char line[] = "AT+QIFGCNT=0;+QICSGP=1,\"apn\",\"user\",\"pass\"\n\r\n\n";
+    static const char first[] = "AT+QIFGCNT=0\n\r\n\n";
+    static const char second[] = "AT+QICSGP=1,\"apn\",\"user\",\"pass\"\n\r\n\n";
+    static const char ok[] = "\r\nOK\r\n";
+    static const char error[] = "\r\nERROR\r\n";
+    static const M66Step steps[] = {{CMD_FOREGROUND, NULL, 0}, {CMD_APN, NULL, 0}};
+    size_t offset = 4;
+
+    memcpy(capture, "M66C", 4);
+    offset = record(offset, 'T', line, sizeof(line) - 1);
+    offset = record(offset, 'R', ok, sizeof(ok) - 1);
+    offset = record(offset, 'T', line, sizeof(line) - 1);
+    offset = record(offset, 'R', error, sizeof(error) - 1);
+    offset = record(offset, 'T', first, sizeof(first) - 1);
+    offset = record(offset, 'R', ok, sizeof(ok) - 1);
+    offset = record(offset, 'T', second, sizeof(second) - 1);
+    offset = record(offset, 'R', ok, sizeof(ok) - 1);
+
+    M66Replay replay(parser);
+    sentLength = 0;
+    replay.attachTransmit(transmitted);
+    TEST_ASSERT_TRUE(replay.start(capture, offset, 0));
+
+    // one round trip for both commands
+    TEST_ASSERT_TRUE(parser.batch(steps, 2, "apn", "user", "pass"));
+    // a line the modem rejects is repeated one command at a time, with the same arguments
+    TEST_ASSERT_TRUE(parser.batch(steps, 2, "apn", "user", "pass"));
+    TEST_ASSERT_TRUE(replay.wait(1000));
+
+    const size_t lineLength = sizeof(line) - 1, firstLength = sizeof(first) - 1;
+    TEST_ASSERT_EQUAL(2 * lineLength + firstLength + sizeof(second) - 1, sentLength);
+    TEST_ASSERT_EQUAL_MEMORY(line, sent, lineLength);
+    TEST_ASSERT_EQUAL_MEMORY(line, sent + lineLength, lineLength);
+    TEST_ASSERT_EQUAL_MEMORY(first, sent + 2 * lineLength, firstLength);
+    TEST_ASSERT_EQUAL_MEMORY(second, sent + 2 * lineLength + firstLength, sizeof(second) - 1);
+}
+
+void batchEcho() {
+    static const char line[] = "ATE0+QIURC=1\n\r\n\n";
+    static const char echoed[] = "ATE0+QIURC=1\r\r\nOK\r\n";
+    static const M66Step steps[] = {{CMD_ECHO_OFF, NULL, 0}, {CMD_URC, NULL, 0}};
+    size_t offset = 4;
+
+    memcpy(capture, "M66C", 4);
+    offset = record(offset, 'T', line, sizeof(line) - 1);
+    offset = record(offset, 'R', echoed, sizeof(echoed) - 1);
+
+    M66Replay replay(parser);
+    TEST_ASSERT_TRUE(replay.start(capture, offset, 0));
+
+    // the echo of the whole line comes before the OK, as long as ATE0 is not through
+    TEST_ASSERT_TRUE(parser.batch(steps, 2));
+    TEST_ASSERT_TRUE(replay.wait(1000));
+}
+#endif
+
+void warmReset() {
+    static const char alive[] = "AT\n\r\n\n";
+    static const char aliveEchoed[] = "AT\r\r\nOK\r\n";
+#if M66_BATCH_COMMANDS
+    static const char *const settings[] = {"ATE0+QIURC=1;+CMEE=1;+QIMUX=1\n\r\n\n"};
+    static const char *const answers[] = {"ATE0+QIURC=1;+CMEE=1;+QIMUX=1\r\r\nOK\r\n"};
+#else
+    static const char *const settings[] = {"ATE0\n\r\n\n", "AT+QIURC=1\n\r\n\n", "AT+CMEE=1\n\r\n\n", "AT+QIMUX=1\n\r\n\n"};
+    static const char *const answers[] = {"ATE0\r\r\nOK\r\n", "\r\nOK\r\n", "\r\nOK\r\n", "\r\nOK\r\n"};
+#endif
+    M66VirtualClock clock;
+    size_t offset = 4;
+
+    memcpy(capture, "M66C", 4);
+    offset = record(offset, 'T', alive, sizeof(alive) - 1);
+    offset = record(offset, 'R', aliveEchoed, sizeof(aliveEchoed) - 1);
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+        offset = record(offset, 'T', settings[i], strlen(settings[i]));
+        offset = record(offset, 'R', answers[i], strlen(answers[i]));
+    }
+
+    // the modem answers the first AT, it kept running while the MCU restarted
+    M66Clock::use(&clock);
+    M66Replay replay(parser);
+    sentLength = 0;
+    replay.attachTransmit(transmitted);
+    TEST_ASSERT_TRUE(replay.start(capture, offset, 0));
+    const bool reset = parser.reset();
+    const bool complete = replay.wait(1000);
+    M66Clock::use(NULL);
+
+    TEST_ASSERT_TRUE(reset);
+    TEST_ASSERT_TRUE(complete);
+    // without AT+QIMUX=1 every AT+QIOPEN=<id>,... after it fails
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(sent, "+QIMUX=1"), "multiplexing not set");
+}
+
+void linkDiscard() {
+    char buffer[16];
+    size_t offset = 4;
+
+    memcpy(capture, "M66C", 4);
+    offset = record(offset, 'R', "\r\n1, CONNECT OK\r\n", 17);
+    offset = record(offset, 'R', "\r\n+RECEIVE: 1, 3\r\nabc", 21);
+    offset = record(offset, 'R', "\r\n+RECEIVE: 2, 3\r\nxyz", 21);
+
+    M66Replay replay(parser);
+    TEST_ASSERT_TRUE(replay.start(capture, offset, 0));
+    parser.setTimeout(0);
+    while (!replay.wait(0)) parser.process();
+    parser.process();
+
+    // the data of a connection given up stays behind, that of the others is kept
+    parser.discard(1);
+    TEST_ASSERT_EQUAL(-1, parser.recv(1, buffer, sizeof(buffer)));
+    parser.clearLinkStatus(1);
+
+    int id = -1;
+    TEST_ASSERT_EQUAL(3, parser.recvfrom(1u << 2, &id, buffer, sizeof(buffer), NULL, NULL, false));
+    TEST_ASSERT_EQUAL(2, id);
+    TEST_ASSERT_EQUAL_MEMORY("xyz", buffer, 3);
+}
+
+void emptyDatagram() {
+    char buffer[16];
+    size_t offset = 4;
+
+    memcpy(capture, "M66C", 4);
+    offset = record(offset, 'R', "\r\n4, CONNECT OK\r\n", 17);
+    offset = record(offset, 'R', "\r\n+RECEIVE: 4, 0\r\n", 18);
+    offset = record(offset, 'R', "\r\n4, CLOSED\r\n", 13);
+
+    M66Replay replay(parser);
+    TEST_ASSERT_TRUE(replay.start(capture, offset, 0));
+    parser.setTimeout(0);
+    while (!replay.wait(0)) parser.process();
+    parser.process();
+
+    // an empty datagram is data of its link, after it the closed link has none
+    int id = -1;
+    TEST_ASSERT_EQUAL(0, parser.recvfrom(1u << 4, &id, buffer, sizeof(buffer), NULL, NULL, true));
+    TEST_ASSERT_EQUAL(4, id);
+    id = -1;
+    TEST_ASSERT_EQUAL(0, parser.recvfrom(1u << 4, &id, buffer, sizeof(buffer), NULL, NULL, true));
+    TEST_ASSERT_EQUAL(-1, id);
+    parser.clearLinkStatus(4);
+}
+
+void tlsResults() {
+    static const char ok[] = "\r\nOK\r\n";
+    static const char error[] = "\r\nERROR\r\n";
+    static const char failed[] = "\r\n+QSSLOPEN: 0,-3\r\n";
+    static const char opened[] = "\r\n+QSSLOPEN: 0,0\r\n";
+    static const char close[] = "AT+QSSLCLOSE=0\n\r\n\n";
+    char open[48];
+    const size_t length = (size_t) snprintf(open, sizeof(open), "AT+QSSLOPEN=0,%d,\"example.com\",443,0\n\r\n\n",
+                                            M66_TLS_CONTEXT);
+    size_t offset = 4;
+
+    memcpy(capture, "M66C", 4);
+    offset = record(offset, 'T', open, length);
+    offset = record(offset, 'R', ok, sizeof(ok) - 1);
+    offset = record(offset, 'R', failed, sizeof(failed) - 1);
+    offset = record(offset, 'T', open, length);
+    offset = record(offset, 'R', error, sizeof(error) - 1);
+    offset = record(offset, 'T', open, length);
+    offset = record(offset, 'R', ok, sizeof(ok) - 1);
+    offset = record(offset, 'T', open, length);
+    offset = record(offset, 'R', ok, sizeof(ok) - 1);
+    offset = record(offset, 'R', opened, sizeof(opened) - 1);
+    offset = record(offset, 'T', close, sizeof(close) - 1);
+    offset = record(offset, 'R', ok, sizeof(ok) - 1);
+
+    M66Replay replay(parser);
+    TEST_ASSERT_TRUE(replay.start(capture, offset, 0));
+
+    // only a failed handshake is a TLS failure, the socket maps the others to their own errors
+    TEST_ASSERT_FALSE(parser.sslOpen(0, "example.com", 443, 5));
+    TEST_ASSERT_EQUAL(SSL_HANDSHAKE, parser.sslResult());
+    TEST_ASSERT_FALSE(parser.sslOpen(0, "example.com", 443, 5));
+    TEST_ASSERT_EQUAL(SSL_REJECTED, parser.sslResult());
+    TEST_ASSERT_FALSE(parser.sslOpen(0, "example.com", 443, 0));
+    TEST_ASSERT_EQUAL(SSL_TIMEOUT, parser.sslResult());
+    TEST_ASSERT_TRUE(parser.sslOpen(0, "example.com", 443, 5));
+    TEST_ASSERT_EQUAL(SSL_OK, parser.sslResult());
+    TEST_ASSERT_TRUE(parser.close(0));
+    TEST_ASSERT_TRUE(replay.wait(1000));
+}
+
+#if M66_UDP
+static int sendResults = 0;
+
+static void linkEvent(int id) {
+    if (id == 0) sendResults++;
+}
+
+void datagramResults() {
+    static const char client[] = "AT+QISRVC=1\n\r\n\n";
+    static const char send[] = "AT+QISEND=0,1\n\r\n\n";
+    static const char ok[] = "\r\nOK\r\n";
+    static const char sendOk[] = "\r\nSEND OK\r\n\r\nSEND OK\r\n";
+    size_t offset = 4;
+
+    memcpy(capture, "M66C", 4);
+    offset = record(offset, 'T', client, sizeof(client) - 1);
+    offset = record(offset, 'R', ok, sizeof(ok) - 1);
+    for (int i = 0; i < 2; i++) {
+        offset = record(offset, 'T', send, sizeof(send) - 1);
+        offset = record(offset, 'R', "> ", 2);
+        offset = record(offset, 'T', "x", 1);
+    }
+    // the results of both datagrams back to back, read with what is left before the next command
+    offset = record(offset, 'R', sendOk, sizeof(sendOk) - 1);
+
+    M66Replay replay(parser);
+    sendResults = 0;
+    parser.attachLinkEvent(linkEvent);
+    TEST_ASSERT_TRUE(replay.start(capture, offset, 0));
+    TEST_ASSERT_TRUE(parser.sendDatagram(0, "x", 1));
+    TEST_ASSERT_TRUE(parser.sendDatagram(0, "x", 1));
+    TEST_ASSERT_TRUE(replay.wait(1000));
+
+    parser.tx("AT");
+    parser.attachLinkEvent(NULL);
+
+    // each SEND OK frees its place in the send window
+    TEST_ASSERT_EQUAL(2, sendResults);
+    TEST_ASSERT_FALSE(parser.sendFailed(0));
+}
+
+void datagramThenSend() {
+    static const char sendDatagram[] = "AT+QISEND=0,1\n\r\n\n";
+    static const char sendStream[] = "AT+QISEND=1,1\n\r\n\n";
+    static const char sendFail[] = "\r\nSEND FAIL\r\n";
+    static const char sendOk[] = "\r\nSEND OK\r\n";
+    size_t offset = 4;
+
+    // AT+QISRVC=1 was sent by the case before
+    memcpy(capture, "M66C", 4);
+    offset = record(offset, 'T', sendDatagram, sizeof(sendDatagram) - 1);
+    offset = record(offset, 'R', "> ", 2);
+    offset = record(offset, 'T', "x", 1);
+    // the result of the datagram comes late, the TCP send has to wait for it
+    offset = record(offset, 'R', sendFail, sizeof(sendFail) - 1, 20000);
+    offset = record(offset, 'T', sendStream, sizeof(sendStream) - 1);
+    offset = record(offset, 'R', "> ", 2);
+    offset = record(offset, 'T', "y", 1);
+    offset = record(offset, 'R', sendOk, sizeof(sendOk) - 1);
+
+    M66Replay replay(parser);
+    TEST_ASSERT_TRUE(replay.start(capture, offset, 1));
+    TEST_ASSERT_TRUE(parser.sendDatagram(0, "x", 1));
+    TEST_ASSERT_TRUE(parser.send(1, "y", 1));
+    TEST_ASSERT_TRUE(replay.wait(1000));
+
+    // each result went to its own send
+    TEST_ASSERT_TRUE(parser.sendFailed(0));
+}
+#endif
+
+static volatile bool spinning = false;
+static volatile uint32_t spins = 0;
+
+static void spin() {
+    while (spinning) spins++;
+}
+
+void waitBlocks() {
+    Thread spinner(osPriorityNormal, 512);
+    M66Replay replay(parser);
+    replay.inject("", 0);
+
+    // a thread of the same priority alone
+    spinning = true;
+    spinner.start(spin);
+    Thread::wait(200);
+    const uint32_t alone = spins;
+
+    // and while the parser waits for an answer that does not come
+    spins = 0;
+    const bool answered = parser.tx("AT") && parser.rx("OK", M66Deadline(200));
+    const uint32_t waiting = spins;
+    spinning = false;
+    spinner.join();
+
+    TEST_ASSERT_FALSE(answered);
+    TEST_ASSERT_TRUE_MESSAGE(waiting > alone / 10 * 9, "the parser kept the CPU while waiting");
+}
+
+#if M66_CAPTURE
+void captureCommand() {
+    static const uint8_t answer[] = {'M', '6', '6', 'C', 'T', 6, 0, 0, 'A', 'T', '\n', '\r', '\n', '\n',
+                                     'R', 6, 0, 0, '\r', '\n', 'O', 'K', '\r', '\n'};
+    M66Replay replay(parser);
+    uint8_t recorded[64];
+
+    parser.startCapture(recorded, sizeof(recorded));
+    TEST_ASSERT_TRUE(replay.start(answer, sizeof(answer), 0));
+    TEST_ASSERT_TRUE(parser.tx("AT") && parser.rx("OK"));
+    TEST_ASSERT_TRUE(replay.wait(1000));
+    const size_t length = parser.stopCapture();
+
+    // the sent side is recorded, the replayed answer does not come from the UART
+    TEST_ASSERT_EQUAL(4 + 4 + 6, length);
+    TEST_ASSERT_EQUAL_MEMORY("M66C", recorded, 4);
+    TEST_ASSERT_EQUAL('T', recorded[4]);
+    TEST_ASSERT_EQUAL(6, recorded[5]);
+    TEST_ASSERT_EQUAL_MEMORY("AT\n\r\n\n", recorded + 8, 6);
+}
+#endif
+
+void replayThroughput() {
+    char packet[BULK_PACKET_SIZE];
+    char header[32];
+    size_t offset = 4;
+
+    memcpy(capture, "M66C", 4);
+    offset = record(offset, 'R', "\r\n0, CONNECT OK\r\n", 17);
+    memset(packet, 'x', sizeof(packet));
+    const size_t headerLength = (size_t) snprintf(header, sizeof(header), "\r\n+RECEIVE: 0, %d\r\n", BULK_PACKET_SIZE);
+    for (int i = 0; i < BULK_PACKETS; i++) {
+        offset = record(offset, 'R', header, headerLength);
+        offset = record(offset, 'R', packet, sizeof(packet));
+    }
+
+    M66Replay replay(parser);
+    Timer timer;
+    timer.start();
+    TEST_ASSERT_TRUE(replay.start(capture, offset, 0));
+
+    parser.setTimeout(1000);
+    while (parser.linkStatus(0) != LINK_CONNECTED && timer.read_ms() < 1000) parser.process();
+
+    int received = 0, r;
+    while (received < BULK_PACKETS * BULK_PACKET_SIZE && (r = parser.recv(0, packet, sizeof(packet))) > 0) {
+        received += r;
+    }
+    const int elapsed = timer.read_us();
+    parser.clearLinkStatus(0);
+
+    TEST_ASSERT_EQUAL(BULK_PACKETS * BULK_PACKET_SIZE, received);
+    TEST_ASSERT_TRUE(replay.wait(1000));
+    greentea_send_kv("replay_bytes", (int) offset);
+    greentea_send_kv("replay_us", elapsed);
+}
+
+utest::v1::status_t greentea_failure_handler(const Case *const source, const failure_t reason) {
+    greentea_case_failure_abort_handler(source, reason);
+    return STATUS_CONTINUE;
+}
+
+Case cases[] = {
+    Case("Replay Session-0", replaySession, greentea_failure_handler),
+    Case("Replay Session-1", replaySessionVirtual, greentea_failure_handler),
+#if M66_STATIC_PACKETS
+    Case("Replay Heap Free-0", replayHeapFree, greentea_failure_handler),
+    Case("Packet Store Full-0", packetStoreFull, greentea_failure_handler),
+#endif
+    Case("Virtual Timeout-0", virtualTimeout, greentea_failure_handler),
+    Case("Command Deadline-0", commandDeadline, greentea_failure_handler),
+    Case("Retry Budget-0", retryBudget, greentea_failure_handler),
+    Case("Retry Budget-1", batchBudget, greentea_failure_handler),
+    Case("Typed Response-0", typedResponse, greentea_failure_handler),
+#if M66_BATCH_COMMANDS
+    Case("Batch Commands-0", batchCommands, greentea_failure_handler),
+    Case("Batch Commands-1", batchEcho, greentea_failure_handler),
+#endif
+    Case("Warm Reset-0", warmReset, greentea_failure_handler),
+    Case("Link Discard-0", linkDiscard, greentea_failure_handler),
+    Case("Empty Datagram-0", emptyDatagram, greentea_failure_handler),
+    Case("TLS Results-0", tlsResults, greentea_failure_handler),
+#if M66_UDP
+    Case("Datagram Results-0", datagramResults, greentea_failure_handler),
+    Case("Datagram Results-1", datagramThenSend, greentea_failure_handler),
+#endif
+    Case("Wait Blocks-0", waitBlocks, greentea_failure_handler),
+#if M66_CAPTURE
+    Case("Replay Capture-0", captureCommand, greentea_failure_handler),
+#endif
+    Case("Replay Throughput-0", replayThroughput, greentea_failure_handler),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases) {
+    GREENTEA_SETUP(60, "default_auto");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+int main() {
+    Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+    Harness::run(specification);
+}
@@ -0,0 +1,37 @@
+// generated by tools/m66capture.py, do not edit
+static const uint8_t session[535] = {
+    0x4d, 0x36, 0x36, 0x43, 0x54, 0x08, 0x00, 0x00, 0x41, 0x54, 0x56, 0x30, 0x0a, 0x0d, 0x0a, 0x0a,
+    0x52, 0x03, 0x88, 0x13, 0x30, 0x0d, 0x0a, 0x54, 0x0e, 0x00, 0x00, 0x41, 0x54, 0x2b, 0x51, 0x49,
+    0x53, 0x54, 0x41, 0x54, 0x45, 0x0a, 0x0d, 0x0a, 0x0a, 0x52, 0x03, 0x10, 0x27, 0x30, 0x0d, 0x0a,
+    0x52, 0x66, 0x00, 0x00, 0x2b, 0x51, 0x49, 0x53, 0x54, 0x41, 0x54, 0x45, 0x3a, 0x30, 0x2c, 0x20,
+    0x22, 0x54, 0x43, 0x50, 0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c, 0x20, 0x22,
+    0x22, 0x2c, 0x20, 0x30, 0x0d, 0x0a, 0x2b, 0x51, 0x49, 0x53, 0x54, 0x41, 0x54, 0x45, 0x3a, 0x31,
+    0x2c, 0x20, 0x22, 0x54, 0x43, 0x50, 0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c,
+    0x20, 0x22, 0x22, 0x2c, 0x20, 0x30, 0x0d, 0x0a, 0x2b, 0x51, 0x49, 0x53, 0x54, 0x41, 0x54, 0x45,
+    0x3a, 0x32, 0x2c, 0x20, 0x22, 0x54, 0x43, 0x50, 0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c, 0x20, 0x22,
+    0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c, 0x20, 0x30, 0x0d, 0x0a, 0x52, 0x69, 0x00, 0x00, 0x2b, 0x51,
+    0x49, 0x53, 0x54, 0x41, 0x54, 0x45, 0x3a, 0x33, 0x2c, 0x20, 0x22, 0x54, 0x43, 0x50, 0x22, 0x2c,
+    0x20, 0x22, 0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c, 0x20, 0x30, 0x0d, 0x0a,
+    0x2b, 0x51, 0x49, 0x53, 0x54, 0x41, 0x54, 0x45, 0x3a, 0x34, 0x2c, 0x20, 0x22, 0x54, 0x43, 0x50,
+    0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c, 0x20, 0x30,
+    0x0d, 0x0a, 0x2b, 0x51, 0x49, 0x53, 0x54, 0x41, 0x54, 0x45, 0x3a, 0x35, 0x2c, 0x20, 0x22, 0x54,
+    0x43, 0x50, 0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c, 0x20, 0x22, 0x22, 0x2c,
+    0x20, 0x30, 0x0d, 0x0a, 0x30, 0x0d, 0x0a, 0x54, 0x08, 0x00, 0x00, 0x41, 0x54, 0x56, 0x31, 0x0a,
+    0x0d, 0x0a, 0x0a, 0x52, 0x06, 0x88, 0x13, 0x0d, 0x0a, 0x4f, 0x4b, 0x0d, 0x0a, 0x54, 0x10, 0x00,
+    0x00, 0x41, 0x54, 0x2b, 0x51, 0x49, 0x44, 0x4e, 0x53, 0x49, 0x50, 0x3d, 0x30, 0x0a, 0x0d, 0x0a,
+    0x0a, 0x52, 0x06, 0x88, 0x13, 0x0d, 0x0a, 0x4f, 0x4b, 0x0d, 0x0a, 0x54, 0x25, 0x00, 0x00, 0x41,
+    0x54, 0x2b, 0x51, 0x49, 0x4f, 0x50, 0x45, 0x4e, 0x3d, 0x30, 0x2c, 0x22, 0x54, 0x43, 0x50, 0x22,
+    0x2c, 0x22, 0x31, 0x30, 0x2e, 0x30, 0x2e, 0x30, 0x2e, 0x31, 0x22, 0x2c, 0x22, 0x38, 0x30, 0x22,
+    0x0a, 0x0d, 0x0a, 0x0a, 0x52, 0x06, 0x10, 0x27, 0x0d, 0x0a, 0x4f, 0x4b, 0x0d, 0x0a, 0x52, 0x11,
+    0x52, 0x83, 0x0d, 0x0a, 0x30, 0x2c, 0x20, 0x43, 0x4f, 0x4e, 0x4e, 0x45, 0x43, 0x54, 0x20, 0x4f,
+    0x4b, 0x0d, 0x0a, 0x54, 0x0f, 0x00, 0x00, 0x41, 0x54, 0x2b, 0x51, 0x49, 0x53, 0x52, 0x56, 0x43,
+    0x3d, 0x31, 0x0a, 0x0d, 0x0a, 0x0a, 0x52, 0x06, 0x88, 0x13, 0x0d, 0x0a, 0x4f, 0x4b, 0x0d, 0x0a,
+    0x54, 0x11, 0x00, 0x00, 0x41, 0x54, 0x2b, 0x51, 0x49, 0x53, 0x45, 0x4e, 0x44, 0x3d, 0x30, 0x2c,
+    0x35, 0x0a, 0x0d, 0x0a, 0x0a, 0x52, 0x15, 0x98, 0x3a, 0x0d, 0x0a, 0x2b, 0x52, 0x45, 0x43, 0x45,
+    0x49, 0x56, 0x45, 0x3a, 0x20, 0x30, 0x2c, 0x20, 0x33, 0x0d, 0x0a, 0x61, 0x62, 0x63, 0x52, 0x02,
+    0xd0, 0x07, 0x3e, 0x20, 0x54, 0x05, 0x00, 0x00, 0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x52, 0x0b, 0x40,
+    0x81, 0x0d, 0x0a, 0x53, 0x45, 0x4e, 0x44, 0x20, 0x4f, 0x4b, 0x0d, 0x0a, 0x52, 0x16, 0xb0, 0x84,
+    0x0d, 0x0a, 0x2b, 0x52, 0x45, 0x43, 0x45, 0x49, 0x56, 0x45, 0x3a, 0x20, 0x30, 0x2c, 0x20, 0x34,
+    0x0d, 0x0a, 0x70, 0x6f, 0x6e, 0x67, 0x52, 0x0d, 0xe8, 0x03, 0x0d, 0x0a, 0x30, 0x2c, 0x20, 0x43,
+    0x4c, 0x4f, 0x53, 0x45, 0x44, 0x0d, 0x0a,
+};
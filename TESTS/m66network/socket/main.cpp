@@ -0,0 +1,328 @@
+/*!
+ * End-to-end socket benchmarks, TCPSocket and UDPSocket over M66Interface
+ * against a simulated modem and server behind a shaped link (simulator.h).
+ * The results go to the host as "bench" values, collected per commit by
+ * TESTS/host_tests/benchmark.py.
+ *
+ * Busy time is the time the MCU was not available to a low priority
+ * thread, the driver and the simulator working. The parser sleeps while it
+ * waits for the modem, that is not busy time.
+ *
+ * The TLS cases compare a handshake done by the modem (M66_TLS) with one
+ * done by mbedTLS on the MCU, in time and in the heap a connection holds.
+ * The server of the mbedTLS handshake runs on the MCU too, its time is
+ * taken out.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include "utest/utest.h"
+#include "unity/unity.h"
+#include "greentea-client/test_env.h"
+
+#include "M66Interface.h"
+#include "simulator.h"
+#include "config.h"
+
+using namespace utest::v1;
+
+#define SERVER          "10.0.0.1"
+#define RTT_ROUNDS      10
+#define RTT_SIZE        32
+#define TRANSFER_SIZE   8192
+#define TRANSFER_CHUNK  512
+#define SOCKET_TIMEOUT  10000
+#define TLS_HOST        "localhost"    // the name of the mbedTLS test certificate
+
+M66Interface modem(GSM_UART_TX, GSM_UART_RX, GSM_PWRKEY, GSM_POWER);
+
+// GPRS multislot class 10 (4 down, 2 up) and the UART at 115200 baud
+static const LinkModel gprs = {"gprs", 5000, 10000, 300, 11520};
+// only the cost of the driver
+static const LinkModel unshaped = {"unshaped", 0, 0, 0, 0};
+
+static volatile uint32_t idleLoops = 0;
+static uint32_t idleLoopsPerMs = 0;
+Thread idle(osPriorityLow, 512);
+
+static void idleCount() {
+    for (;;) idleLoops++;
+}
+
+/** Measures wall and busy time of a part of a benchmark */
+class Stopwatch {
+public:
+    Stopwatch() : _loops(idleLoops) {
+        _timer.start();
+    }
+
+    int elapsedUs() {
+        return _timer.read_us();
+    }
+
+    int busyUs() {
+        const int idleUs = idleLoopsPerMs ? (int) ((uint64_t) (idleLoops - _loops) * 1000 / idleLoopsPerMs) : 0;
+        const int elapsed = _timer.read_us();
+        return elapsed > idleUs ? elapsed - idleUs : 0;
+    }
+
+private:
+    Timer _timer;
+    uint32_t _loops;
+};
+
+static void report(const LinkModel &link, const char *name, int value) {
+    char text[64];
+    snprintf(text, sizeof(text), "%s_%s=%d", link.name, name, value);
+    greentea_send_kv("bench", text);
+}
+
+static void tcpConnect(TCPSocket &socket, int port) {
+    TEST_ASSERT_EQUAL(NSAPI_ERROR_OK, socket.open(&modem));
+    socket.set_timeout(SOCKET_TIMEOUT);
+    TEST_ASSERT_EQUAL(NSAPI_ERROR_OK, socket.connect(SocketAddress(SERVER, (uint16_t) port)));
+}
+
+static int recvAll(TCPSocket &socket, char *buffer, int size, int wanted) {
+    int received = 0;
+    while (received < wanted) {
+        const int r = socket.recv(buffer, (nsapi_size_t) (wanted - received < size ? wanted - received : size));
+        if (r <= 0) break;
+        received += r;
+    }
+    return received;
+}
+
+static void benchmark(const LinkModel &link) {
+    ModemSimulator simulator(modem, link);
+    char buffer[TRANSFER_CHUNK];
+
+    // connect latency
+    TCPSocket echo;
+    {
+        Stopwatch watch;
+        tcpConnect(echo, SIM_PORT_ECHO);
+        report(link, "connect_ms", watch.elapsedUs() / 1000);
+    }
+
+    // request/response round trip
+    {
+        memset(buffer, 'r', RTT_SIZE);
+        Stopwatch watch;
+        for (int i = 0; i < RTT_ROUNDS; i++) {
+            TEST_ASSERT_EQUAL(RTT_SIZE, echo.send(buffer, RTT_SIZE));
+            TEST_ASSERT_EQUAL(RTT_SIZE, recvAll(echo, buffer, sizeof(buffer), RTT_SIZE));
+        }
+        report(link, "tcp_rtt_ms", watch.elapsedUs() / 1000 / RTT_ROUNDS);
+    }
+    echo.close();
+
+    // sustained upload, until the modem took the last byte
+    {
+        TCPSocket discard;
+        tcpConnect(discard, SIM_PORT_DISCARD);
+        memset(buffer, 'u', sizeof(buffer));
+
+        Stopwatch watch;
+        for (int sent = 0; sent < TRANSFER_SIZE; sent += TRANSFER_CHUNK) {
+            TEST_ASSERT_EQUAL(TRANSFER_CHUNK, discard.send(buffer, TRANSFER_CHUNK));
+        }
+        const int elapsed = watch.elapsedUs();
+        report(link, "upload_bytes_per_s", (int) ((uint64_t) TRANSFER_SIZE * 1000000 / elapsed));
+        report(link, "upload_busy_us_per_kb", watch.busyUs() / (TRANSFER_SIZE / 1024));
+        discard.close();
+    }
+
+    // sustained download, from the request to the last byte
+    {
+        TCPSocket chargen;
+        tcpConnect(chargen, SIM_PORT_CHARGEN);
+        const int length = snprintf(buffer, sizeof(buffer), "%d", TRANSFER_SIZE);
+
+        Stopwatch watch;
+        TEST_ASSERT_EQUAL(length, chargen.send(buffer, (nsapi_size_t) length));
+        TEST_ASSERT_EQUAL(TRANSFER_SIZE, recvAll(chargen, buffer, sizeof(buffer), TRANSFER_SIZE));
+        const int elapsed = watch.elapsedUs();
+        report(link, "download_bytes_per_s", (int) ((uint64_t) TRANSFER_SIZE * 1000000 / elapsed));
+        report(link, "download_busy_us_per_kb", watch.busyUs() / (TRANSFER_SIZE / 1024));
+        chargen.close();
+    }
+
+    // datagram round trip
+    {
+        UDPSocket udp;
+        SocketAddress server(SERVER, SIM_PORT_ECHO);
+        TEST_ASSERT_EQUAL(NSAPI_ERROR_OK, udp.open(&modem));
+        udp.set_timeout(SOCKET_TIMEOUT);
+        memset(buffer, 'd', RTT_SIZE);
+
+        Stopwatch watch;
+        for (int i = 0; i < RTT_ROUNDS; i++) {
+            TEST_ASSERT_EQUAL(RTT_SIZE, udp.sendto(server, buffer, RTT_SIZE));
+            TEST_ASSERT_EQUAL(RTT_SIZE, udp.recvfrom(NULL, buffer, sizeof(buffer)));
+        }
+        report(link, "udp_rtt_ms", watch.elapsedUs() / 1000 / RTT_ROUNDS);
+        udp.close();
+    }
+}
+
+#if SIM_TLS
+/** What a TLS client on the MCU holds, all of it is counted */
+struct TlsClient {
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_x509_crt ca;
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_context ssl;
+};
+
+static int tlsSend(void *context, const unsigned char *buffer, size_t length) {
+    const int r = ((TCPSocket *) context)->send(buffer, (nsapi_size_t) length);
+    return r < 0 ? MBEDTLS_ERR_NET_SEND_FAILED : r;
+}
+
+static int tlsRecv(void *context, unsigned char *buffer, size_t length) {
+    // the socket blocks, would block is its timeout
+    const int r = ((TCPSocket *) context)->recv(buffer, (nsapi_size_t) length);
+    return r == NSAPI_ERROR_WOULD_BLOCK ? MBEDTLS_ERR_SSL_TIMEOUT : r < 0 ? MBEDTLS_ERR_NET_RECV_FAILED : r;
+}
+
+static void mcuHandshake(const LinkModel &link, ModemSimulator &simulator) {
+    mbed_stats_heap_t before, after;
+    TCPSocket socket;
+    tcpConnect(socket, SIM_PORT_TLS);
+
+    mbed_stats_heap_get(&before);
+    const uint32_t serverUs = simulator.tlsServerUs();
+    Stopwatch watch;
+
+    TlsClient *tls = new TlsClient;
+    mbedtls_entropy_init(&tls->entropy);
+    mbedtls_ctr_drbg_init(&tls->drbg);
+    mbedtls_x509_crt_init(&tls->ca);
+    mbedtls_ssl_config_init(&tls->conf);
+    mbedtls_ssl_init(&tls->ssl);
+
+    TEST_ASSERT_EQUAL(0, mbedtls_ctr_drbg_seed(&tls->drbg, mbedtls_entropy_func, &tls->entropy, NULL, 0));
+    TEST_ASSERT_EQUAL(0, mbedtls_x509_crt_parse(&tls->ca, (const unsigned char *) mbedtls_test_cas_pem,
+                                                mbedtls_test_cas_pem_len));
+    TEST_ASSERT_EQUAL(0, mbedtls_ssl_config_defaults(&tls->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                                     MBEDTLS_SSL_PRESET_DEFAULT));
+    mbedtls_ssl_conf_authmode(&tls->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&tls->conf, &tls->ca, NULL);
+    mbedtls_ssl_conf_rng(&tls->conf, mbedtls_ctr_drbg_random, &tls->drbg);
+    TEST_ASSERT_EQUAL(0, mbedtls_ssl_setup(&tls->ssl, &tls->conf));
+    TEST_ASSERT_EQUAL(0, mbedtls_ssl_set_hostname(&tls->ssl, TLS_HOST));
+    mbedtls_ssl_set_bio(&tls->ssl, &socket, tlsSend, tlsRecv, NULL);
+    TEST_ASSERT_EQUAL(0, mbedtls_ssl_handshake(&tls->ssl));
+
+    const int server = (int) (simulator.tlsServerUs() - serverUs);
+    const int elapsed = watch.elapsedUs() - server;
+    const int busy = watch.busyUs() - server;
+    mbed_stats_heap_get(&after);
+    report(link, "tls_mcu_handshake_ms", elapsed / 1000);
+    report(link, "tls_mcu_busy_us", busy > 0 ? busy : 0);
+    report(link, "tls_mcu_heap_bytes", (int) (after.current_size - before.current_size));
+
+    mbedtls_ssl_free(&tls->ssl);
+    mbedtls_ssl_config_free(&tls->conf);
+    mbedtls_x509_crt_free(&tls->ca);
+    mbedtls_ctr_drbg_free(&tls->drbg);
+    mbedtls_entropy_free(&tls->entropy);
+    delete tls;
+    socket.close();
+}
+#endif
+
+static void tlsBenchmark(const LinkModel &link) {
+    ModemSimulator simulator(modem, link);
+    mbed_stats_heap_t before, after;
+    const int tls = 1;
+
+    // the modem does the handshake, the driver waits for +QSSLOPEN
+    {
+        TCPSocket socket;
+        TEST_ASSERT_EQUAL(NSAPI_ERROR_OK, socket.open(&modem));
+        socket.set_timeout(SOCKET_TIMEOUT);
+        TEST_ASSERT_EQUAL(NSAPI_ERROR_OK, socket.setsockopt(M66_SOCKET_LEVEL, M66_TLS, &tls, sizeof(tls)));
+        TEST_ASSERT_EQUAL(NSAPI_ERROR_OK,
+                          socket.setsockopt(M66_SOCKET_LEVEL, M66_TLS_HOSTNAME, TLS_HOST, sizeof(TLS_HOST)));
+
+        mbed_stats_heap_get(&before);
+        Stopwatch watch;
+        TEST_ASSERT_EQUAL(NSAPI_ERROR_OK, socket.connect(SocketAddress(SERVER, SIM_PORT_TLS)));
+        report(link, "tls_modem_handshake_ms", watch.elapsedUs() / 1000);
+        report(link, "tls_modem_busy_us", watch.busyUs());
+        mbed_stats_heap_get(&after);
+        report(link, "tls_modem_heap_bytes", (int) (after.current_size - before.current_size));
+        socket.close();
+    }
+
+#if SIM_TLS
+    // mbedTLS over a plain TCP socket
+    mcuHandshake(link, simulator);
+#endif
+}
+
+void calibrate() {
+    idle.start(idleCount);
+
+    // nothing else runs while this thread waits
+    const uint32_t before = idleLoops;
+    Thread::wait(200);
+    idleLoopsPerMs = (idleLoops - before) / 200;
+    TEST_ASSERT_TRUE_MESSAGE(idleLoopsPerMs > 0, "idle counter does not run");
+}
+
+void benchUnshaped() {
+    benchmark(unshaped);
+}
+
+void benchGPRS() {
+    benchmark(gprs);
+}
+
+void benchTLSUnshaped() {
+    tlsBenchmark(unshaped);
+}
+
+void benchTLSGPRS() {
+    tlsBenchmark(gprs);
+}
+
+utest::v1::status_t greentea_failure_handler(const Case *const source, const failure_t reason) {
+    greentea_case_failure_abort_handler(source, reason);
+    return STATUS_CONTINUE;
+}
+
+Case cases[] = {
+    Case("Socket Calibrate-0", calibrate, greentea_failure_handler),
+    Case("Socket Unshaped-0", benchUnshaped, greentea_failure_handler),
+    Case("Socket GPRS-0", benchGPRS, greentea_failure_handler),
+    Case("Socket TLS-0", benchTLSUnshaped, greentea_failure_handler),
+    Case("Socket TLS-1", benchTLSGPRS, greentea_failure_handler),
+};
+
+utest::v1::status_t greentea_test_setup(const size_t number_of_cases) {
+    GREENTEA_SETUP(300, "m66_benchmark");
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+int main() {
+    Specification specification(greentea_test_setup, cases, greentea_test_teardown_handler);
+    Harness::run(specification);
+}
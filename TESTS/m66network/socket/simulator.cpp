@@ -0,0 +1,322 @@
+/*
+ * ubirch#1 M66 Modem simulator for the socket benchmarks.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simulator.h"
+
+// the TLS server runs on the simulator thread
+#define SIM_THREAD_STACK_SIZE (SIM_TLS ? 8192 : 2048)
+#define SIM_QUEUE_EVENTS      96
+
+// time in ms to move bytes at a rate in bytes/s
+static uint32_t transfer(uint32_t bytes, uint32_t rate) {
+    return rate ? (bytes * 1000 + rate - 1) / rate : 0;
+}
+
+ModemSimulator::ModemSimulator(M66Interface &modem, const LinkModel &link)
+    : _modem(modem), _link(link), _thread(osPriorityAboveNormal, SIM_THREAD_STACK_SIZE),
+      _queue(SIM_QUEUE_EVENTS * EVENTS_EVENT_SIZE), _lineLength(0), _sendId(0), _sendLength(0), _sendLeft(0),
+      _upFree(0), _downFree(0), _out(NULL), _outEnd(&_out), _pumping(false), _tlsServerUs(0) {
+#if SIM_TLS
+    _tls = NULL;
+#endif
+    memset(_ports, 0, sizeof(_ports));
+    _clock.start();
+    // answers must be able to interrupt a parser waiting for them
+    _thread.start(callback(&_queue, &EventQueue::dispatch_forever));
+    _modem.attachTransmit(Callback<void(char)>(this, &ModemSimulator::transmit));
+}
+
+ModemSimulator::~ModemSimulator() {
+    _modem.attachTransmit(NULL);
+    _thread.terminate();
+    while (_out) {
+        message *m = _out;
+        _out = m->next;
+        free(m);
+    }
+#if SIM_TLS
+    if (_tls) {
+        mbedtls_ssl_free(&_tls->ssl);
+        mbedtls_ssl_config_free(&_tls->conf);
+        mbedtls_pk_free(&_tls->key);
+        mbedtls_x509_crt_free(&_tls->cert);
+        mbedtls_ctr_drbg_free(&_tls->drbg);
+        mbedtls_entropy_free(&_tls->entropy);
+        delete _tls;
+    }
+#endif
+}
+
+void ModemSimulator::transmit(char c) {
+    if (_sendLeft) {
+        _sendData[_sendLength++] = c;
+        if (!--_sendLeft) sent();
+        return;
+    }
+
+    if (c == '\r') return;
+    if (c == '\n') {
+        _line[_lineLength] = 0;
+        if (_lineLength) command(_line);
+        _lineLength = 0;
+        return;
+    }
+    if (_lineLength < sizeof(_line) - 1) _line[_lineLength++] = c;
+}
+
+void ModemSimulator::command(const char *line) {
+    char type[4];
+    int id, port, length;
+
+    if (!strcmp("ATV0", line)) {
+        reply(0, "0\r\n");
+    } else if (!strcmp("AT+QISTATE", line)) {
+        // IP INITIAL, all connections free
+        char state[320];
+        size_t used = (size_t) snprintf(state, sizeof(state), "0\r\n");
+        for (int i = 0; i < M66_LINK_COUNT; i++) {
+            used += snprintf(state + used, sizeof(state) - used, "+QISTATE:%d, \"TCP\", \"\", \"\", \"INITIAL\"\r\n", i);
+        }
+        reply(0, "%s0\r\n", state);
+    } else if (sscanf(line, "AT+QIOPEN=%d,\"%3[A-Z]\",\"%*[0-9.]\",\"%d\"", &id, type, &port) == 3
+               && id >= 0 && id < M66_LINK_COUNT) {
+        _ports[id] = port;
+#if SIM_TLS
+        if (port == SIM_PORT_TLS) tlsAccept();
+#endif
+        reply(0, "\r\nOK\r\n");
+        // SYN and SYN-ACK, a UDP connection is only set up in the modem
+        reply(strcmp("TCP", type) ? 0 : 2 * _link.latency, "\r\n%d, CONNECT OK\r\n", id);
+    } else if (sscanf(line, "AT+QSSLOPEN=%d,%*d,\"%*[^\"]\",%d", &id, &port) == 2
+               && id >= 0 && id < M66_LINK_COUNT) {
+        _ports[id] = port;
+        reply(0, "\r\nOK\r\n");
+        // SYN and SYN-ACK, the hello and the server flight, the key exchange and finished
+        const uint32_t handshake = 6 * _link.latency + transfer(SIM_TLS_CLIENT_BYTES, _link.uplink)
+                                   + transfer(SIM_TLS_SERVER_BYTES, _link.downlink) + SIM_TLS_MODEM_MS;
+        reply(handshake, "\r\n+QSSLOPEN: %d,0\r\n", id);
+    } else if (sscanf(line, "AT+QISEND=%d,%d", &id, &length) == 2
+               && id >= 0 && id < M66_LINK_COUNT && length > 0 && length <= M66_MAX_SEND_BYTES) {
+        _sendId = id;
+        _sendLength = 0;
+        _sendLeft = (uint32_t) length;
+        reply(0, "> ");
+    } else if (sscanf(line, "AT+QICLOSE=%d", &id) == 1) {
+        reply(0, "\r\n%d, CLOSE OK\r\n", id);
+    } else {
+        reply(0, "\r\nOK\r\n");
+    }
+}
+
+void ModemSimulator::sent() {
+    const uint32_t now = (uint32_t) _clock.read_ms();
+    const uint32_t start = _upFree > now ? _upFree : now;
+    _upFree = start + transfer(_sendLength, _link.uplink);
+
+    // the modem buffers the data, SEND OK only waits when the buffer is full
+    const uint32_t queued = _link.uplink ? (_upFree - now) * _link.uplink / 1000 : 0;
+    reply(queued > SIM_MODEM_BUFFER ? transfer(queued - SIM_MODEM_BUFFER, _link.uplink) : 0, "\r\nSEND OK\r\n");
+
+#if SIM_TLS
+    // the server needs the stack of the simulator thread
+    if (_ports[_sendId] == SIM_PORT_TLS) {
+        message *m = (message *) malloc(sizeof(message) + _sendLength);
+        if (!m) return;
+        m->next = NULL;
+        m->length = _sendLength;
+        m->offset = 0;
+        memcpy(m + 1, _sendData, _sendLength);
+        if (!_queue.call(this, &ModemSimulator::tlsServe, _sendId, _upFree + _link.latency, m)) free(m);
+        return;
+    }
+#endif
+
+    receive(_upFree + _link.latency, _sendId, _sendData, _sendLength);
+}
+
+void ModemSimulator::receive(uint32_t arrival, int id, const char *data, uint32_t length) {
+    static char chunk[SIM_RECEIVE_SIZE];
+    uint32_t answer = 0;
+
+    if (_ports[id] == SIM_PORT_ECHO || _ports[id] == SIM_PORT_TLS) {
+        // the TLS server has already answered, its records go back as they are
+        answer = length;
+    } else if (_ports[id] == SIM_PORT_CHARGEN) {
+        char count[12];
+        const uint32_t size = length < sizeof(count) - 1 ? length : sizeof(count) - 1;
+        memcpy(count, data, size);
+        count[size] = 0;
+        answer = (uint32_t) atoi(count);
+        if (answer > SIM_CHARGEN_MAX) answer = SIM_CHARGEN_MAX;
+    }
+
+    const uint32_t now = (uint32_t) _clock.read_ms();
+    for (uint32_t offset = 0; offset < answer; offset += SIM_RECEIVE_SIZE) {
+        const uint32_t size = answer - offset < SIM_RECEIVE_SIZE ? answer - offset : SIM_RECEIVE_SIZE;
+        const char *payload = data + offset;
+        if (_ports[id] == SIM_PORT_CHARGEN) {
+            for (uint32_t i = 0; i < size; i++) chunk[i] = (char) ('!' + (offset + i) % 94);
+            payload = chunk;
+        }
+
+        // a packet is reported when its last byte reached the modem
+        const uint32_t start = arrival + _link.latency > _downFree ? arrival + _link.latency : _downFree;
+        _downFree = start + transfer(size, _link.downlink);
+
+        char header[32];
+        const int headerLength = snprintf(header, sizeof(header), "\r\n+RECEIVE: %d, %u\r\n", id, (unsigned) size);
+        post(_downFree > now ? _downFree - now : 0, header, (size_t) headerLength, payload, size);
+    }
+}
+
+void ModemSimulator::reply(uint32_t delay, const char *format, ...) {
+    char text[384];
+
+    va_list ap;
+    va_start(ap, format);
+    const int length = vsnprintf(text, sizeof(text), format, ap);
+    va_end(ap);
+
+    post(delay, text, (size_t) length, NULL, 0);
+}
+
+void ModemSimulator::post(uint32_t delay, const char *header, size_t headerLength, const void *data, size_t length) {
+    message *m = (message *) malloc(sizeof(message) + headerLength + length);
+    if (!m) return;
+
+    m->next = NULL;
+    m->length = headerLength + length;
+    m->offset = 0;
+    memcpy(m + 1, header, headerLength);
+    if (length) memcpy((char *) (m + 1) + headerLength, data, length);
+
+    if (!_queue.call_in((int) delay, this, &ModemSimulator::deliver, m)) free(m);
+}
+
+void ModemSimulator::deliver(message *m) {
+    *_outEnd = m;
+    _outEnd = &m->next;
+    if (!_pumping) pump();
+}
+
+void ModemSimulator::pump() {
+    // what the UART moves in a millisecond
+    size_t budget = _link.uart ? (_link.uart >= 1000 ? _link.uart / 1000 : 1) : (size_t) -1;
+    _pumping = false;
+
+    while (_out && budget) {
+        message *m = _out;
+        const size_t left = m->length - m->offset;
+        const size_t size = left < budget ? left : budget;
+        const size_t taken = _modem.inject((const char *) (m + 1) + m->offset, size);
+
+        m->offset += taken;
+        budget -= taken;
+        if (m->offset == m->length) {
+            _out = m->next;
+            if (!_out) _outEnd = &_out;
+            free(m);
+        }
+        // the receive buffer of the parser is full
+        if (taken < size) break;
+    }
+
+    if (_out) {
+        _pumping = true;
+        _queue.call_in(1, this, &ModemSimulator::pump);
+    }
+}
+
+#if SIM_TLS
+void ModemSimulator::tlsAccept() {
+    if (_tls) {
+        mbedtls_ssl_session_reset(&_tls->ssl);
+    } else {
+        _tls = new tls_server;
+        mbedtls_entropy_init(&_tls->entropy);
+        mbedtls_ctr_drbg_init(&_tls->drbg);
+        mbedtls_x509_crt_init(&_tls->cert);
+        mbedtls_pk_init(&_tls->key);
+        mbedtls_ssl_config_init(&_tls->conf);
+        mbedtls_ssl_init(&_tls->ssl);
+
+        // a server that failed to set up fails the handshake of the client
+        if (!mbedtls_ctr_drbg_seed(&_tls->drbg, mbedtls_entropy_func, &_tls->entropy, NULL, 0)
+            && !mbedtls_x509_crt_parse(&_tls->cert, (const unsigned char *) mbedtls_test_srv_crt,
+                                       mbedtls_test_srv_crt_len)
+            && !mbedtls_pk_parse_key(&_tls->key, (const unsigned char *) mbedtls_test_srv_key,
+                                     mbedtls_test_srv_key_len, NULL, 0)
+            && !mbedtls_ssl_config_defaults(&_tls->conf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                            MBEDTLS_SSL_PRESET_DEFAULT)
+            && !mbedtls_ssl_conf_own_cert(&_tls->conf, &_tls->cert, &_tls->key)) {
+            mbedtls_ssl_conf_rng(&_tls->conf, mbedtls_ctr_drbg_random, &_tls->drbg);
+            mbedtls_ssl_setup(&_tls->ssl, &_tls->conf);
+        }
+        mbedtls_ssl_set_bio(&_tls->ssl, _tls, tlsSend, tlsRecv, NULL);
+    }
+    _tls->inLength = _tls->inOffset = _tls->outLength = 0;
+}
+
+void ModemSimulator::tlsServe(int id, uint32_t arrival, message *m) {
+    const size_t room = sizeof(_tls->in) - _tls->inLength;
+    const size_t size = m->length < room ? m->length : room;
+    memcpy(_tls->in + _tls->inLength, m + 1, size);
+    _tls->inLength += size;
+    free(m);
+
+    // as far as the records of the client go, a finished handshake does nothing
+    Timer busy;
+    busy.start();
+    _tls->outLength = 0;
+    mbedtls_ssl_handshake(&_tls->ssl);
+    busy.stop();
+    _tlsServerUs += (uint32_t) busy.read_us();
+
+    // the answer leaves the server when it is done
+    const uint32_t now = (uint32_t) _clock.read_ms();
+    if (_tls->outLength) receive(arrival > now ? arrival : now, id, _tls->out, (uint32_t) _tls->outLength);
+}
+
+int ModemSimulator::tlsRecv(void *context, unsigned char *buffer, size_t length) {
+    tls_server *tls = (tls_server *) context;
+    if (tls->inOffset == tls->inLength) return MBEDTLS_ERR_SSL_WANT_READ;
+
+    const size_t left = tls->inLength - tls->inOffset;
+    const size_t size = length < left ? length : left;
+    memcpy(buffer, tls->in + tls->inOffset, size);
+    tls->inOffset += size;
+    if (tls->inOffset == tls->inLength) tls->inOffset = tls->inLength = 0;
+    return (int) size;
+}
+
+int ModemSimulator::tlsSend(void *context, const unsigned char *buffer, size_t length) {
+    tls_server *tls = (tls_server *) context;
+    const size_t room = sizeof(tls->out) - tls->outLength;
+    if (!room) return MBEDTLS_ERR_SSL_WANT_WRITE;
+
+    const size_t size = length < room ? length : room;
+    memcpy(tls->out + tls->outLength, buffer, size);
+    tls->outLength += size;
+    return (int) size;
+}
+#endif
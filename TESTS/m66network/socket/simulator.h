@@ -0,0 +1,153 @@
+/*!
+ * A simulated M66 with a server behind a shaped link, for benchmarking the
+ * whole socket path without a modem or a network.
+ *
+ * The simulator answers the AT commands the socket path uses and sends the
+ * data of every connection to a server at 10.0.0.1: port 7 echoes, port 9
+ * discards and port 19 answers a decimal byte count with that many bytes.
+ * Port 443 is an mbedTLS server with the mbedTLS test certificate, for a
+ * TLS client on the MCU. A TLS connection of the modem (AT+QSSLOPEN) only
+ * takes the time of a handshake. The link model delays and limits the data
+ * like a cellular network and the UART does.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+#ifndef M66_SIMULATOR_H
+#define M66_SIMULATOR_H
+
+#include "mbed.h"
+#include "M66Interface.h"
+#include "M66Replay.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/certs.h"
+
+#if defined(MBEDTLS_SSL_CLI_C) && defined(MBEDTLS_SSL_SRV_C) && defined(MBEDTLS_CERTS_C)
+#  define SIM_TLS 1
+#else
+#  define SIM_TLS 0
+#endif
+
+#define SIM_PORT_ECHO        7
+#define SIM_PORT_DISCARD     9
+#define SIM_PORT_CHARGEN     19
+#define SIM_PORT_TLS         443
+#define SIM_MODEM_BUFFER     4096   // data the modem takes before SEND OK waits for the uplink
+#define SIM_RECEIVE_SIZE     1024   // largest +RECEIVE the modem reports
+#define SIM_CHARGEN_MAX      65536
+#define SIM_TLS_BUFFER       4096   // handshake records in each direction
+#define SIM_TLS_MODEM_MS     1500   // the crypto of a handshake in the modem, compare tls_handshake_ms of the modem suite
+#define SIM_TLS_CLIENT_BYTES 350    // the client flights of a full handshake
+#define SIM_TLS_SERVER_BYTES 1900   // the server flight, mostly the certificate
+
+/** Link between the modem and the server, 0 means unlimited */
+struct LinkModel {
+    const char *name;
+    uint32_t uplink;    //!< bytes/s from the modem to the server
+    uint32_t downlink;  //!< bytes/s from the server to the modem
+    uint32_t latency;   //!< one way, ms
+    uint32_t uart;      //!< bytes/s from the modem to the MCU
+};
+
+class ModemSimulator {
+public:
+    /**
+     * Take over the UART of the modem interface, the real modem should be off.
+     *
+     * @param modem the interface to answer
+     * @param link  the link model
+     */
+    ModemSimulator(M66Interface &modem, const LinkModel &link);
+
+    ~ModemSimulator();
+
+    /**
+     * The server behind SIM_PORT_TLS runs on this MCU, its time is not part
+     * of what a TLS client costs.
+     *
+     * @return the time in us the server was busy
+     */
+    uint32_t tlsServerUs() const {
+        return _tlsServerUs;
+    }
+
+private:
+    /** Bytes for the parser, delivered in order */
+    struct message {
+        message *next;
+        size_t length;
+        size_t offset;
+        // data follows
+    };
+
+    M66Replay _modem;
+    LinkModel _link;
+    Thread _thread;
+    EventQueue _queue;
+    Timer _clock;
+
+    // the command the parser is writing, and the data of an AT+QISEND
+    char _line[96];
+    size_t _lineLength;
+    int _sendId;
+    uint32_t _sendLength, _sendLeft;
+    char _sendData[M66_MAX_SEND_BYTES];
+    int _ports[M66_LINK_COUNT];
+
+    // when the uplink and the downlink are free again, ms on _clock
+    uint32_t _upFree, _downFree;
+
+    // touched by the simulator thread only
+    message *_out, **_outEnd;
+    bool _pumping;
+
+    // the server behind SIM_PORT_TLS, one connection at a time, and its busy time
+    uint32_t _tlsServerUs;
+#if SIM_TLS
+    struct tls_server {
+        mbedtls_entropy_context entropy;
+        mbedtls_ctr_drbg_context drbg;
+        mbedtls_x509_crt cert;
+        mbedtls_pk_context key;
+        mbedtls_ssl_config conf;
+        mbedtls_ssl_context ssl;
+        // records of the client not read yet, and the answer to them
+        char in[SIM_TLS_BUFFER];
+        size_t inLength, inOffset;
+        char out[SIM_TLS_BUFFER];
+        size_t outLength;
+    } *_tls;
+#endif
+
+    void transmit(char c);
+    void command(const char *line);
+    void sent();
+    void receive(uint32_t arrival, int id, const char *data, uint32_t length);
+    void reply(uint32_t delay, const char *format, ...);
+    void post(uint32_t delay, const char *header, size_t headerLength, const void *data, size_t length);
+    void deliver(message *m);
+    void pump();
+#if SIM_TLS
+    void tlsAccept();
+    void tlsServe(int id, uint32_t arrival, message *m);
+    static int tlsRecv(void *context, unsigned char *buffer, size_t length);
+    static int tlsSend(void *context, const unsigned char *buffer, size_t length);
+#endif
+};
+
+#endif
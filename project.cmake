@@ -1,2 +1,5 @@
 add_executable(test-modem TESTS/m66network/modem/main.cpp TESTS/m66network/modem/config.h)
-add_executable(test-timestamp TESTS/m66network/unixTimestamp/unixTimestamp.cpp TESTS/m66network/unixTimestamp/config.h)
\ No newline at end of file
+add_executable(test-timestamp TESTS/m66network/unixTimestamp/unixTimestamp.cpp TESTS/m66network/unixTimestamp/config.h)
+add_executable(test-replay TESTS/m66network/replay/main.cpp TESTS/m66network/replay/recordings.h TESTS/m66network/replay/config.h)
+add_executable(test-benchmark TESTS/m66network/benchmark/main.cpp TESTS/m66network/benchmark/config.h)
+add_executable(test-socket TESTS/m66network/socket/main.cpp TESTS/m66network/socket/simulator.cpp TESTS/m66network/socket/simulator.h TESTS/m66network/socket/config.h)
\ No newline at end of file
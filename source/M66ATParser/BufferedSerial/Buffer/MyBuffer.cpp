@@ -24,9 +24,9 @@
 #include "MyBuffer.h"
 
 template <class T>
-MyBuffer<T>::MyBuffer(uint32_t size)
+MyBuffer<T>::MyBuffer(T *storage, uint32_t size)
 {
-    _buf = new T [size];
+    _buf = storage;
     _size = size;
     clear();
     
@@ -36,8 +36,6 @@ MyBuffer<T>::MyBuffer(uint32_t size)
 template <class T>
 MyBuffer<T>::~MyBuffer()
 {
-    delete [] _buf;
-    
     return;
 }
 
@@ -63,14 +61,5 @@ uint32_t MyBuffer<T>::peek(char c)
     return 1;
 }
 
-// make the linker aware of some possible types
-template class MyBuffer<uint8_t>;
-template class MyBuffer<int8_t>;
-template class MyBuffer<uint16_t>;
-template class MyBuffer<int16_t>;
-template class MyBuffer<uint32_t>;
-template class MyBuffer<int32_t>;
-template class MyBuffer<uint64_t>;
-template class MyBuffer<int64_t>;
+// the only type BufferedSerial uses, add others here when needed
 template class MyBuffer<char>;
-template class MyBuffer<wchar_t>;
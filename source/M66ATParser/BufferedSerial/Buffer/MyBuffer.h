@@ -34,7 +34,8 @@
  *  #include "mbed.h"
  *  #include "MyBuffer.h"
  *
- *  MyBuffer <char> buf;
+ *  char storage[0x100];
+ *  MyBuffer <char> buf(storage, sizeof(storage));
  *
  *  int main()
  *  {
@@ -67,17 +68,18 @@ private:
     uint32_t            _size;
 
 public:
-    /** Create a Buffer and allocate memory for it
-     *  @param size The size of the buffer
+    /** Create a Buffer in memory owned by the caller, nothing is allocated
+     *  @param storage The memory for the elements, it must outlive the buffer
+     *  @param size The size of the buffer in elements
      */
-    MyBuffer(uint32_t size = 0x100);
+    MyBuffer(T *storage, uint32_t size);
     
     /** Get the size of the ring buffer
      * @return the size of the ring buffer
      */
      uint32_t getSize();
     
-    /** Destry a Buffer and release it's allocated memory
+    /** Destroy a Buffer, the storage stays with the caller
      */
     ~MyBuffer();
     
@@ -104,6 +106,11 @@ public:
      *  @return 1 if something can be read, 0 otherwise
      */
     uint32_t available(void);
+
+    /** Determine if the buffer is full, another put() would overwrite everything
+     *  @return 1 if the buffer is full, 0 otherwise
+     */
+    uint32_t full(void);
     
     /** Overloaded operator for writing to the buffer
      *  @param data Something to put in the buffer
@@ -159,5 +166,11 @@ inline uint32_t MyBuffer<T>::available(void)
     return (_wloc == _rloc) ? 0 : 1;
 }
 
+template <class T>
+inline uint32_t MyBuffer<T>::full(void)
+{
+    return ((_wloc + 1) % (_size-1) == _rloc) ? 1 : 0;
+}
+
 #endif
 
@@ -19,23 +19,24 @@
 #include <stdio.h>
 #include <string.h>
 
-#include "mbed_error.h"
+#ifndef BUFFERED_PRINTF_SIZE
+#  define BUFFERED_PRINTF_SIZE 128
+#endif
 
 size_t BufferedSerialThunk(void *buf_serial, const void *s, size_t length);
 
 int BufferedPrintfC(void *stream, int size, const char* format, va_list arg)
 {
     int r;
-    char buffer[512];
-    if (size >= 512) {
-        return -1;
+    // on the stack of the caller, keep it small and do not clear it, vsnprintf() terminates
+    char buffer[BUFFERED_PRINTF_SIZE];
+    if (size > BUFFERED_PRINTF_SIZE) {
+        size = BUFFERED_PRINTF_SIZE;
     }
-    memset(buffer, 0, size);
-    r = vsprintf(buffer, format, arg);
-    // this may not hit the heap but should alert the user anyways
-    if(r > (int32_t) size) {
-        error("%s %d buffer overwrite (max_buf_size: %d exceeded: %d)!\r\n", __FILE__, __LINE__, size, r);
-        return 0;
+    r = vsnprintf(buffer, size, format, arg);
+    // a longer text is cut, nothing is overwritten
+    if (r >= size) {
+        r = size - 1;
     }
     if ( r > 0 ) {
         BufferedSerialThunk(stream, buffer, r);
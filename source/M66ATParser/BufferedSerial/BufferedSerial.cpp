@@ -22,15 +22,23 @@
 
 #include "BufferedSerial.h"
 #include <stdarg.h>
+#include <string.h>
+
+#define CAPTURE_HEADER_SIZE 4
 
 extern "C" int BufferedPrintfC(void *stream, int size, const char* format, va_list arg);
 
-BufferedSerial::BufferedSerial(PinName tx, PinName rx, uint32_t buf_size, uint32_t tx_multiple, const char* name)
-    : RawSerial(tx, rx) , _rxbuf(buf_size), _txbuf((uint32_t)(tx_multiple*buf_size))
+BufferedSerial::BufferedSerial(PinName tx, PinName rx, char *rx_buf, uint32_t rx_size, char *tx_buf, uint32_t tx_size,
+                               const char* name)
+    : RawSerial(tx, rx) , _rxbuf(rx_buf, rx_size), _txbuf(tx_buf, tx_size), _overflows(0),
+      _transmitted(0), _offline(false), _rxReady(0, 1), _rxWaiting(false)
 {
+#if M66_CAPTURE
+    _capture = NULL;
+    _capture_used = 0;
+#endif
     RawSerial::attach(this, &BufferedSerial::rxIrq, Serial::RxIrq);
-    this->_buf_size = buf_size;
-    this->_tx_multiple = tx_multiple;   
+    this->_buf_size = tx_size;
     return;
 }
 
@@ -47,6 +55,24 @@ int BufferedSerial::readable(void)
     return _rxbuf.available();  // note: look if things are in the buffer
 }
 
+int BufferedSerial::waitReadable(uint32_t ms)
+{
+    // the receive interrupt only signals while someone waits, a byte arriving
+    // between the flag and the check leaves a token that ends one later wait early
+    _rxWaiting = true;
+    if (!_rxbuf.available()) {
+        _rxReady.wait(ms);
+    }
+    _rxWaiting = false;
+
+    return _rxbuf.available();
+}
+
+uint32_t BufferedSerial::overflows(void)
+{
+    return _overflows;
+}
+
 int BufferedSerial::writeable(void)
 {
     return 1;   // buffer allows overwriting by design, always true
@@ -59,7 +85,7 @@ int BufferedSerial::getc(void)
 
 int BufferedSerial::putc(int c)
 {
-    _txbuf = (char)c;
+    BufferedSerial::transmit((char)c);
     BufferedSerial::prime();
 
     return c;
@@ -71,9 +97,9 @@ int BufferedSerial::puts(const char *s)
         const char* ptr = s;
     
         while(*(ptr) != 0) {
-            _txbuf = *(ptr++);
+            BufferedSerial::transmit(*(ptr++));
         }
-        _txbuf = '\n';  // done per puts definition
+        BufferedSerial::transmit('\n');  // done per puts definition
         BufferedSerial::prime();
     
         return (ptr - s) + 1;
@@ -103,7 +129,7 @@ ssize_t BufferedSerial::write(const void *s, size_t length)
         const char* end = ptr + length;
     
         while (ptr != end) {
-            _txbuf = *(ptr++);
+            BufferedSerial::transmit(*(ptr++));
         }
         BufferedSerial::prime();
     
@@ -117,7 +143,20 @@ void BufferedSerial::rxIrq(void)
 {
     // read from the peripheral and make sure something is available
     if(serial_readable(&_serial)) {
-        _rxbuf = serial_getc(&_serial); // if so load them into a buffer
+        char c = serial_getc(&_serial);
+#if M66_CAPTURE
+        if (_capture != NULL) BufferedSerial::record(CaptureRx, c);
+#endif
+        // writing into a full buffer would make it look empty, lose this byte only
+        if (_rxbuf.full()) {
+            _overflows++;
+        } else {
+            _rxbuf = c; // if so load them into a buffer
+        }
+        if (_rxWaiting) {
+            _rxWaiting = false;
+            _rxReady.release();
+        }
         // trigger callback if necessary
         if (_cbs[RxIrq]) {
             _cbs[RxIrq]();
@@ -127,6 +166,132 @@ void BufferedSerial::rxIrq(void)
     return;
 }
 
+void BufferedSerial::transmit(char c)
+{
+#if M66_CAPTURE
+    if (_capture != NULL) BufferedSerial::record(CaptureTx, c);
+#endif
+    _transmitted++;
+    if (_tap) {
+        _tap(c);
+    }
+    if (!_offline) {
+        _txbuf = c;
+    }
+
+    return;
+}
+
+void BufferedSerial::capture(uint8_t *buffer, uint32_t size)
+{
+#if M66_CAPTURE
+    core_util_critical_section_enter();
+    if (buffer == NULL) {
+        _capture = NULL;    // keep what was recorded
+    } else if (size >= CAPTURE_HEADER_SIZE) {
+        memcpy(buffer, "M66C", CAPTURE_HEADER_SIZE);
+        _capture_size = size;
+        _capture_used = CAPTURE_HEADER_SIZE;
+        _capture_record = 0;
+        _capture_time = _capture_last = us_ticker_read();
+        _capture = buffer;
+    }
+    core_util_critical_section_exit();
+#endif
+
+    return;
+}
+
+uint32_t BufferedSerial::captured(void)
+{
+#if M66_CAPTURE
+    return _capture_used;
+#else
+    return 0;
+#endif
+}
+
+#if M66_CAPTURE
+void BufferedSerial::record(uint8_t type, char c)
+{
+    const uint32_t now = us_ticker_read();
+
+    // both directions record, the tx side from thread context
+    core_util_critical_section_enter();
+    if (_capture != NULL) {
+        uint8_t *open = _capture + _capture_record;
+        if (_capture_record && open[0] == type && open[1] < 0xFF && now - _capture_last < M66_CAPTURE_GAP_US) {
+            if (_capture_used < _capture_size) {
+                open[1]++;
+                _capture[_capture_used++] = (uint8_t)c;
+            }
+        } else if (_capture_used + CAPTURE_HEADER_SIZE + 1 <= _capture_size) {
+            const uint32_t delay = now - _capture_time;
+            uint16_t stamp = 0xFFFF;
+            if (delay < 0x8000) {
+                stamp = (uint16_t)delay;
+            } else if (delay / 1000 < 0x8000) {
+                stamp = (uint16_t)(0x8000 | delay / 1000);
+            }
+
+            _capture_record = _capture_used;
+            _capture[_capture_used++] = type;
+            _capture[_capture_used++] = 1;
+            _capture[_capture_used++] = (uint8_t)stamp;
+            _capture[_capture_used++] = (uint8_t)(stamp >> 8);
+            _capture[_capture_used++] = (uint8_t)c;
+            _capture_time = now;
+        }
+        _capture_last = now;
+    }
+    core_util_critical_section_exit();
+
+    return;
+}
+#endif
+
+std::size_t BufferedSerial::inject(const void *data, std::size_t length)
+{
+    const char *ptr = (const char *)data;
+    std::size_t taken = 0;
+
+    // the receive interrupt writes to the same buffer
+    core_util_critical_section_enter();
+    while (taken < length && !_rxbuf.full()) {
+        _rxbuf = ptr[taken++];
+    }
+    core_util_critical_section_exit();
+
+    if (taken && _rxWaiting) {
+        _rxWaiting = false;
+        _rxReady.release();
+    }
+    if (taken && _cbs[RxIrq]) {
+        _cbs[RxIrq]();
+    }
+
+    return taken;
+}
+
+void BufferedSerial::offline(bool enable)
+{
+    _offline = enable;
+
+    return;
+}
+
+void BufferedSerial::tap(Callback<void(char)> func)
+{
+    _tap = func;
+
+    return;
+}
+
+uint32_t BufferedSerial::transmitted(void)
+{
+    return _transmitted;
+}
+
 void BufferedSerial::txIrq(void)
 {
     // see if there is room in the hardware fifo and if something is in the software fifo
@@ -27,6 +27,13 @@
 #include "mbed.h"
 #include "MyBuffer.h"
 
+#ifndef M66_CAPTURE
+#  define M66_CAPTURE        1
+#endif
+#ifndef M66_CAPTURE_GAP_US
+#  define M66_CAPTURE_GAP_US 2000
+#endif
+
 /** A serial port (UART) for communication with other serial devices
  *
  * Can be used for Full Duplex communication, or Simplex by specifying
@@ -37,7 +44,8 @@
  *  #include "mbed.h"
  *  #include "BufferedSerial.h"
  *
- *  BufferedSerial pc(USBTX, USBRX);
+ *  char rx[256], tx[1024];
+ *  BufferedSerial pc(USBTX, USBRX, rx, sizeof(rx), tx, sizeof(tx));
  *
  *  int main()
  *  { 
@@ -74,33 +82,70 @@ private:
     MyBuffer <char> _rxbuf;
     MyBuffer <char> _txbuf;
     uint32_t      _buf_size;
-    uint32_t      _tx_multiple;
+    volatile uint32_t _overflows;
+    uint32_t      _transmitted;
+    bool          _offline;
+    Semaphore     _rxReady;
+    volatile bool _rxWaiting;
+#if M66_CAPTURE
+    uint8_t * volatile _capture;
+    uint32_t      _capture_size;
+    uint32_t      _capture_used;
+    uint32_t      _capture_record;
+    uint32_t      _capture_time;
+    uint32_t      _capture_last;
+
+    void record(uint8_t type, char c);
+#endif
  
     void rxIrq(void);
     void txIrq(void);
     void prime(void);
+    void transmit(char c);
 
     Callback<void()> _cbs[2];
+    Callback<void(char)> _tap;
     
 public:
     /** Create a BufferedSerial port, connected to the specified transmit and receive pins
      *  @param tx Transmit pin
      *  @param rx Receive pin
-     *  @param buf_size printf() buffer size
-     *  @param tx_multiple amount of max printf() present in the internal ring buffer at one time
+     *  @param rx_buf memory of the receive ring buffer, owned by the caller
+     *  @param rx_size size of the receive ring buffer
+     *  @param tx_buf memory of the transmit ring buffer, owned by the caller
+     *  @param tx_size size of the transmit ring buffer, printf() uses at most BUFFERED_PRINTF_SIZE (128) of it at once
      *  @param name optional name
-     *  @note Either tx or rx may be specified as NC if unused
+     *  @note Either tx or rx may be specified as NC if unused, nothing is allocated
      */
-    BufferedSerial(PinName tx, PinName rx, uint32_t buf_size = 256, uint32_t tx_multiple = 4,const char* name=NULL);
+    BufferedSerial(PinName tx, PinName rx, char *rx_buf, uint32_t rx_size, char *tx_buf, uint32_t tx_size,
+                   const char* name=NULL);
     
     /** Destroy a BufferedSerial port
      */
     virtual ~BufferedSerial(void);
     
+    /** Record types of a capture, see capture()
+     */
+    enum CaptureType {
+        CaptureRx = 'R',
+        CaptureTx = 'T'
+    };
+
     /** Check on how many bytes are in the rx buffer
      *  @return 1 if something exists, 0 otherwise
      */
     virtual int readable(void);
+
+    /** Block the calling thread until something is received, other threads run meanwhile
+     *  @param ms the time to wait at most in ms
+     *  @return 1 if something exists, 0 otherwise
+     */
+    int waitReadable(uint32_t ms);
+
+    /** Check how many received bytes were lost because the rx buffer was full
+     *  @return the number of lost bytes since the port was created
+     */
+    uint32_t overflows(void);
     
     /** Check to see if the tx buffer has room
      *  @return 1 always has room and can overwrite previous content if too small / slow
@@ -125,7 +170,8 @@ public:
      */
     virtual int puts(const char *s);
     
-    /** Write a formatted string to the BufferedSerial Port.
+    /** Write a formatted string to the BufferedSerial Port, longer texts than the
+     *  printf() buffer size are cut. The text is formatted on the stack of the caller.
      *  @param format The string + format specifiers to write to the Serial Port
      *  @return The number of bytes written to the Serial Port Buffer
      */
@@ -138,6 +184,49 @@ public:
      */
     virtual ssize_t write(const void *s, std::size_t length);
 
+    /** Record both directions of the port into a buffer. The capture starts
+     *  with "M66C", followed by records of consecutive bytes in one direction:
+     *  @code
+     *  uint8 type ('R' or 'T') | uint8 length | uint16 delay | length bytes
+     *  @endcode
+     *  The delay (little endian) is the time since the previous record started,
+     *  in us below 0x8000, else in ms ored with 0x8000. A record is continued
+     *  while its bytes are less than M66_CAPTURE_GAP_US apart. Recording stops
+     *  silently when the buffer is full.
+     *  @param buffer where to record or NULL to stop recording
+     *  @param size size of the buffer
+     */
+    void capture(uint8_t *buffer, uint32_t size);
+
+    /** Check the size of the capture
+     *  @return the bytes used in the capture buffer, also after recording stopped
+     */
+    uint32_t captured(void);
+
+    /** Feed data into the rx buffer as if it was received, the rx callback is called once
+     *  @param data the data to receive
+     *  @param length the amount of data
+     *  @return the amount taken, less than length if the rx buffer is full
+     */
+    std::size_t inject(const void *data, std::size_t length);
+
+    /** Discard everything written instead of sending it, to replay a capture
+     *  without a modem answering
+     *  @param enable true to discard, false to send again
+     */
+    void offline(bool enable);
+
+    /** Call a function with every byte written, in the context of the writer,
+     *  e.g. to let a simulated device answer while offline
+     *  @param func A pointer to a void function, or 0 to set as none
+     */
+    void tap(Callback<void(char)> func);
+
+    /** Check how many bytes were written
+     *  @return the number of bytes written (or discarded while offline) since the port was created
+     */
+    uint32_t transmitted(void);
+
     /** Attach a function to call whenever a serial interrupt is generated
      *  @param func A pointer to a void function, or 0 to set as none
      *  @param type Which serial interrupt to attach the member function to (Serial::RxIrq for receive, TxIrq for transmit buffer empty)
@@ -23,35 +23,67 @@
 
 #include <cctype>
 #include <fsl_rtc.h>
-#include <string>
 #include "mbed_debug.h"
 #include "M66ATParser.h"
 #include "M66Types.h"
+#include "M66Retry.h"
+#include "M66Trace.h"
+#include "M66Clock.h"
 
-#ifdef NCIODEBUG
-#  define CIODUMP(buffer, size)
-#  define CIODEBUG(...)
+#if M66_TRACE_LEVEL >= 1
+#  define CSTDEBUG(...)         M66Trace::info(__LINE__, __VA_ARGS__)  /*!< Status message, format looked up by line */
+#else
 #  define CSTDEBUG(...)
+#endif
+#if M66_TRACE_LEVEL >= 2
+#  define CIOTRACE(event, line) M66Trace::text(event, __LINE__, line)  /*!< AT line sent or received */
 #else
-#  define CIODUMP(buffer, size) _debug_dump("GSM", buffer, size) /*!< Debug and dump a buffer */
-#  define CIODEBUG(...)  printf(__VA_ARGS__)                     /*!< Debug I/O message (AT commands) */
-#  define CSTDEBUG(...)  printf(__VA_ARGS__)                     /*!< Standard debug message (info) */
-//#  define CSTDEBUG(fmt, ...) printf("%10.10s:%d::" fmt, __FUNCTION__, __LINE__, ##__VA_ARGS__);
-//#  define CIODEBUG(fmt, ...) printf("%10.10s:%d::" fmt, __FUNCTION__, __LINE__, ##__VA_ARGS__);
+#  define CIOTRACE(event, line)
+#endif
+#if M66_TRACE_LEVEL >= 3
+#  define CIODUMP(buffer, size) M66Trace::data(__LINE__, buffer, size) /*!< Payload sent or received */
+#else
+#  define CIODUMP(buffer, size)
 #endif
 
 #define GSM_UART_BAUD_RATE 115200
-#define RXTX_BUFFER_SIZE   512
-#define MAX_SEND_BYTES     1400
+#define MAX_SEND_BYTES     M66_MAX_SEND_BYTES
+#define LINE_TIMEOUT       1000   // ms, for the rest of a line or data that already started
+#define BOOT_TIMEOUT       10000  // ms, for the first answer after switching the modem on
+#define SEND_TIMEOUT       20000  // ms, from the data to SEND OK
+
+// bytes a packet of len bytes takes in the packet store
+#define PACKET_RECORD(len) (sizeof(struct packet) + (((len) + 3u) & ~3u))
 
 
 M66ATParser::M66ATParser(PinName txPin, PinName rxPin, PinName rstPin, PinName pwrPin)
-    : _serial(txPin, rxPin, RXTX_BUFFER_SIZE),
+    : _serial(txPin, rxPin, _serialRx, sizeof(_serialRx), _serialTx, sizeof(_serialTx)),
       _powerPin(pwrPin),
       _resetPin(rstPin),
+#if M66_STATIC_PACKETS
+      _packetUsed(0),
+#else
       _packets(0),
       _packets_end(&_packets),
-      networkTimeSynchronised(false){
+#endif
+      _datagrams(0),
+      _dataLost(0),
+      networkTimeSynchronised(false),
+      _timeout(0){
+    memset((void *) _links, LINK_CLOSED, sizeof(_links));
+    _line[0] = '\0';
+    _lineLength = 0;
+    _remoteIp[0] = '\0';
+    _remotePort = 0;
+    _inflightHead = _inflightCount = 0;
+    _sendFailed = 0;
+    _clientService = false;
+    _secure = _sslPending = 0;
+    _sslReady = false;
+    _sslCa = NULL;
+    _sslResult = SSL_OK;
+    memset(&_stats, 0, sizeof(_stats));
+    _sent = CMD_COUNT;
     _serial.baud(GSM_UART_BAUD_RATE);
     _powerPin = 0;
 }
@@ -59,17 +91,22 @@ M66ATParser::M66ATParser(PinName txPin, PinName rxPin, PinName rstPin, PinName p
 bool M66ATParser::startup(void) {
     //When the board comes nack from deep sleep mode make sure the modem is restarted
     _powerPin = 0;
-    wait_ms(200);
+    M66Clock::sleep(200);
     _powerPin = 1;
-    wait_ms(200);
+    M66Clock::sleep(200);
 
-    bool success = reset() && tx("AT+QIMUX=1") && rx("OK");
+    bool success = reset();
+
+    // report the sender of received data, optional: recvfrom() falls back to the connected peer
+    if (M66_UDP && success && !command(CMD_SHOW_ADDRESS, NULL, 0)) {
+        CSTDEBUG("M66 [--] !! no remote address reporting\r\n");
+    }
     return success;
 }
 
 bool M66ATParser::powerDown(void) {
     //TODO call this function if connection fails or on some unexpected events
-    bool normalPowerDown = tx("AT+QPOWD=1") && rx("NORMAL POWER DOWN", 20);
+    bool normalPowerDown = command(CMD_POWER_DOWN, NULL, 0);
 
     _powerPin =  0;
 
@@ -77,47 +114,57 @@ bool M66ATParser::powerDown(void) {
 }
 
 bool M66ATParser::isModemAlive() {
-    return (tx("AT") && rx("OK"));
+    return command(CMD_AT, NULL, 0);
 }
 
 int M66ATParser::checkGPRS() {
     int val = -1;
     if (!isModemAlive())
         return false;
-    int ret = (tx("AT+CGATT?") && scan("+CGATT: %d", &val) && rx("OK", 10));
+    M66Field attached[] = {&val};
+    int ret = command(CMD_ATTACHED, attached, 1);
     return val && ret;
 }
 
 bool M66ATParser::reset(void) {
     char response[4];
 
+    // forget what the modem was doing before
+    _inflightHead = _inflightCount = 0;
+    _clientService = false;
+    _secure = _sslPending = 0;
+    _sslReady = false;
+
     bool modemOn = false;
     for (int tries = 0; !modemOn && tries < 3; tries++) {
         CSTDEBUG("M66 [--] !! reset (%d)\r\n", tries);
         // switch on modem
         _resetPin = 1;
-        wait_ms(200);
+        M66Clock::sleep(200);
         _resetPin = 0;
-        wait_ms(1000);
+        M66Clock::sleep(1000);
         _resetPin = 1;
 
-        if (isModemAlive()) return true;
+        // already up, e.g. after a restart of the MCU alone
+        modemOn = isModemAlive();
 
-        // TODO check if need delay here to wait for boot
         for (int i = 0; !modemOn && i < 1; i++) {
-            modemOn = (tx("AT") && scan("%2s", &response)
+            // the modem may still be booting
+            tx(CMD_AT);
+            setDeadline(M66Deadline(BOOT_TIMEOUT));
+            modemOn = (scan("%2s", &response)
                        && (!strncmp("AT", response, 2) || !strncmp("OK", response, 2)));
 
-            wait_ms(500);
+            M66Clock::sleep(500);
         }
     }
 
     if (modemOn) {
-        // TODO check if the parser ignores any lines it doesn't expect
-        modemOn = tx("ATE0") && scan("%3s", response)
-                  && (!strncmp("ATE0", response, 3) || !strncmp("OK", response, 2))
-                  && tx("AT+QIURC=1") && rx("OK")
-                  && tx("AT+CMEE=1") && rx("OK");
+        // one round trip, also when the modem was up already, the echo of the line itself is skipped
+        static const M66Step settings[] = {
+            {CMD_ECHO_OFF, NULL, 0}, {CMD_URC, NULL, 0}, {CMD_ERRORS, NULL, 0}, {CMD_MUX, NULL, 0}
+        };
+        modemOn = batch(settings, sizeof(settings) / sizeof(settings[0]));
 /*TODO Do we need to save the setting profile
         tx("AT&W");
         rx("OK");*/
@@ -127,27 +174,29 @@ bool M66ATParser::reset(void) {
 
 
 bool M66ATParser::requestDateTime() {
-
+#if M66_TIME_SYNC
     bool tdStatus = false;
 
-    tdStatus = (tx("AT+QNITZ=1") && rx("OK", 10)
-                && tx("AT+CTZU=2") && rx("OK", 10)
-                && tx("AT+CFUN=1") && rx("OK", 10)
-                && tx("AT+CCLK=\"70/01/01,00:00:00+00\"")&& rx("OK"));
+    static const M66Step timeSetup[] = {
+        {CMD_NITZ, NULL, 0}, {CMD_ZONE_UPDATE, NULL, 0}, {CMD_FUNCTION, NULL, 0}, {CMD_SET_CLOCK, NULL, 0}
+    };
+    tdStatus = batch(timeSetup, sizeof(timeSetup) / sizeof(timeSetup[0]));
 
     bool connected = false;
-    for (int networkTries = 0; !connected && networkTries < 20; networkTries++) {
+    M66Retry registration(RETRY_REGISTER);
+    while (!connected && registration.next()) {
         int bearer = -1, status = -1;
-        if (tx("AT+CGREG?") && scan("+CGREG: %d,%d", &bearer, &status) && rx("OK", 15)) {
+        M66Field reply[] = {&bearer, &status};
+        if (command(CMD_GPRS_REGISTRATION, reply, 2)) {
             // TODO add an enum of status codes
             connected = status == 1 || status == 5;
         }
-        // TODO check if we need to use thread wait
-        wait_ms(1000);
     }
 
-    if(!((tx("AT+QNTP=\"pool.ntp.org\"") && rx("OK"))&& rx("+QNTP: 0", 30))){
-        if(!((tx("AT+QNTP=\"1.pool.ntp.org\"") && rx("OK"))&& rx("+QNTP: 0", 30))){
+    int ntp = -1;
+    M66Field result[] = {&ntp};
+    if(!(command(CMD_NTP, result, 1, "pool.ntp.org") && ntp == 0)){
+        if(!(command(CMD_NTP, result, 1, "1.pool.ntp.org") && ntp == 0)){
             CSTDEBUG("Failed to synchronize NTP time \r\n");
             /*TODO call mbed NTP lib function*/
             tdStatus &= false;
@@ -157,57 +206,60 @@ bool M66ATParser::requestDateTime() {
 
 
     return tdStatus && connected;
+#else
+    return false;
+#endif
 }
 
 bool M66ATParser::connect(const char *apn, const char *userName, const char *passPhrase) {
     // TODO implement setting the pin number, add it to the contructor arguments
 
     bool connected = false, attached = false;
-    //TODO do we need timeout here
-    for (int tries = 0; !connected && !attached && tries < 3; tries++) {
+    // the connect policy is the overall deadline, registration and attach stop with it
+    M66Retry retry(RETRY_CONNECT);
+    while (!attached && retry.next()) {
 
         // connecte to the mobile network
-        for (int networkTries = 0; !connected && networkTries < 20; networkTries++) {
+        M66Retry registration(RETRY_REGISTER, &retry);
+        connected = false;
+        while (!connected && registration.next()) {
             int bearer = -1, status = -1;
-            if (tx("AT+CREG?") && scan("+CREG: %d,%d", &bearer, &status) && rx("OK", 10)) {
+            M66Field reply[] = {&bearer, &status};
+            if (command(registration, CMD_REGISTRATION, reply, 2)) {
                 // TODO add an enum of status codes
                 connected = status == 1 || status == 5;
             }
-            // TODO check if we need to use thread wait
-            wait_ms(1000);
         }
         if (!connected) continue;
 
         // attach GPRS
-        if (!(tx("AT+QIDEACT") && rx("DEACT OK"))) continue;
+        if (!command(retry, CMD_DEACTIVATE, NULL, 0)) continue;
 
-        for (int attachTries = 0; !attached && attachTries < 20; attachTries++) {
-            attached = tx("AT+CGATT=1") && rx("OK", 10);
-            wait_ms(2000);
-        }
+        // repeated by the attach policy of the command
+        attached = command(retry, CMD_ATTACH, NULL, 0);
         if (!attached) continue;
 
-        // set APN and finish setup
+        // set APN and finish setup, the context is activated on its own with its long timeout
+        static const M66Step context[] = {{CMD_FOREGROUND, NULL, 0}, {CMD_APN, NULL, 0}, {CMD_REGISTER_APP, NULL, 0}};
         attached =
-            tx("AT+QIFGCNT=0") && rx("OK") &&
-            tx("AT+QICSGP=1,\"%s\",\"%s\",\"%s\"", apn, userName, passPhrase) && rx("OK", 10) &&
-            tx("AT+QIREGAPP") && rx("OK", 10) &&
-            tx("AT+QIACT") && rx("OK", 10);
+            batch(retry, context, sizeof(context) / sizeof(context[0]), apn, userName, passPhrase) &&
+            command(retry, CMD_ACTIVATE, NULL, 0);
     }
 
     // Send request to get the local time
-    attached &= requestDateTime();
+    if (M66_TIME_SYNC) attached &= requestDateTime();
 
     return connected && attached ;
 }
 
 bool M66ATParser::disconnect(void) {
-    return (tx("AT+QIDEACT") && rx("DEACT OK"));
+    return command(CMD_DEACTIVATE, NULL, 0);
 }
 
 
 const char *M66ATParser::getIPAddress(void) {
-    if (!(tx("AT+QILOCIP") && scan("%s", _ip_buffer))) {
+    M66Field address[] = {_ip_buffer};
+    if (!command(CMD_LOCAL_IP, address, 1)) {
         return 0;
     }
 
@@ -215,55 +267,52 @@ const char *M66ATParser::getIPAddress(void) {
 }
 
 bool M66ATParser::getIMEI(char *getimei) {
-    if (!(tx("AT+GSN") && scan("%16s", _imei))) {
+    M66Field imei[] = {_imei};
+    if (!command(CMD_IMEI, imei, 1)) {
         return 0;
     }
     strncpy(getimei, _imei, 16);
+
+    // the IMEI is unique per device, use it to spread retries over the fleet
+    uint32_t hash = 2166136261u;
+    for (const char *c = _imei; *c; c++) hash = (hash ^ (uint8_t) *c) * 16777619u;
+    M66Retry::seed(hash);
+
     return 1;
 }
 
 bool M66ATParser::getLocation(char *lon, char *lat) {
-
-    char response[32] = "";
-
-    string responseLon;
-    string responseLat;
+#if M66_LOCATION
+    char longitude[16], latitude[16];
+    M66Field position[] = {longitude, latitude};
 
     // get location - +QCELLLOC: Longitude, Latitude
-    if (!(tx("AT+QCELLLOC=1") && scan("+QCELLLOC: %s", response) && rx("OK")))
+    if (!command(CMD_LOCATION, position, 2))
         return false;
 
-    string str(response);
-    size_t found = str.find(",");
-    if (found <= 0) return false;
-
-    responseLon = str.substr(0, found - 1);
-    responseLat = str.substr(found + 1);
-    strcpy(lon, responseLon.c_str());
-    strcpy(lat, responseLat.c_str());
+    strcpy(lon, longitude);
+    strcpy(lat, latitude);
 
     return true;
+#else
+    return false;
+#endif
 }
 
 bool M66ATParser::getDateTime(tm *datetime, int *zone) {
+#if M66_TIME_SYNC
     // get network time
 
     for (int i = 0; i < 3 && !networkTimeSynchronised; i++) {
-        char cmd[512];
-        while (flushRx(cmd, sizeof(cmd), 10)) {
-            CIODEBUG("GSM (%02d) !! '%s'\r\n", strlen(cmd), cmd);
-            checkURC(cmd);
-        }
-        printf("Time (%d)\r\n", i);
-        Thread::wait(1000);
+        _flush();
+        CSTDEBUG("M66 [--] !! waiting for the network time (%d)\r\n", i);
+        M66Clock::sleep(1000);
     }
 
     if (networkTimeSynchronised) {
-        printf("networkTimeSynchronised\r\n");
-        if (!((tx("AT+CCLK?")) && (scan("+CCLK: \"%d/%d/%d,%d:%d:%d+%d\"",
-                                        &datetime->tm_year, &datetime->tm_mon, &datetime->tm_mday,
-                                        &datetime->tm_hour, &datetime->tm_min, &datetime->tm_sec,
-                                        &zone))) && rx("OK")) {
+        M66Field clock[] = {&datetime->tm_year, &datetime->tm_mon, &datetime->tm_mday,
+                            &datetime->tm_hour, &datetime->tm_min, &datetime->tm_sec, zone};
+        if (!command(CMD_CLOCK, clock, 7)) {
             CSTDEBUG("M66 [--] !! no time received\r\n");
             return false;
         }
@@ -301,15 +350,19 @@ bool M66ATParser::getDateTime(tm *datetime, int *zone) {
         CSTDEBUG("M66 [--] !! Waitin for network time synchronisation\r\n");
         return false;
     }
+#else
+    return false;
+#endif
 }
 
 bool M66ATParser::getUnixTime(time_t *t) {
-
+#if M66_TIME_SYNC
     tm dateTime = {};
     int zone = -1;
     bool ret = false;
 
-    for (int i = 0; i < 3; ++i) {
+    M66Retry retry(RETRY_TIME);
+    while (retry.next()) {
         if (getDateTime(&dateTime, &zone)) {
             *t = mktime(&dateTime);
             ret = true;
@@ -318,63 +371,117 @@ bool M66ATParser::getUnixTime(time_t *t) {
     }
 
     return ret;
+#else
+    return false;
+#endif
 }
 
 bool M66ATParser::modem_battery(uint8_t *status, int *level, int *voltage) {
-    return (tx("AT+CBC") && scan("+CBC: %d,%d,%d", status, level, voltage));
+#if M66_BATTERY
+    int charge = -1;
+    M66Field battery[] = {&charge, level, voltage};
+    if (!command(CMD_BATTERY, battery, 3)) return false;
+
+    *status = (uint8_t) charge;
+    return true;
+#else
+    return false;
+#endif
 }
 
 bool M66ATParser::isConnected(void) {
     return getIPAddress() != 0;
 }
 
-bool M66ATParser::queryIP(const char *url, const char *theIP) {
+bool M66ATParser::queryIP(const char *url, char *theIP) {
+    // a failed lookup answers ERROR after the OK, repeated by the DNS policy of the command
+    M66Field address(theIP, NSAPI_IPv4_SIZE);
+    return command(CMD_RESOLVE, &address, 1, url);
+}
 
-    for(int i = 0; i < 3; i++) {
-        if((tx("AT+QIDNSGIP=\"%s\"", url)
-             && rx("OK")
-             && scan("%s", theIP))){
-            if(strncmp(theIP, "ERROR", 5) != 0) return true;
-        } wait(1);
+bool M66ATParser::open(const char *type, int id, const char *addr, int port) {
+    M66Retry retry(RETRY_OPEN);
+    while (retry.next()) {
+        if (!startOpen(type, id, addr, port)) continue;
+
+        // "n, CONNECT OK" or "n, CONNECT FAIL" is handled by checkURC(), within the time of AT+QIOPEN
+        while (_links[id] == LINK_CONNECTING) {
+            if (!_serial.readable()) {
+                if (_deadline.expired()) break;
+                _wait_rx(_deadline);
+                continue;
+            }
+            process();
+        }
+
+        if (_links[id] == LINK_CONNECTED) return true;
+        _links[id] = LINK_CLOSED;
+        /*TODO  AT+QIDEACT and QICLOSE, if open fails, check the application note*/
     }
+
+    //TODO return a error code to debug the open fail in a bettwe way
     return false;
 }
 
-bool M66ATParser::open(const char *type, int id, const char *addr, int port) {
-    int id_resp = -1;
-
+bool M66ATParser::startOpen(const char *type, int id, const char *addr, int port) {
     //IDs only 0-5
-    if (id > 6) {
+    if (id < 0 || id >= M66_LINK_COUNT) {
         return false;
     }
 
-    for(int i = 0; i < 3; i++) {
+    /* opne a connection only if the QISTATE is IPINITAL, IP_CLOSE, IP STATUS
+     * if it is in any other state then close the connection and / or deactivate context qideact
+     */
+    const int stateRet = queryConnection();
+    if (!(stateRet == IP_INITIAL || stateRet == IP_CLOSE || stateRet == IP_STATUS)) return false;
+
+    if (!command(CMD_DNS_ADDRESS, NULL, 0)) return false;
+
+    // the result arrives later, make sure checkURC() accepts it for this id
+    _links[id] = LINK_CONNECTING;
+    _dataLost &= ~(1u << id);
+    if (!strcmp("UDP", type)) _datagrams |= 1u << id;
+    else _datagrams &= ~(1u << id);
+    if (!command(CMD_OPEN, NULL, 0, id, type, addr, port)) {
+        _links[id] = LINK_CLOSED;
+        return false;
+    }
 
-        /* opne a connection only if the QISTATE is IPINITAL, IP_CLOSE, IP STATUS
-         * if it is in any other state then close the connection and / or deactivate context qideact
-         */
-        const int stateRet = queryConnection();
+    return true;
+}
+
+int M66ATParser::linkStatus(int id) {
+    if (id < 0 || id >= M66_LINK_COUNT) return LINK_CLOSED;
+    return _links[id];
+}
 
-        if (stateRet == IP_INITIAL || stateRet == IP_CLOSE || stateRet == IP_STATUS) {
+void M66ATParser::clearLinkStatus(int id) {
+    if (id < 0 || id >= M66_LINK_COUNT) return;
+    _links[id] = LINK_CLOSED;
+    _dataLost &= ~(1u << id);
+}
 
-            if (!(tx("AT+QIDNSIP=0") && rx("OK"))) return false;
+void M66ATParser::discard(int id) {
+    if (id < 0 || id >= M66_LINK_COUNT) return;
 
-            if ((tx("AT+QIOPEN=%d,\"%s\",\"%s\",\"%d\"", id, type, addr, port)
-                 && rx("OK", 10)
-                 && scan("%d, CONNECT OK", &id_resp))) {
-                return id == id_resp;
-            }
+    struct packet *p;
+    while ((p = _packet_find(1u << id))) _packet_take(p, p->len);
+}
+
+void M66ATParser::process() {
+    while (_serial.readable()) {
+        if (readline(_line, sizeof(_line) - 1, M66Deadline(LINE_TIMEOUT)) && checkURC(_line) == -1) {
+            CIOTRACE(TRACE_DROP, _line);
         }
-        /*TODO  AT+QIDEACT and QICLOSE, if open fails, check the application note*/
     }
-
-    //TODO return a error code to debug the open fail in a bettwe way
-    return false;
 }
 
 bool M66ATParser::send(int id, const void *data, uint32_t amount) {
 
-    if (!(tx("AT+QISRVC=1") && rx("OK"))) return false;
+    if (!_select_client()) return false;
+
+    // the results of datagrams come first, this SEND OK must not be taken for one of theirs
+    if (M66_UDP) _wait_send_window(M66Deadline(SEND_TIMEOUT), 0);
 
     char *tempData = (char *) data;
     uint32_t remainingAmount = amount;
@@ -383,28 +490,349 @@ bool M66ATParser::send(int id, const void *data, uint32_t amount) {
         sendDataSize = remainingAmount < MAX_SEND_BYTES ?  remainingAmount: MAX_SEND_BYTES;
         remainingAmount -= sendDataSize;
 
-        /* TODO if this retry is required?
-         * TODO May take a second try if device is busy
+        /* May take a second try if device is busy
          * TODO use QISACK after you receive SEND OK, to check if whether the data has been sent to the remote
          */
-        for (int i = 0; i < 2; i++) {
-            if (tx("AT+QISEND=%d,%d", id, sendDataSize) && rx(">", 10)) {
-                char cmd[512];
-                while (flushRx(cmd, sizeof(cmd), 10)) {
-                    CIODEBUG("GSM (%02d) !! '%s'\r\n", strlen(cmd), cmd);
-                    checkURC(cmd);
-                }
+        bool sent = false;
+        M66Retry retry(RETRY_SEND);
+        while (!sent && retry.next()) {
+            const bool sending = (_secure & (1u << id))
+                                 ? tx(CMD_SSL_SEND, id, sendDataSize)
+                                 : tx(CMD_SEND, id, sendDataSize);
+            if (sending && _prompt(_deadline)) {
+                _flush();
                 CIODUMP((uint8_t *) tempData, (size_t)sendDataSize);
-                if (_serial.write(tempData, (size_t)sendDataSize) >= 0 && rx("SEND OK", 20)) {
-                    break;
+                if (_serial.write(tempData, (size_t)sendDataSize) >= 0 && rx("SEND OK", M66Deadline(SEND_TIMEOUT))) {
+                    sent = true;
+                    if (_linkEvent) _linkEvent(id);
                 } else return false;
             } //if: AT+QISEND
-        } //for:i
+        }
+        if (!sent) return false;
         tempData += sendDataSize;
     }//while
     return true;
 }
 
+bool M66ATParser::sendDatagram(int id, const void *data, uint32_t amount) {
+    // a datagram is never split, that would turn it into several
+    if (!M66_UDP || amount > MAX_SEND_BYTES) return false;
+
+    if (!_select_client()) return false;
+    _wait_send_window(M66Deadline(SEND_TIMEOUT), M66_UDP_SEND_WINDOW - 1);
+
+    if (!(tx(CMD_SEND, id, (int) amount) && _prompt(_deadline))) return false;
+
+    CIODUMP((const uint8_t *) data, (size_t) amount);
+    if (_serial.write(data, (size_t) amount) < 0) return false;
+
+    // SEND OK is picked up by checkURC(), in order
+    _inflight[(_inflightHead + _inflightCount) % M66_UDP_SEND_WINDOW] = (uint8_t) id;
+    _inflightCount++;
+    return true;
+}
+
+bool M66ATParser::sendFailed(int id) {
+    const bool failed = (_sendFailed & (1u << id)) != 0;
+    _sendFailed &= ~(1u << id);
+    return failed;
+}
+
+bool M66ATParser::dataLost(int id) {
+    return (_dataLost & (1u << id)) != 0;
+}
+
+bool M66ATParser::_select_client() {
+    // the service type stays selected until the modem is reset
+    if (!_clientService) _clientService = command(CMD_CLIENT, NULL, 0);
+    return _clientService;
+}
+
+bool M66ATParser::_prompt(M66Deadline deadline) {
+    // the prompt "> " is not terminated by a line break, readline() would wait for the deadline
+    size_t idx = 0;
+    for (;;) {
+        if (!_serial.readable()) {
+            if (deadline.expired()) break;
+            _wait_rx(deadline);
+            continue;
+        }
+
+        int c = _serial.getc();
+        if (c == '>' && !idx) {
+            // drop the blank following the prompt
+            while (!_serial.readable() && !deadline.expired()) _wait_rx(deadline);
+            if (_serial.readable()) _serial.getc();
+            return true;
+        }
+        if (c == '\r') continue;
+        if (c == '\n') {
+            if (!idx) continue;
+            _line[idx] = 0;
+            CIOTRACE(TRACE_RX, _line);
+            // anything but an URC (ERROR, +CME ERROR) means there will be no prompt
+            if (checkURC(_line) == -1) return false;
+            idx = 0;
+            continue;
+        }
+        if (idx < sizeof(_line) - 1 && isprint(c)) _line[idx++] = (char) c;
+    }
+
+    return false;
+}
+
+void M66ATParser::_wait_send_window(M66Deadline deadline, int limit) {
+    while (_inflightCount > limit) {
+        if (deadline.expired()) {
+            // the results got lost, do not block the following sends forever
+            CSTDEBUG("M66 [--] !! %d datagrams without result\r\n", _inflightCount);
+            _inflightCount = 0;
+            break;
+        }
+        if (!_serial.readable()) {
+            _wait_rx(deadline);
+            continue;
+        }
+        process();
+    }
+}
+
+bool M66ATParser::httpUrl(const char *url, uint32_t timeout) {
+    const int length = (int) strlen(url);
+    if (!command(CMD_HTTP_URL, NULL, 0, length, (int) timeout)) return false;
+
+    CIODUMP((const uint8_t *) url, (size_t) length);
+    return _serial.write(url, (size_t) length) >= 0 && rx("OK", M66Deadline(timeout * 1000));
+}
+
+bool M66ATParser::httpGet(uint32_t timeout) {
+    // OK comes when the modem has the complete response, or +CME ERROR
+    return tx(CMD_HTTP_GET, (int) timeout) && rx("OK", M66Deadline((timeout + 5) * 1000));
+}
+
+bool M66ATParser::httpPost(const void *data, uint32_t amount, uint32_t timeout) {
+    if (!command(CMD_HTTP_POST, NULL, 0, (int) amount, (int) timeout)) return false;
+
+    CIODUMP((const uint8_t *) data, (size_t) amount);
+    return _serial.write(data, (size_t) amount) >= 0 && rx("OK", M66Deadline((timeout + 5) * 1000));
+}
+
+int32_t M66ATParser::httpRead(char *chunk, size_t size, M66Sink sink, uint32_t timeout) {
+    if (!(tx(CMD_HTTP_READ, (int) timeout) && rx("CONNECT", M66Deadline(timeout * 1000)))) return -1;
+
+    return _read_body(chunk, size, sink, M66Deadline(timeout * 1000));
+}
+
+int32_t M66ATParser::_read_body(char *chunk, size_t size, M66Sink sink, M66Deadline silence) {
+    // the data has no length, it ends with the final result "\r\nOK\r\n"
+    static const char end[] = "\r\nOK\r\n";
+    const size_t endLength = sizeof(end) - 1;
+    if (size <= endLength) return -1;
+
+    int32_t total = 0;
+    size_t idx = 0;
+    bool accepted = true;
+    for (;;) {
+        if (!_serial.readable()) {
+            if (silence.expired()) break;
+            _wait_rx(silence);
+            continue;
+        }
+
+        chunk[idx++] = (char) _serial.getc();
+        silence.restart();
+
+        if (idx >= endLength && !memcmp(chunk + idx - endLength, end, endLength)) {
+            idx -= endLength;
+            if (idx && accepted) accepted = sink(chunk, idx);
+            total += idx;
+            CSTDEBUG("M66 [--] -> %d bytes\r\n", (int) total);
+            return accepted ? total : -1;
+        }
+
+        if (idx == size) {
+            // the tail may be the start of the final result, it stays for the next chunk
+            const size_t full = size - endLength;
+            if (accepted) accepted = sink(chunk, full);
+            total += full;
+            memmove(chunk, chunk + full, endLength);
+            idx = endLength;
+        }
+    }
+
+    return -1;
+}
+
+bool M66ATParser::ftpOpen(const char *host, int port, const char *user, const char *password, uint32_t timeout) {
+    int result = -1;
+    return command(CMD_FTP_USER, NULL, 0, user) &&
+           command(CMD_FTP_PASSWORD, NULL, 0, password) &&
+           command(CMD_FTP_OPEN, NULL, 0, host, port) &&
+           _result("+QFTPOPEN:", &result, M66Deadline(timeout * 1000)) && result == 0;
+}
+
+int32_t M66ATParser::ftpGet(const char *path, const char *file, uint32_t timeout) {
+    int result = -1;
+    if (!(command(CMD_FTP_PATH, NULL, 0, path) &&
+          _result("+QFTPPATH:", &result, _deadline) && result == 0)) {
+        return -1;
+    }
+
+    // store in the modem file system, not in the modem RAM
+    if (!command(CMD_FTP_STORAGE, NULL, 0)) return -1;
+
+    // the modem downloads on its own, the result comes when the file is complete
+    result = -1;
+    if (!(command(CMD_FTP_GET, NULL, 0, file) && _result("+QFTPGET:", &result, M66Deadline(timeout * 1000)))) {
+        return -1;
+    }
+
+    return result < 0 ? -1 : result;
+}
+
+bool M66ATParser::ftpClose() {
+    int result = -1;
+    return command(CMD_FTP_CLOSE, NULL, 0) && _result("+QFTPCLOSE:", &result, _deadline) && result == 0;
+}
+
+int M66ATParser::fileOpen(const char *file) {
+    int handle = -1;
+    // mode 2 opens read only
+    M66Field opened[] = {&handle};
+    if (!command(CMD_FILE_OPEN, opened, 1, file)) return -1;
+
+    return handle;
+}
+
+int32_t M66ATParser::fileRead(int handle, void *data, uint32_t amount, uint32_t timeout) {
+    int length = -1;
+    M66Field connect[] = {&length};
+    if (!command(CMD_FILE_READ, connect, 1, handle, (int) amount)) return -1;
+    if (length <= 0) return rx("OK") ? 0 : -1;
+
+    // the length is known, the data is read as is and may contain anything
+    const size_t received = read((char *) data, MIN((size_t) length, (size_t) amount), M66Deadline(timeout * 1000));
+    CIODUMP((const uint8_t *) data, received);
+    if (received != (size_t) length || !rx("OK")) return -1;
+
+    return length;
+}
+
+bool M66ATParser::fileClose(int handle) {
+    return command(CMD_FILE_CLOSE, NULL, 0, handle);
+}
+
+bool M66ATParser::fileDelete(const char *file) {
+    return command(CMD_FILE_DELETE, NULL, 0, file);
+}
+
+bool M66ATParser::_result(const char *prefix, int *value, M66Deadline deadline) {
+    // a result code that comes after OK, "+QFTPGET:<value>", other URCs are handled on the way
+    const size_t prefixLength = strlen(prefix);
+    const uint32_t start = us_ticker_read();
+
+    while (!deadline.expired()) {
+        if (!readline(_line, sizeof(_line) - 1, deadline)) continue;
+
+        CIOTRACE(TRACE_RX, _line);
+        if (!strncmp(prefix, _line, prefixLength)) {
+            _account(_line, start);
+            // the last number is the result, "+QSSLOPEN: <ssid>,<err>"
+            const char *last = strrchr(_line + prefixLength, ',');
+            return sscanf(last ? last + 1 : _line + prefixLength, "%d", value) == 1;
+        }
+        if (checkURC(_line) == -1) {
+            _account(_line, start);
+            return false;
+        }
+    }
+
+    _account("", start);
+    return false;
+}
+
+bool M66ATParser::sslSetup(const char *ca) {
+    // the configuration stays in the modem until it is reset
+    if (_sslReady && ca == _sslCa) return true;
+
+    if (ca) {
+        const int length = (int) strlen(ca);
+        int written = -1;
+        if (!command(CMD_SSL_WRITE_CA, NULL, 0, length)) return false;
+        if (_serial.write(ca, (size_t) length) < 0) return false;
+        if (!(scan("+QSECWRITE: %d", &written) == 1 && written == length && rx("OK"))) return false;
+    }
+
+    _sslReady =
+        command(CMD_SSL_CONFIG, NULL, 0, "sslversion", M66_TLS_CONTEXT, "4") &&
+        command(CMD_SSL_CONFIG, NULL, 0, "ciphersuite", M66_TLS_CONTEXT, "\"0XFFFF\"") &&
+        command(CMD_SSL_CONFIG, NULL, 0, "seclevel", M66_TLS_CONTEXT, ca ? "1" : "0") &&
+        (!ca || command(CMD_SSL_CONFIG, NULL, 0, "cacert", M66_TLS_CONTEXT, "\"RAM:ca.pem\""));
+
+    // resumption saves the full handshake on reconnects, not every firmware has it
+    if (_sslReady && !command(CMD_SSL_CONFIG, NULL, 0, "sessioncache", M66_TLS_CONTEXT, "1")) {
+        CSTDEBUG("M66 [--] !! no TLS session resumption\r\n");
+    }
+
+    _sslCa = ca;
+    return _sslReady;
+}
+
+bool M66ATParser::sslOpen(int id, const char *addr, int port, uint32_t timeout) {
+    int result = -1;
+
+    _secure |= 1u << id;
+    _sslPending &= ~(1u << id);
+    _links[id] = LINK_CONNECTING;
+
+    // non-transparent mode, data goes through AT+QSSLSEND and AT+QSSLRECV
+    const M66Deadline deadline(timeout * 1000);
+    if (!command(CMD_SSL_OPEN, NULL, 0, id, M66_TLS_CONTEXT, addr, port)) {
+        _sslResult = SSL_REJECTED;
+    } else if (!_result("+QSSLOPEN: ", &result, deadline)) {
+        _sslResult = deadline.expired() ? SSL_TIMEOUT : SSL_REJECTED;
+    } else if (result != 0) {
+        _sslResult = SSL_HANDSHAKE;
+    } else {
+        _sslResult = SSL_OK;
+        _links[id] = LINK_CONNECTED;
+        return true;
+    }
+
+    _secure &= ~(1u << id);
+    _links[id] = LINK_FAILED;
+    return false;
+}
+
+int M66ATParser::sslResult() {
+    return _sslResult;
+}
+
+int32_t M66ATParser::_ssl_recv(int id, void *data, uint32_t amount) {
+    // pick up "recv" and "closed" notifications
+    process();
+
+    if (_sslPending & (1u << id)) {
+        char result[24];
+        if (!(tx(CMD_SSL_RECEIVE, id, (int) amount) && scan("+QSSLRECV: %23[0-9,]", result) == 1)) {
+            return -1;
+        }
+
+        // "+QSSLRECV: <cid>,<ssid>,<length>", the data follows
+        const char *last = strrchr(result, ',');
+        const int length = MIN(atoi(last ? last + 1 : result), (int) amount);
+        const size_t received = length > 0 ? read((char *) data, (size_t) length, _deadline) : 0;
+        CIODUMP((const uint8_t *) data, received);
+        if (received != (size_t) MAX(length, 0) || !rx("OK")) return -1;
+
+        // there may be more when the buffer was filled
+        if ((uint32_t) length < amount) _sslPending &= ~(1u << id);
+        if (length > 0) return length;
+    }
+
+    return _links[id] == LINK_CONNECTED ? -1 : 0;
+}
+
 /*TODO Use this commmand to get the IP status before running IP commands(open, send, ..)
  * getIPAddress() can also be used
  * A string parameter to indicate the status of the connection
@@ -421,22 +849,18 @@ bool M66ATParser::send(int id, const void *data, uint32_t amount) {
  * "PDP DEACT"      :: GPRS/CSD context was deactivated because of unknown reason
  */
 int M66ATParser::queryConnection() {
-    char resp[20];
     int qstate = -1;
+    M66Field state[] = {&qstate};
 
-    if (!(tx("ATV0") && rx("0"))) return false;
+    if (!command(CMD_NUMERIC, NULL, 0)) return false;
 
-    bool ret = (tx("AT+QISTATE") && scan("%d", &qstate));
+    bool ret = command(CMD_STATE, state, 1);
 
-    scan("+QISTATE:0, %s", resp);
-    scan("+QISTATE:1, %s", resp);
-    scan("+QISTATE:2, %s", resp);
-    scan("+QISTATE:3, %s", resp);
-    scan("+QISTATE:4, %s", resp);
-    scan("+QISTATE:5, %s", resp);
+    // "+QISTATE:<id>, ..." of every connection, not needed
+    for (int i = 0; i < M66_LINK_COUNT; i++) nextLine(_deadline);
     rx("0");
 
-    ret &= (tx("ATV1") && rx("OK"));
+    ret &= command(CMD_VERBOSE, NULL, 0);
 
     if (!ret) return false;
 
@@ -453,72 +877,163 @@ void M66ATParser::_packet_handler(const char *response) {
     }
     CSTDEBUG("M66 [%02d] -> %d bytes\r\n", id, amount);
 
-    struct packet *packetBuf = (struct packet *) malloc(sizeof(struct packet) + amount);
+    // a TCP stream with a gap is broken, the data after it is of no use either
+    struct packet *packetBuf = (_dataLost & (1u << id)) ? NULL : _packet_alloc(amount);
     if (!packetBuf) {
+        M66_STAT(_stats.allocFailures++);
+        _remoteIp[0] = '\0';
+        CSTDEBUG("M66 [%02d] EE no room, %d bytes dropped\r\n", id, amount);
+        if (id >= 0 && id < M66_LINK_COUNT && !(_datagrams & (1u << id))) {
+            // recv() returns what came before, then the error, rather than a stream with a hole
+            _dataLost |= 1u << id;
+            _links[id] = LINK_FAILED;
+        }
+
+        // the data must not be taken for lines
+        char skip[32];
+        for (size_t left = amount; left;) {
+            const size_t skipped = read(skip, MIN(left, sizeof(skip)), M66Deadline(LINE_TIMEOUT));
+            if (!skipped) break;
+            left -= skipped;
+        }
+        if (_linkEvent) _linkEvent(id);
         return;
     }
 
     packetBuf->id = id;
     packetBuf->len = (uint32_t) amount;
-    packetBuf->next = 0;
+    strcpy(packetBuf->ip, _remoteIp);
+    packetBuf->port = _remotePort;
+    _remoteIp[0] = '\0';
 
     // packetBuf +1 is the same as packetBuf + sizeof(struct packetBuf)
-    const size_t bytesRead = read((char *) (packetBuf + 1), (size_t) amount, 10);
+    const size_t bytesRead = read((char *) (packetBuf + 1), (size_t) amount, M66Deadline(LINE_TIMEOUT));
     CIODUMP((uint8_t *) (packetBuf + 1), (size_t) bytesRead);
 
     if (bytesRead != amount) {
         CSTDEBUG("M66 [%02d] EE read(%d) != expected(%d)\r\n", id, bytesRead, amount);
+#if !M66_STATIC_PACKETS
         free(packetBuf);
+#endif
         return;
     }
 
-    // append to packetBuf list
-    *_packets_end = packetBuf;
-    _packets_end = &packetBuf->next;
+    _packet_append(packetBuf);
+
+    if (_linkEvent) _linkEvent(id);
 }
 
-int32_t M66ATParser::recv(int id, void *data, uint32_t amount) {
-    Timer timer;
-    timer.start();
+#if M66_STATIC_PACKETS
+M66ATParser::packet *M66ATParser::_packet_alloc(uint32_t amount) {
+    // the record goes behind the last one, it only counts once appended
+    if (PACKET_RECORD(amount) > sizeof(_packetStore) - _packetUsed) return NULL;
+    return (struct packet *) ((uint8_t *) _packetStore + _packetUsed);
+}
 
-    while (timer.read_ms() < _timeout) {
-        CSTDEBUG("M66 [%02d] !! _timeout=%d, time=%d\r\n", id, (int) _timeout, (int) timer.read() * 1000);
+void M66ATParser::_packet_append(struct packet *p) {
+    _packetUsed += PACKET_RECORD(p->len);
+}
 
-        // check if any packets are ready for us
-        for (struct packet **p = &_packets; *p; p = &(*p)->next) {
-            if ((*p)->id == id) {
-                struct packet *q = *p;
+M66ATParser::packet *M66ATParser::_packet_find(uint32_t ids) {
+    for (size_t offset = 0; offset < _packetUsed;) {
+        struct packet *q = (struct packet *) ((uint8_t *) _packetStore + offset);
+        if (ids & (1u << q->id)) return q;
+        offset += PACKET_RECORD(q->len);
+    }
+    return NULL;
+}
 
-                if (q->len <= amount) { // Return and remove full packet
-                    memcpy(data, q + 1, q->len);
+void M66ATParser::_packet_take(struct packet *p, uint32_t amount) {
+    uint8_t *store = (uint8_t *) _packetStore;
+    const size_t offset = (size_t) ((uint8_t *) p - store);
+    const size_t record = PACKET_RECORD(p->len);
 
-                    if (_packets_end == &(*p)->next) {
-                        _packets_end = p;
-                    }
-                    *p = (*p)->next;
+    // the whole packet or its first bytes, the rest of the data moves to the front
+    p->len -= MIN(amount, p->len);
+    memmove(p + 1, (uint8_t *) (p + 1) + amount, p->len);
+    const size_t kept = p->len ? PACKET_RECORD(p->len) : 0;
 
-                    uint32_t len = q->len;
-                    free(q);
-                    return len;
-                } else { // return only partial packet
-                    memcpy(data, q + 1, amount);
+    // the records behind move up, the store stays without gaps
+    memmove(store + offset + kept, store + offset + record, _packetUsed - offset - record);
+    _packetUsed -= record - kept;
+}
+#else
+M66ATParser::packet *M66ATParser::_packet_alloc(uint32_t amount) {
+    return (struct packet *) malloc(sizeof(struct packet) + amount);
+}
 
-                    q->len -= amount;
-                    memmove(q + 1, (uint8_t *) (q + 1) + amount, q->len);
+void M66ATParser::_packet_append(struct packet *p) {
+    p->next = 0;
+    *_packets_end = p;
+    _packets_end = &p->next;
+}
 
-                    return amount;
-                }
-            }
+M66ATParser::packet *M66ATParser::_packet_find(uint32_t ids) {
+    for (struct packet *q = _packets; q; q = q->next) {
+        if (ids & (1u << q->id)) return q;
+    }
+    return NULL;
+}
+
+void M66ATParser::_packet_take(struct packet *p, uint32_t amount) {
+    if (amount < p->len) {
+        p->len -= amount;
+        memmove(p + 1, (uint8_t *) (p + 1) + amount, p->len);
+        return;
+    }
+
+    struct packet **q = &_packets;
+    while (*q != p) q = &(*q)->next;
+    if (_packets_end == &p->next) _packets_end = q;
+    *q = p->next;
+    free(p);
+}
+#endif
+
+int32_t M66ATParser::recv(int id, void *data, uint32_t amount) {
+    if (_secure & (1u << id)) return _ssl_recv(id, data, amount);
+
+    return recvfrom(1u << id, NULL, data, amount, NULL, NULL, false);
+}
+
+int32_t M66ATParser::recvfrom(uint32_t ids, int *id, void *data, uint32_t amount, char *ip, int *port, bool datagram) {
+    M66Deadline deadline(_timeout);
+
+    // a timeout of 0 only drains what is already buffered
+    for (;;) {
+
+        // check if any packets are ready for us
+        struct packet *q = _packet_find(ids);
+        if (q) {
+            if (id) *id = q->id;
+            if (ip) strcpy(ip, q->ip);
+            if (port) *port = q->port;
+
+            // a datagram is taken whole, what does not fit is dropped, a stream may take a part
+            const uint32_t len = MIN(q->len, amount);
+            memcpy(data, q + 1, len);
+            _packet_take(q, datagram ? q->len : len);
+            return len;
         }
 
-        // Wait for inbound packet
-        // TODO check what happens when we receive a packet (like OK)
-        // TODO the response code may be different if connection is still open
-        // TODO it may need to be moved to packet handler
-        int receivedId;
-        if (!scan("%d, CLOSED", &receivedId) && id == receivedId) {
-            return -1;
+        // closed by the remote and no data left, "n, CLOSED" is handled by checkURC()
+        bool connected = false;
+        for (int i = 0; i < M66_LINK_COUNT; i++) {
+            if ((ids & (1u << i)) && _links[i] == LINK_CONNECTED) connected = true;
+        }
+        if (!connected) {
+            return 0;
         }
+
+        if (_serial.readable()) {
+            process();
+            continue;
+        }
+        if (deadline.expired()) {
+            break;
+        }
+        // Wait for inbound packet
+        _wait_rx(deadline);
     }
     // timeout
     return -1;
@@ -526,21 +1041,35 @@ int32_t M66ATParser::recv(int id, void *data, uint32_t amount) {
 
 bool M66ATParser::close(int id) {
     int id_resp;
-    // TODO check if this retry is required
-    //May take a second try if device is busy
-    for (unsigned i = 0; i < 2; i++) {
-        if (tx("AT+QICLOSE=%d", id) && scan("%d, CLOSE OK", &id_resp)) {
-            return id == id_resp;
-        }
+
+    if (_secure & (1u << id)) {
+        _secure &= ~(1u << id);
+        _sslPending &= ~(1u << id);
+        _links[id] = LINK_CLOSED;
+        return command(CMD_SSL_CLOSE, NULL, 0, id);
     }
 
-    return false;
+    // may take a second try if the device is busy, repeated by the close policy of the command
+    M66Field closed[] = {&id_resp};
+    if (!command(CMD_CLOSE, closed, 1, id)) return false;
+
+    _links[id] = LINK_CLOSED;
+    return id == id_resp;
 }
 
 void M66ATParser::setTimeout(uint32_t timeout_ms) {
     _timeout = timeout_ms;
 }
 
+uint32_t M66ATParser::commandTimeout(const char *command) {
+    const M66Command *known = M66Command::find(command);
+    return known && known->timeout ? known->timeout : M66_COMMAND_TIMEOUT_MS;
+}
+
+void M66ATParser::setDeadline(M66Deadline deadline) {
+    _deadline = deadline;
+}
+
 bool M66ATParser::readable() {
     return (bool) _serial.readable();
 }
@@ -549,67 +1078,396 @@ bool M66ATParser::writeable() {
     return (bool) _serial.writeable();
 }
 
+void M66ATParser::lock() {
+    _mutex.lock();
+}
+
+bool M66ATParser::trylock() {
+    return _mutex.trylock();
+}
+
+void M66ATParser::unlock() {
+    _mutex.unlock();
+}
+
 void M66ATParser::attach(Callback<void()> func) {
     _serial.attach(func);
 }
 
-bool M66ATParser::tx(const char *pattern, ...) {
-    char cmd[512];
+void M66ATParser::attachLinkEvent(Callback<void(int)> func) {
+    _linkEvent = func;
+}
+
+bool M66ATParser::command(M66CommandId id, M66Field *fields, size_t count, ...) {
+    va_list ap;
+    va_start(ap, count);
+    const bool done = _command(NULL, id, fields, count, &ap);
+    va_end(ap);
+
+    return done;
+}
+
+bool M66ATParser::command(const M66Retry &parent, M66CommandId id, M66Field *fields, size_t count, ...) {
+    va_list ap;
+    va_start(ap, count);
+    const bool done = _command(&parent, id, fields, count, &ap);
+    va_end(ap);
+
+    return done;
+}
+
+bool M66ATParser::batch(const M66Step *steps, size_t count, ...) {
+    va_list ap;
+    va_start(ap, count);
+    const bool done = _steps(NULL, steps, count, &ap);
+    va_end(ap);
+
+    return done;
+}
+
+bool M66ATParser::batch(const M66Retry &parent, const M66Step *steps, size_t count, ...) {
+    va_list ap;
+    va_start(ap, count);
+    const bool done = _steps(&parent, steps, count, &ap);
+    va_end(ap);
+
+    return done;
+}
+
+bool M66ATParser::_steps(const M66Retry *parent, const M66Step *steps, size_t count, va_list *args) {
+    if (parent && parent->expired()) return false;
+
+    size_t done = 0;
+    if (M66_BATCH_COMMANDS && count > 1) {
+        va_list line;
+        va_copy(line, *args);
+        done = _batch(parent, steps, count, &line);
+        va_end(line);
+        if (done == count) return true;
+
+        CSTDEBUG("M66 [--] !! command line failed after %d of %d\r\n", (int) done, (int) count);
+    }
+
+    // one at a time with the policy of each command, the arguments of the commands done are passed over
+    bool success = true;
+    for (size_t i = 0; i < count && success; i++) {
+        const M66Command &command = M66Command::get(steps[i].id);
+        if (i >= done) {
+            va_list step;
+            va_copy(step, *args);
+            success = _command(parent, steps[i].id, steps[i].fields, steps[i].count, &step);
+            va_end(step);
+        }
+        if (command.arguments) M66Command::format(NULL, 0, command.arguments, args);
+    }
+
+    return success;
+}
+
+bool M66ATParser::_command(const M66Retry *parent, M66CommandId id, M66Field *fields, size_t count, va_list *args) {
+    const M66Command &command = M66Command::get(id);
+    if (command.retry == RETRY_NONE) {
+        if (parent && parent->expired()) return false;
+        return _exchange(command, fields, count, args, parent);
+    }
+
+    M66Retry retry((M66RetryOp) command.retry, parent);
+    while (retry.next()) {
+        // every attempt takes the arguments from the start
+        va_list attempt;
+        va_copy(attempt, *args);
+        const bool done = _exchange(command, fields, count, &attempt, &retry);
+        va_end(attempt);
+        if (done) return true;
+    }
+    return false;
+}
+
+bool M66ATParser::_exchange(const M66Command &command, M66Field *fields, size_t count, va_list *args,
+                            const M66Retry *within) {
+    _send_command(command, args, within);
+
+    // the information response comes before the final result, for AT+QIDNSGIP after it
+    const bool after = (command.flags & COMMAND_RESPONSE_AFTER_FINAL) != 0;
+    if (command.response && !after && !_response(command, command.verb, fields, count)) return false;
+    if (command.final) {
+        const M66Line line = _answer(command.verb);
+        if (!line.length || strncmp(command.final, line.text, strlen(command.final))) return false;
+    }
+    return !(command.response && after) || _response(command, command.verb, fields, count);
+}
+
+size_t M66ATParser::_batch(const M66Retry *parent, const M66Step *steps, size_t count, va_list *args) {
+    uint32_t timeout = 0;
+    for (size_t i = 0; i < count; i++) {
+        const M66Command &command = M66Command::get(steps[i].id);
+        if (!(command.flags & COMMAND_CONCATENATE)) return 0;
+        timeout += command.timeout ? command.timeout : M66_COMMAND_TIMEOUT_MS;
+    }
+
+    _flush();
+
+    // "ATE0+QIURC=1;+CMEE=1", an extended command needs a ';' before the next one
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) {
+        const M66Command &command = M66Command::get(steps[i].id);
+        const char *separator = !i ? "AT" : M66Command::get(steps[i - 1].id).verb[0] == '+' ? ";" : "";
+        size_t used = MIN(length, sizeof(_line));
+        length += (size_t) snprintf(_line + used, sizeof(_line) - used, "%s%s", separator, command.verb);
+        if (command.arguments) {
+            used = MIN(length, sizeof(_line));
+            length += M66Command::format(_line + used, sizeof(_line) - used, command.arguments, args);
+        }
+    }
+    // cut, nothing is sent and the commands go one at a time
+    if (length >= sizeof(_line)) return 0;
+
+    _send(_line, parent ? parent->clamp(timeout) : timeout, steps[0].id);
+
+    // the responses come in the order of the commands, the echo is that of the whole line
+    const char *echo = M66Command::get(steps[0].id).verb;
+    size_t done = 0;
+    for (size_t i = 0; i < count; i++) {
+        const M66Command &command = M66Command::get(steps[i].id);
+        if (!command.response) continue;
+        if (!_response(command, echo, steps[i].fields, steps[i].count)) return done;
+        // the modem stops at the first error, everything up to an answered command succeeded
+        done = i + 1;
+    }
+
+    const M66Line line = _answer(echo);
+    return line.length && !strncmp("OK", line.text, 2) ? count : done;
+}
+
+bool M66ATParser::_response(const M66Command &command, const char *echo, M66Field *fields, size_t count) {
+    const M66Line line = _answer(echo);
+    return line.length && M66Command::parse(command.response, line.text, fields, count);
+}
+
+M66Line M66ATParser::_answer(const char *echo) {
+    M66Line line = nextLine(_deadline);
+
+    // the echo of the command line, while it is still on (ATE0)
+    const size_t echoLength = strlen(echo);
+    while (line.length && !strncmp("AT", line.text, 2) && !strncmp(echo, line.text + 2, echoLength)) {
+        line = nextLine(_deadline);
+    }
 
-    while (flushRx(cmd, sizeof(cmd), 10)) {
-        CIODEBUG("GSM (%02d) !! '%s'\r\n", strlen(cmd), cmd);
-        checkURC(cmd);
+    // ERROR, +CME ERROR: <n> or +CMS ERROR: <n> end every command
+    if (!strncmp("ERROR", line.text, 5) || !strncmp("+CME ERROR", line.text, 10) || !strncmp("+CMS ERROR", line.text, 10)) {
+        line.length = 0;
     }
+    return line;
+}
+
+bool M66ATParser::tx(M66CommandId id, ...) {
+    va_list ap;
+    va_start(ap, id);
+    _send_command(M66Command::get(id), &ap);
+    va_end(ap);
 
+    return true;
+}
+
+bool M66ATParser::tx(const char *pattern, ...) {
     // cleanup the input buffer and check for URC messages
-    cmd[0] = '\0';
+    _flush();
 
+    // the command is built in the line buffer, the answer replaces it
     va_list ap;
     va_start(ap, pattern);
-    vsnprintf(cmd, 512, pattern, ap);
+    vsnprintf(_line, sizeof(_line), pattern, ap);
     va_end(ap);
 
+    // a command of the table gets its deadline and its counters
+    const M66Command *known = M66Command::find(_line);
+    const uint32_t timeout = known && known->timeout ? known->timeout : M66_COMMAND_TIMEOUT_MS;
+    _send(_line, timeout, known ? known->id() : CMD_COUNT);
+    return true;
+}
+
+void M66ATParser::_send_command(const M66Command &command, va_list *args, const M66Retry *within) {
+    _flush();
+
+    // "AT", the verb and the formatted arguments, built in the line buffer
+    const size_t length = (size_t) snprintf(_line, sizeof(_line), "AT%s", command.verb);
+    if (command.arguments) M66Command::format(_line + length, sizeof(_line) - length, command.arguments, args);
+
+    // an attempt ends with the operation it belongs to
+    const uint32_t timeout = command.timeout ? command.timeout : M66_COMMAND_TIMEOUT_MS;
+    _send(_line, within ? within->clamp(timeout) : timeout, command.id());
+}
+
+void M66ATParser::_send(const char *cmd, uint32_t timeout, M66CommandId id) {
     _serial.puts(cmd);
     _serial.puts("\r\n");
-    CIODEBUG("GSM (%02d) <- '%s'\r\n", strlen(cmd), cmd);
-
-    return true;
+    _deadline = M66Deadline(timeout);
+    _sent = id;
+    CIOTRACE(TRACE_TX, cmd);
+    M66_STAT(_stats.commands++);
+#if M66_LATENCY
+    _latency.start(cmd);
+#endif
 }
 
 int M66ATParser::scan(const char *pattern, ...) {
-    char response[512];
-    //TODO use if (readable()) here
-    do {
-        readline(response, 512 - 1, 10);
-    } while (checkURC(response) != -1);
+    const M66Line line = nextLine(_deadline);
 
     va_list ap;
     va_start(ap, pattern);
-    int matched = vsscanf(response, pattern, ap);
+    int matched = vsscanf(line.text, pattern, ap);
     va_end(ap);
 
-    CIODEBUG("GSM (%02d) -> '%s' (%d)\r\n", strlen(response), response, matched);
     return matched;
 }
 
-bool M66ATParser::rx(const char *pattern, uint32_t timeout) {
-    char response[512];
-    size_t length = 0, patternLength = strnlen(pattern, sizeof(response));
+bool M66ATParser::rx(const char *pattern) {
+    return rx(pattern, _deadline);
+}
+
+bool M66ATParser::rx(const char *pattern, M66Deadline deadline) {
+    const M66Line line = nextLine(deadline);
+    if (!line.length) return false;
+
+    return strncmp(pattern, line.text, MIN(line.length, strlen(pattern))) == 0;
+}
+
+M66Line M66ATParser::nextLine(M66Deadline deadline) {
+    const uint32_t start = us_ticker_read();
     do {
-        length = readline(response, 512 - 1, timeout);
-        if (!length) return false;
+        _lineLength = readline(_line, sizeof(_line) - 1, deadline);
+        if (!_lineLength) break;
 
-        CIODEBUG("GSM (%02d) -> '%s'\r\n", strlen(response), response);
-    } while (checkURC(response) != -1);
+        CIOTRACE(TRACE_RX, _line);
+    } while (checkURC(_line) != -1);
+    _account(_line, start);
 
-    return strncmp(pattern, (const char *) response, MIN(length, patternLength)) == 0;
+    return line();
+}
+
+M66Line M66ATParser::line() const {
+    const M66Line line = {_line, _lineLength};
+    return line;
+}
+
+void M66ATParser::_flush() {
+    // what is left from earlier commands, URCs are handled on the way
+    while (flushRx(_line, sizeof(_line) - 1, M66Deadline(LINE_TIMEOUT))) {
+        CIOTRACE(TRACE_DROP, _line);
+        checkURC(_line);
+    }
+    _lineLength = 0;
+}
+
+void M66ATParser::_account(const char *response, uint32_t since) {
+    M66_STAT(_stats.blockedUs += us_ticker_read() - since);
+#if M66_LATENCY
+    _latency.answer();
+#endif
+
+    if (!response[0]) {
+        M66_STAT(_stats.timeouts++; _stats.byCommand[_sent].timeouts++);
+    } else if (!strncmp("ERROR", response, 5) || !strncmp("+CME ERROR", response, 10)) {
+        M66_STAT(_stats.errors++; _stats.byCommand[_sent].errors++);
+    }
+}
+
+void M66ATParser::getStats(M66Stats *stats) {
+    *stats = _stats;
+    stats->retries = M66Retry::retries();
+    stats->rxOverflows = _serial.overflows();
+}
+
+bool M66ATParser::getLatency(int index, M66LatencyEntry *entry) {
+#if M66_LATENCY
+    _latency.finish();
+    const M66LatencyEntry *e = _latency.entry(index);
+    if (e) *entry = *e;
+    return e != NULL;
+#else
+    return false;
+#endif
+}
+
+void M66ATParser::dumpLatency() {
+#if M66_LATENCY && M66_DEBUG
+    _latency.finish();
+    _latency.dump();
+#endif
+}
+
+void M66ATParser::resetLatency() {
+#if M66_LATENCY
+    _latency.reset();
+#endif
+}
+
+void M66ATParser::startCapture(uint8_t *buffer, size_t size) {
+    _serial.capture(buffer, (uint32_t) size);
+}
+
+size_t M66ATParser::stopCapture() {
+    _serial.capture(NULL, 0);
+    return _serial.captured();
 }
 
 int M66ATParser::checkURC(const char *response) {
     if (!strncmp("+RECEIVE:", response, 9)) {
+        M66_STAT(_stats.urcs[URC_RECEIVE]++);
         _packet_handler(response);
         return 0;
     }
+
+    // results of datagrams sent without waiting
+    if (_inflightCount && (!strcmp("SEND OK", response) || !strcmp("SEND FAIL", response))) {
+        const int id = _inflight[_inflightHead];
+        _inflightHead = (_inflightHead + 1) % M66_UDP_SEND_WINDOW;
+        _inflightCount--;
+
+        if (response[5] == 'F') _sendFailed |= 1u << id;
+        if (_linkEvent) _linkEvent(id);
+        M66_STAT(_stats.urcs[URC_SEND_RESULT]++);
+        return 0;
+    }
+
+    // TLS connections are not pushed, the URC only says there is something to read
+    if (!strncmp("+QSSLURC: ", response, 10)) {
+        const char *last = strrchr(response, ',');
+        const int ssid = last ? atoi(last + 1) : -1;
+        if (ssid >= 0 && ssid < M66_LINK_COUNT) {
+            if (strstr(response, "\"recv\"")) _sslPending |= 1u << ssid;
+            if (strstr(response, "\"closed\"")) _links[ssid] = LINK_CLOSED;
+            if (_linkEvent) _linkEvent(ssid);
+        }
+        M66_STAT(_stats.urcs[URC_SSL]++);
+        return 0;
+    }
+
+    // sender of the following +RECEIVE, enabled with AT+QISHOWRA=1
+    if (!strncmp("RECV FROM:", response, 10)) {
+        if (sscanf(response + 10, "%15[0-9.]:%d", _remoteIp, &_remotePort) != 2) _remoteIp[0] = '\0';
+        M66_STAT(_stats.urcs[URC_RECV_FROM]++);
+        return 0;
+    }
+
+    // connection state changes "n, CONNECT OK", "n, CONNECT FAIL", "n, CLOSED"
+    int id = -1, offset = 0;
+    if (sscanf(response, "%d, %n", &id, &offset) == 1 && offset && id >= 0 && id < M66_LINK_COUNT) {
+        const char *result = response + offset;
+        int state = -1;
+
+        if (!strcmp("CONNECT OK", result) || !strcmp("ALREADY CONNECT", result)) state = LINK_CONNECTED;
+        else if (!strcmp("CONNECT FAIL", result)) state = LINK_FAILED;
+        else if (!strcmp("CLOSED", result)) state = LINK_CLOSED;
+
+        if (state != -1) {
+            _links[id] = (uint8_t) state;
+            if (_linkEvent) _linkEvent(id);
+            M66_STAT(_stats.urcs[URC_LINK_STATE]++);
+            return 0;
+        }
+    }
+
     if (!strncmp("SMS Ready", response, 9)
         || !strncmp("Call Ready", response, 10)
         || !strncmp("+CPIN: READY", response, 12)
@@ -618,6 +1476,7 @@ int M66ATParser::checkURC(const char *response) {
         || !strncmp("+CFUN: 1", response, 8)
 
         ) {
+        M66_STAT(_stats.urcs[URC_STATUS]++);
         return 0;
     }
     /*TODO use networkTimeSynchronised  flag */
@@ -629,14 +1488,12 @@ int M66ATParser::checkURC(const char *response) {
     return -1;
 }
 
-size_t M66ATParser::read(char *buffer, size_t max, uint32_t timeout) {
-    Timer timer;
-    timer.start();
-
+size_t M66ATParser::read(char *buffer, size_t max, M66Deadline deadline) {
     size_t idx = 0;
-    while (idx < max && timer.read() < timeout) {
+    while (idx < max) {
         if (!_serial.readable()) {
-            __WFI();
+            if (deadline.expired()) break;
+            _wait_rx(deadline);
             continue;
         }
 
@@ -646,17 +1503,15 @@ size_t M66ATParser::read(char *buffer, size_t max, uint32_t timeout) {
     return idx;
 }
 
-size_t M66ATParser::readline(char *buffer, size_t max, uint32_t timeout) {
-    Timer timer;
-    timer.start();
-
+size_t M66ATParser::readline(char *buffer, size_t max, M66Deadline deadline) {
     size_t idx = 0;
 
-    while (idx < max && timer.read() < timeout) {
+    while (idx < max) {
 
         if (!_serial.readable()) {
-            // nothing in the buffer, wait for interrupt
-            __WFI();
+            // nothing in the buffer, sleep until the receive interrupt
+            if (deadline.expired()) break;
+            _wait_rx(deadline);
             continue;
         }
 
@@ -678,42 +1533,32 @@ size_t M66ATParser::readline(char *buffer, size_t max, uint32_t timeout) {
     return idx;
 }
 
-size_t M66ATParser::flushRx(char *buffer, size_t max, uint32_t timeout) {
-    Timer timer;
-    timer.start();
+void M66ATParser::_wait_rx(M66Deadline deadline) {
+    // other threads of the same priority run while the modem is silent, only a virtual clock polls
+    if (M66Clock::simulated()) M66Clock::idle();
+    else _serial.waitReadable(deadline.remaining());
+}
 
+size_t M66ATParser::flushRx(char *buffer, size_t max, M66Deadline deadline) {
     size_t idx = 0;
 
     do {
         for (int j = 0; j < (int) max && _serial.readable(); j++) {
             int c = _serial.getc();
 
-            if (c == '\n' && idx > 0 && buffer[idx - 1] == '\r') {
+            // the '\r' is not kept, a line ends at the '\n', "SEND OK" of datagrams come back to back
+            if (c == '\n') {
+                if (!idx) continue;
+                buffer[idx] = 0;
+                CIOTRACE(TRACE_DROP, buffer);
                 checkURC(buffer);
                 idx = 0;
             } else if (max - idx && isprint(c)) {
                 buffer[idx++] = (char) c;
             }
         }
-        //TODO Do we actually need a timeout here
-    } while (idx < max && _serial.readable() && timer.read() < timeout);
+    } while (idx < max && _serial.readable() && !deadline.expired());
 
     buffer[idx] = 0;
     return idx;
 }
-
-
-void M66ATParser::_debug_dump(const char *prefix, const uint8_t *b, size_t size) {
-    for (int i = 0; i < (int) size; i += 16) {
-        if (prefix && strlen(prefix) > 0) printf("%s %06x: ", prefix, i);
-        for (int j = 0; j < 16; j++) {
-            if ((i + j) < (int) size) printf("%02x", b[i + j]); else printf("  ");
-            if ((j + 1) % 2 == 0) putchar(' ');
-        }
-        putchar(' ');
-        for (int j = 0; j < 16 && (i + j) < (int) size; j++) {
-            putchar(b[i + j] >= 0x20 && b[i + j] <= 0x7E ? b[i + j] : '.');
-        }
-        printf("\r\n");
-    }
-}
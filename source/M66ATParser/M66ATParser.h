@@ -28,9 +28,60 @@
 #define M66ATPARSER_H
 
 #include "mbed.h"
+#include <stdarg.h>
 #include <stdint.h>
 #include <features/netsocket/nsapi_types.h>
 #include <BufferedSerial/BufferedSerial.h>
+#include "M66Types.h"
+#include "M66Stats.h"
+#include "M66Latency.h"
+#include "M66Clock.h"
+#include "M66Command.h"
+
+#ifndef M66_UDP_SEND_WINDOW
+#  define M66_UDP_SEND_WINDOW 4
+#endif
+
+#ifndef M66_COMMAND_TIMEOUT_MS
+#  define M66_COMMAND_TIMEOUT_MS 1000
+#endif
+
+#ifndef M66_LINE_SIZE
+#  define M66_LINE_SIZE 256
+#endif
+
+#ifndef M66_SERIAL_RX_SIZE
+#  define M66_SERIAL_RX_SIZE 512
+#endif
+
+#ifndef M66_SERIAL_TX_SIZE
+#  define M66_SERIAL_TX_SIZE 2048
+#endif
+
+#ifndef M66_STATIC_PACKETS
+#  define M66_STATIC_PACKETS 1
+#endif
+
+#ifndef M66_PACKET_STORE_SIZE
+#  define M66_PACKET_STORE_SIZE 4096
+#endif
+
+#ifndef M66_BATCH_COMMANDS
+#  define M66_BATCH_COMMANDS 1
+#endif
+
+#ifndef M66_TLS_CONTEXT
+#  define M66_TLS_CONTEXT 0
+#endif
+
+/** Receives streamed data chunk by chunk, returns false to drop the rest */
+typedef Callback<bool(const char *, size_t)> M66Sink;
+
+/** A line in the line buffer of the parser, valid until the parser is used again */
+struct M66Line {
+    const char *text;
+    size_t length;
+};
 
 /** M66 AT Parser Interface class.
     This is an interface to a M66 modem.
@@ -54,7 +105,8 @@ public:
     bool startup(void);
 
     /**
-    * Reset M66
+    * Reset M66, its settings (echo off, URCs, error codes, several connections)
+    * are sent in one command line
     *
     * @return true only if M66 resets successfully
     * play with PWERKEY - (only) to reset the modem, make sure the modem is reset and alive
@@ -92,7 +144,7 @@ public:
     /**
     * Set up the NTP server and enable the M66 clock functions
     *
-    * @return true if AT cmd were sucessful
+    * @return true if AT cmd were sucessful, false without M66_TIME_SYNC
     */
     bool requestDateTime(void);
 
@@ -123,13 +175,14 @@ public:
     /**
      * Get the Latitude, Longitude, Date and Time of the device
      *
-     * @param lat latitude
-     * @param lon longitude
+     * @param lat latitude, at least 16 bytes
+     * @param lon longitude, at least 16 bytes
      * @param datetime struct contains date and time
-     * @return null-teriminated IP address or null if no IP address is assigned
+     * @return null-teriminated IP address or null if no IP address is assigned, false without M66_LOCATION
      */
     bool getLocation(char *lon, char *lat);
 
+    // the network time, both return false without M66_TIME_SYNC
     bool getDateTime(tm *datetime, int *zone);
 
     bool getUnixTime(time_t *t);
@@ -140,7 +193,7 @@ public:
      * @param status battery status
      * @param level battery level
      * @param voltage battery voltage
-     * @return return false if
+     * @return return false if the modem did not answer or without M66_BATTERY
      */
     bool modem_battery(uint8_t *status, int *level, int *voltage);
 
@@ -154,9 +207,11 @@ public:
     /**
     * Get the IP of the host
     *
-    * @return true only if the chip has an IP address
+    * @param url the host name to resolve
+    * @param theIP buffer for the IP address, at least NSAPI_IPv4_SIZE bytes
+    * @return true only if the host name was resolved
     */
-    bool queryIP(const char *url, const char *theIP);
+    bool queryIP(const char *url, char *theIP);
 
     /**
     * Open a socketed connection
@@ -169,9 +224,52 @@ public:
     */
     bool open(const char *type, int id, const char *addr, int port);
 
+    /**
+    * Start opening a socketed connection, does not wait for the result.
+    * The link is LINK_CONNECTING until "n, CONNECT OK" or "n, CONNECT FAIL"
+    * is processed, which also triggers the link event.
+    *
+    * @param type the type of socket to open "UDP" or "TCP"
+    * @param id id to give the new socket, valid 0-5
+    * @param port port to open connection with
+    * @param addr the IP address of the destination
+    * @return true only if the modem accepted the open request
+    */
+    bool startOpen(const char *type, int id, const char *addr, int port);
+
+    /**
+    * Get the state of a connection as far as processed
+    *
+    * @param id id of the connection
+    * @return the LINKSTATUS of the connection
+    */
+    int linkStatus(int id);
+
+    /**
+    * Forget a failed or closed connection, so the id can be opened again
+    *
+    * @param id id of the connection
+    */
+    void clearLinkStatus(int id);
+
+    /**
+    * Drop the received data of a connection that recv() did not take yet,
+    * before the id is given to another socket
+    *
+    * @param id id of the connection
+    */
+    void discard(int id);
+
+    /**
+    * Process all lines waiting in the receive buffer, without blocking
+    * for new ones. Unsolicited result codes are handled, anything else is dropped.
+    */
+    void process();
+
     /**
     * Sends data to an open socket
-    * 1046 Bytes can be sent each time
+    * 1046 Bytes can be sent each time. The results of datagrams sent
+    * before are waited for first, SEND OK does not tell whose it is.
     *
     * @param id id of socket to send to
     * @param data data to be sent
@@ -180,6 +278,172 @@ public:
     */
     bool send(int id, const void *data, uint32_t amount);
 
+    /**
+    * Send a single datagram without waiting for SEND OK.
+    * Up to M66_UDP_SEND_WINDOW datagrams are in flight, SEND OK or SEND FAIL
+    * for them is handled as URC and triggers the link event.
+    *
+    * @param id id of socket to send to
+    * @param data data to be sent
+    * @param amount size of the datagram, max M66_MAX_SEND_BYTES
+    * @return true if the modem took the datagram
+    */
+    bool sendDatagram(int id, const void *data, uint32_t amount);
+
+    /**
+    * Check and reset the failure flag of datagrams sent with sendDatagram()
+    *
+    * @param id id of the socket
+    * @return true if the modem answered SEND FAIL for a datagram of this socket
+    */
+    bool sendFailed(int id);
+
+    /**
+    * Check if received data of a TCP connection was dropped because there was
+    * no room for it, the connection is failed then and recv() returns the data
+    * before the gap only. The flag is reset when the id is opened again.
+    *
+    * @param id id of the socket
+    * @return true if the stream has a gap
+    */
+    bool dataLost(int id);
+
+    /**
+    * Set the URL for the following HTTP request (AT+QHTTPURL)
+    *
+    * @param url the complete URL, "http://host[:port]/path"
+    * @param timeout time in s the modem waits for the URL and the answer
+    * @return true if the modem accepted the URL
+    */
+    bool httpUrl(const char *url, uint32_t timeout);
+
+    /**
+    * Send a HTTP GET request for the URL set with httpUrl() (AT+QHTTPGET),
+    * the response is kept in the modem until read with httpRead()
+    *
+    * @param timeout time in s to wait for the response
+    * @return true if the response arrived
+    */
+    bool httpGet(uint32_t timeout);
+
+    /**
+    * Send a HTTP POST request for the URL set with httpUrl() (AT+QHTTPPOST),
+    * the response is kept in the modem until read with httpRead()
+    *
+    * @param data the request body
+    * @param amount the size of the request body
+    * @param timeout time in s to wait for the response
+    * @return true if the response arrived
+    */
+    bool httpPost(const void *data, uint32_t amount, uint32_t timeout);
+
+    /**
+    * Read the response of the last HTTP request (AT+QHTTPREAD) and hand it to
+    * sink chunk by chunk, the data never has to fit into memory at once
+    *
+    * @param chunk buffer for one chunk, must be larger than 6 bytes
+    * @param size size of the chunk buffer
+    * @param sink called for every chunk
+    * @param timeout time in s the modem may stay silent
+    * @return the size of the response body or -1 on error or if sink dropped the data
+    */
+    int32_t httpRead(char *chunk, size_t size, M66Sink sink, uint32_t timeout);
+
+    /**
+    * Configure the modem TLS context, loads the CA certificate into the modem
+    * (AT+QSECWRITE, AT+QSSLCFG). Nothing is sent if it is already configured
+    * with the same certificate.
+    *
+    * @param ca the CA certificate (PEM), NULL disables the server verification
+    * @return true if the context is ready
+    */
+    bool sslSetup(const char *ca);
+
+    /**
+    * Open a TLS connection terminated by the modem (AT+QSSLOPEN), send(),
+    * recv() and close() use the TLS commands for this id until it is closed
+    *
+    * @param id id of the connection
+    * @param addr the server name, it is sent for SNI and checked against the
+    *        certificate, or its address
+    * @param port the server port
+    * @param timeout time in s the handshake may take
+    * @return true if the connection is established, else sslResult() tells why
+    */
+    bool sslOpen(int id, const char *addr, int port, uint32_t timeout);
+
+    /**
+    * Get the outcome of the last sslOpen()
+    *
+    * @return the SSLRESULT, SSL_HANDSHAKE for a failed handshake or certificate
+    */
+    int sslResult();
+
+    /**
+    * Log in to a FTP server (AT+QFTPUSER, AT+QFTPPASS, AT+QFTPOPEN)
+    *
+    * @param host the server host name or IP address
+    * @param port the server port
+    * @param user the user name
+    * @param password the password
+    * @param timeout time in s to wait for the login
+    * @return true if the login succeeded
+    */
+    bool ftpOpen(const char *host, int port, const char *user, const char *password, uint32_t timeout);
+
+    /**
+    * Download a file from the FTP server into the modem storage (AT+QFTPPATH, AT+QFTPGET),
+    * it is stored in UFS under the same name
+    *
+    * @param path the directory on the server, ending with '/'
+    * @param file the file name
+    * @param timeout time in s the download may take
+    * @return the size of the file or -1 on error
+    */
+    int32_t ftpGet(const char *path, const char *file, uint32_t timeout);
+
+    /**
+    * Log out from the FTP server (AT+QFTPCLOSE)
+    *
+    * @return true if the modem confirmed the logout
+    */
+    bool ftpClose();
+
+    /**
+    * Open a file of the modem storage for reading (AT+QFOPEN)
+    *
+    * @param file the file name
+    * @return the file handle or -1 on error
+    */
+    int fileOpen(const char *file);
+
+    /**
+    * Read the next part of an open file (AT+QFREAD)
+    *
+    * @param handle the file handle
+    * @param data where to put the data
+    * @param amount the maximum number of bytes
+    * @param timeout time in s to wait for the data
+    * @return the number of bytes read, 0 at the end of the file or -1 on error
+    */
+    int32_t fileRead(int handle, void *data, uint32_t amount, uint32_t timeout);
+
+    /**
+    * Close an open file (AT+QFCLOSE)
+    *
+    * @param handle the file handle
+    * @return true if the file was closed
+    */
+    bool fileClose(int handle);
+
+    /**
+    * Delete a file from the modem storage (AT+QFDEL)
+    *
+    * @param file the file name
+    * @return true if the file was deleted
+    */
+    bool fileDelete(const char *file);
+
     /**
     * Get the M66 connection status
     *
@@ -197,6 +461,21 @@ public:
     */
     int32_t recv(int id, void *data, uint32_t amount);
 
+    /**
+    * Receives data from any of several open sockets
+    *
+    * @param ids bit mask of the ids to receive from
+    * @param id set to the id the data was received from, not set without data, may be NULL
+    * @param data placeholder for returned information
+    * @param amount number of bytes to be received
+    * @param ip set to the sender address reported by AT+QISHOWRA or empty, NSAPI_IPv4_SIZE bytes, may be NULL
+    * @param port set to the sender port reported by AT+QISHOWRA, may be NULL
+    * @param datagram discard the part of a packet not fitting into data instead of keeping it
+    * @return the number of bytes received, 0 also for an empty datagram, 0 with id not
+    * set if all sockets are closed, or -1 on timeout
+    */
+    int32_t recvfrom(uint32_t ids, int *id, void *data, uint32_t amount, char *ip, int *port, bool datagram);
+
     /**
     * Closes a socket
     *
@@ -206,12 +485,72 @@ public:
     bool close(int id);
 
     /**
-    * Allows timeout to be changed between commands
+    * Set how long recv() and recvfrom() wait for data, the AT commands
+    * have their own deadlines (see commandTimeout())
     *
-    * @param timeout_ms timeout of the connection
+    * @param timeout_ms the time in ms, 0 only takes what is already received
     */
     void setTimeout(uint32_t timeout_ms);
 
+    /**
+    * Get the default time an AT command may take from sending it to its final
+    * result, from the command table (M66Command.cpp) or M66_COMMAND_TIMEOUT_MS
+    *
+    * @param command the command line, e.g. "AT+QIOPEN=0,..."
+    * @return the time in ms
+    */
+    static uint32_t commandTimeout(const char *command);
+
+    /**
+    * Replace the deadline of the command sent last, e.g. for a command that
+    * waits for the user given time of the modem (AT+QHTTPGET=<timeout>)
+    *
+    * @param deadline the new deadline
+    */
+    void setDeadline(M66Deadline deadline);
+
+    /**
+    * Copy the parser counters, the socket traffic is left alone
+    *
+    * @param stats where to put the snapshot
+    */
+    void getStats(M66Stats *stats);
+
+    /**
+    * Copy the latency histogram of a command verb
+    *
+    * @param index index of the verb, from 0
+    * @param entry where to put the histogram
+    * @return false if there is no verb with this index
+    */
+    bool getLatency(int index, M66LatencyEntry *entry);
+
+    /**
+    * Print the latency histograms of all command verbs, needs M66_DEBUG
+    */
+    void dumpLatency();
+
+    /**
+    * Forget the latency histograms
+    */
+    void resetLatency();
+
+    /**
+    * Record the UART traffic in both directions, see BufferedSerial::capture()
+    * for the format and tools/m66capture.py to decode or replay it
+    *
+    * @param buffer where to record, it must stay valid until stopCapture()
+    * @param size size of the buffer
+    */
+    void startCapture(uint8_t *buffer, size_t size);
+
+    /**
+    * Stop recording the UART traffic
+    *
+    * @return the size of the capture
+    */
+    size_t stopCapture();
+
     /**
     * Checks if data is available
     */
@@ -240,11 +579,102 @@ public:
         attach(Callback<void()>(obj, method));
     }
 
-    /*! send a command */
+    /**
+    * Attach a function to call with the connection id whenever the state
+    * of a connection changed (connected, failed, closed), data was received
+    * or sent for it. The function is called from the thread processing the line.
+    *
+    * @param func A pointer to a void function, or 0 to set as none
+    */
+    void attachLinkEvent(Callback<void(int)> func);
+
+    /**
+    * Lock the parser for exclusive use by the calling thread.
+    * The lock is recursive, every lock() needs a matching unlock().
+    */
+    void lock();
+
+    /**
+    * Try to lock the parser without waiting
+    *
+    * @return true if the lock was taken, it must be released with unlock()
+    */
+    bool trylock();
+
+    /**
+    * Release the parser lock
+    */
+    void unlock();
+
+    /*!
+    * @brief Run a command of the command table: send it, parse its response into the
+    * fields and wait for its final result. Failed attempts are repeated by its retry policy.
+    * @param id the command
+    * @param fields where the numbers and strings of the response go, NULL without
+    * @param count the number of fields
+    * @param ... the arguments of the command, as its format in the table expects
+    * @return true if the command succeeded and its response matched
+    */
+    bool command(M66CommandId id, M66Field *fields, size_t count, ...);
+
+    /*!
+    * @brief Run a command of the command table, its retries and the deadline of every
+    * attempt end with an enclosing operation.
+    * @param parent the enclosing operation
+    * @param id the command
+    * @param fields where the numbers and strings of the response go, NULL without
+    * @param count the number of fields
+    * @param ... the arguments of the command, as its format in the table expects
+    * @return true if the command succeeded and its response matched
+    */
+    bool command(const M66Retry &parent, M66CommandId id, M66Field *fields, size_t count, ...);
+
+    /*!
+    * @brief Run several commands of the command table in one command line, e.g.
+    * "ATE0+QIURC=1;+CMEE=1", which saves the round trips. The responses go to
+    * the fields of each step in order and the final result ends the line. After
+    * an error the commands not known to have succeeded are repeated one at a
+    * time with the retry policy of each, which is also how they are sent
+    * without M66_BATCH_COMMANDS or when one of them is not marked
+    * COMMAND_CONCATENATE in the table.
+    * @param steps the commands
+    * @param count the number of steps
+    * @param ... the arguments of all commands, in the order of the steps
+    * @return true if every command succeeded
+    */
+    bool batch(const M66Step *steps, size_t count, ...);
+
+    /*!
+    * @brief Run several commands of the command table like batch(), the command
+    * line, the retries and the deadline of every attempt end with an enclosing
+    * operation.
+    * @param parent the enclosing operation
+    * @param steps the commands
+    * @param count the number of steps
+    * @param ... the arguments of all commands, in the order of the steps
+    * @return true if every command succeeded
+    */
+    bool batch(const M66Retry &parent, const M66Step *steps, size_t count, ...);
+
+    /*!
+    * @brief Send a command of the command table whose answer is read by the caller,
+    * e.g. streamed data, the following scan() and rx() calls share its deadline.
+    * @param id the command
+    * @param ... the arguments of the command, as its format in the table expects
+    * @return true if sent
+    */
+    bool tx(M66CommandId id, ...);
+
+    /*!
+    * @brief Send a command, the following scan() and rx() calls share its deadline.
+    * @param pattern the command, printf() format
+    * @return true if sent
+    */
     bool tx(const char *pattern, ...);
 
     /**
-    * @brief Expect a formatted response, blocks until the response is received or timeout.
+    * @brief Expect a formatted response, blocks until the response is received or
+    * the deadline of the command is over.
     * This function will ignore URCs and return when the first non-URC has been received.
     * @param pattern the pattern to match
     * @return the number of matched elements
@@ -252,12 +682,35 @@ public:
     int scan(const char *pattern, ...);
 
     /*!
-    * @brief Expect a certain response, blocks util the response received or timeout.
+    * @brief Expect a certain response, blocks util the response received or the
+    * deadline of the command is over.
     * This function will ignore URCs and return when the first non-URC has been received.
     * @param pattern the string to expect
     * @return true if received or false if not
     */
-    bool rx(const char *pattern, uint32_t timeout = 5);
+    bool rx(const char *pattern);
+
+    /*!
+    * @brief Expect a certain response, blocks util the response received or the deadline.
+    * This function will ignore URCs and return when the first non-URC has been received.
+    * @param pattern the string to expect
+    * @param deadline the end of the wait, instead of the deadline of the command
+    * @return true if received or false if not
+    */
+    bool rx(const char *pattern, M66Deadline deadline);
+
+    /*!
+    * @brief Read the next line that is not an URC into the line buffer of the parser,
+    * without a copy. The URCs on the way are handled.
+    * @param deadline the end of the wait
+    * @return the line, empty if the deadline passed
+    */
+    M66Line nextLine(M66Deadline deadline);
+
+    /*!
+    * @return the line read last by nextLine(), scan() or rx()
+    */
+    M66Line line() const;
 
     /*!
     * Check if this line is an unsolicited result code.
@@ -270,41 +723,156 @@ public:
     * @brief Read a single line from the M66
     * @param buffer the character line buffer to read into
     * @param max the number of characters to read
+    * @param deadline the end of the wait for more characters
     * @return the number of characters read
     */
-    size_t readline(char *buffer, size_t max, uint32_t timeout);
+    size_t readline(char *buffer, size_t max, M66Deadline deadline);
 
     /*!
     * @brief Read binary data into a buffer
     * @param buffer the buffer to read into
     * @param max the number of bytes to read
+    * @param deadline the end of the wait for more bytes
     * @return the amount of bytes read
     */
-    size_t read(char *buffer, size_t max, uint32_t timeout = 5);
+    size_t read(char *buffer, size_t max, M66Deadline deadline);
 
-    size_t flushRx(char *buffer, size_t max, uint32_t timeout = 5);
+    /*!
+    * @brief Read what is already received, lines are checked for URCs
+    * @param buffer the buffer for the last incomplete line
+    * @param max the size of the buffer
+    * @param deadline the end of the flush while more keeps arriving
+    * @return the length of the incomplete line
+    */
+    size_t flushRx(char *buffer, size_t max, M66Deadline deadline);
 
 private:
+    friend class M66Replay;
+
+    // the UART ring buffers, before _serial which is constructed on them
+    char _serialRx[M66_SERIAL_RX_SIZE];
+    char _serialTx[M66_SERIAL_TX_SIZE];
     BufferedSerial _serial;
+    Mutex _mutex;
 
     DigitalOut _powerPin;
     DigitalOut _resetPin;
+    // received data until recv() takes it, one record per packet, the oldest first
     struct packet {
+#if !M66_STATIC_PACKETS
         struct packet *next;
+#endif
         int id;
         uint32_t len;
-        // data follows
-    } *_packets, **_packets_end;
+        char ip[16];
+        int port;
+        // data follows, padded to 4 bytes in the packet store
+    };
+#if M66_STATIC_PACKETS
+    uint32_t _packetStore[(M66_PACKET_STORE_SIZE + 3) / 4];
+    size_t _packetUsed;
+#else
+    struct packet *_packets, **_packets_end;
+#endif
+    // TCP connections that lost received data, nothing after the gap is kept
+    uint32_t _datagrams, _dataLost;
+
+    // sender of the next packet, from "RECV FROM:<ip>:<port>"
+    char _remoteIp[16];
+    int _remotePort;
 
     void _packet_handler(const char *response);
 
-    void _debug_dump(const char *prefix, const uint8_t *b, size_t size);
+    struct packet *_packet_alloc(uint32_t amount);
+
+    void _packet_append(struct packet *p);
+
+    struct packet *_packet_find(uint32_t ids);
+
+    void _packet_take(struct packet *p, uint32_t amount);
+
+    bool _select_client();
+
+    void _wait_rx(M66Deadline deadline);
+
+    void _flush();
+
+    void _send(const char *cmd, uint32_t timeout, M66CommandId id);
+
+    void _send_command(const M66Command &command, va_list *args, const M66Retry *within = NULL);
+
+    bool _command(const M66Retry *parent, M66CommandId id, M66Field *fields, size_t count, va_list *args);
+
+    bool _exchange(const M66Command &command, M66Field *fields, size_t count, va_list *args,
+                   const M66Retry *within = NULL);
+
+    bool _steps(const M66Retry *parent, const M66Step *steps, size_t count, va_list *args);
+
+    size_t _batch(const M66Retry *parent, const M66Step *steps, size_t count, va_list *args);
+
+    bool _response(const M66Command &command, const char *echo, M66Field *fields, size_t count);
+
+    M66Line _answer(const char *echo);
+
+    bool _prompt(M66Deadline deadline);
+
+    void _wait_send_window(M66Deadline deadline, int limit);
+
+    int32_t _read_body(char *chunk, size_t size, M66Sink sink, M66Deadline silence);
+
+    bool _result(const char *prefix, int *value, M66Deadline deadline);
+
+    int32_t _ssl_recv(int id, void *data, uint32_t amount);
+
+    void _account(const char *response, uint32_t since);
+
+    Callback<void(int)> _linkEvent;
+    volatile uint8_t _links[M66_LINK_COUNT];
+
+    // datagrams waiting for SEND OK, ids in the order they were sent
+    uint8_t _inflight[M66_UDP_SEND_WINDOW];
+    int _inflightHead, _inflightCount;
+    uint32_t _sendFailed;
+    bool _clientService;
+
+    // TLS connections and those with data waiting in the modem
+    uint32_t _secure, _sslPending;
+    bool _sslReady;
+    const char *_sslCa;
+    uint8_t _sslResult;
+
+    M66Stats _stats;
+    // the command the answers are counted for, CMD_COUNT if it is not in the table
+    M66CommandId _sent;
+#if M66_LATENCY
+    M66Latency _latency;
+#endif
 
     bool networkTimeSynchronised;
-    int _timeout;
+    // end of the command sent last, for scan() and rx()
+    M66Deadline _deadline;
+    uint32_t _timeout;
+    // the command sent, the line received, the URC handled: one at a time
+    char _line[M66_LINE_SIZE];
+    size_t _lineLength;
     char _ip_buffer[16];
     char _imei[16];
 
 };
 
+/** Holds the parser lock for the lifetime of the object */
+class M66ScopedLock {
+public:
+    M66ScopedLock(M66ATParser &parser) : _parser(parser) {
+        _parser.lock();
+    }
+
+    ~M66ScopedLock() {
+        _parser.unlock();
+    }
+
+private:
+    M66ATParser &_parser;
+};
+
 #endif
@@ -0,0 +1,73 @@
+/*
+ * ubirch#1 M66 Modem driver clock.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include "mbed.h"
+#include "M66Clock.h"
+
+M66ClockSource *M66Clock::_source = NULL;
+
+void M66Clock::use(M66ClockSource *source) {
+    _source = source;
+}
+
+uint32_t M66Clock::now() {
+    if (_source) return _source->now();
+
+    // the kernel tick
+    return (uint32_t) Kernel::get_ms_count();
+}
+
+void M66Clock::sleep(uint32_t ms) {
+    if (_source) _source->sleep(ms);
+    else Thread::wait(ms);
+}
+
+bool M66Clock::simulated() {
+    return _source != NULL;
+}
+
+void M66Clock::idle() {
+    if (_source) _source->idle();
+    else __WFI();
+}
+
+M66VirtualClock::M66VirtualClock(uint32_t step) : _now(0), _step(step ? step : 1) {
+}
+
+uint32_t M66VirtualClock::now() {
+    return _now;
+}
+
+void M66VirtualClock::sleep(uint32_t ms) {
+    // others waiting at the same time advance it as well
+    const uint32_t until = _now + ms;
+    while ((int32_t) (until - _now) > 0) idle();
+}
+
+void M66VirtualClock::idle() {
+    advance(_step);
+    Thread::yield();
+}
+
+void M66VirtualClock::advance(uint32_t ms) {
+    core_util_critical_section_enter();
+    _now += ms;
+    core_util_critical_section_exit();
+}
@@ -0,0 +1,207 @@
+/*!
+ * @file
+ * @brief Time base of the M66 driver.
+ *
+ * Every wait and timeout of the parser, the retry policies and the replay
+ * goes through M66Clock. It runs on real time unless a test installs its
+ * own clock source, e.g. an M66VirtualClock, which lets a minute of modem
+ * timeouts pass in a few milliseconds.
+ *
+ * Measurements (statistics, latency histograms, the trace) stay on real
+ * time.
+ *
+ * The driver reads the kernel tick or us_ticker_read() and never keeps an
+ * mbed Timer running, a running Timer would keep the MCU out of deep sleep.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+#ifndef M66CLOCK_H
+#define M66CLOCK_H
+
+#include <stdint.h>
+
+/** A source of time for the driver */
+class M66ClockSource {
+public:
+    virtual ~M66ClockSource() {}
+
+    /**
+     * @return the time in ms, it wraps around
+     */
+    virtual uint32_t now() = 0;
+
+    /**
+     * Block the calling thread.
+     *
+     * @param ms the time to wait in ms
+     */
+    virtual void sleep(uint32_t ms) = 0;
+
+    /**
+     * Wait a little for something to happen, e.g. a byte to arrive. Called
+     * in polling loops that check their timeout afterwards.
+     */
+    virtual void idle() = 0;
+};
+
+/** Virtual time for tests.
+ *
+ * The time only moves when a thread of the driver waits or when the test
+ * advances it. Every wait advances it in steps and yields to the other
+ * threads of the same priority in between, so data injected by a test
+ * thread is seen before a timeout expires.
+ *
+ * Example:
+ * @code
+ *  M66VirtualClock clock;
+ *  M66Clock::use(&clock);
+ *  parser.rx("OK", M66Deadline(10000));  // nothing answers, returns after 10 virtual seconds
+ *  M66Clock::use(NULL);
+ * @endcode
+ */
+class M66VirtualClock : public M66ClockSource {
+public:
+    /**
+     * @param step the time in ms one idle() call or sleep step advances the clock
+     */
+    M66VirtualClock(uint32_t step = 1);
+
+    virtual uint32_t now();
+    virtual void sleep(uint32_t ms);
+    virtual void idle();
+
+    /**
+     * Move the time forward.
+     *
+     * @param ms the time in ms
+     */
+    void advance(uint32_t ms);
+
+private:
+    volatile uint32_t _now;
+    uint32_t _step;
+};
+
+/** The clock of the driver */
+class M66Clock {
+public:
+    /**
+     * Install a clock source, all waits and timeouts started afterwards use it.
+     *
+     * @param source the clock source or NULL for real time
+     */
+    static void use(M66ClockSource *source);
+
+    /**
+     * @return the time in ms, it wraps around
+     */
+    static uint32_t now();
+
+    /**
+     * Block the calling thread.
+     *
+     * @param ms the time to wait in ms
+     */
+    static void sleep(uint32_t ms);
+
+    /**
+     * Wait a little for something to happen, in real time until the next interrupt.
+     */
+    static void idle();
+
+    /**
+     * @return true while a clock source is installed, waits for the modem
+     * must poll with idle() then instead of blocking in real time
+     */
+    static bool simulated();
+
+private:
+    static M66ClockSource *_source;
+};
+
+/** Measures time on the driver clock, used like Timer but running from construction */
+class M66Timer {
+public:
+    M66Timer() : _start(M66Clock::now()) {}
+
+    /** Restart at 0 */
+    void reset() {
+        _start = M66Clock::now();
+    }
+
+    /**
+     * @return the time since construction or reset() in ms
+     */
+    uint32_t read_ms() const {
+        return M66Clock::now() - _start;
+    }
+
+    /**
+     * @return the time since construction or reset() in s
+     */
+    float read() const {
+        return read_ms() / 1000.0f;
+    }
+
+private:
+    uint32_t _start;
+};
+
+/** The end of a timeout on the driver clock.
+ *
+ * All waits of the parser take a deadline instead of a timeout, so the
+ * calls of one command (tx(), scan(), rx()) share the time of the command.
+ *
+ * Example:
+ * @code
+ *  M66Deadline deadline(2000);
+ *  while (!done && !deadline.expired()) M66Clock::idle();
+ * @endcode
+ */
+class M66Deadline {
+public:
+    /**
+     * @param ms the time from now in ms
+     */
+    explicit M66Deadline(uint32_t ms = 0) : _start(M66Clock::now()), _ms(ms) {}
+
+    /**
+     * @return true once the time is over
+     */
+    bool expired() const {
+        return M66Clock::now() - _start >= _ms;
+    }
+
+    /**
+     * @return the time left in ms, 0 once expired
+     */
+    uint32_t remaining() const {
+        const uint32_t elapsed = M66Clock::now() - _start;
+        return elapsed < _ms ? _ms - elapsed : 0;
+    }
+
+    /** Give the same time again from now, e.g. when the modem made progress */
+    void restart() {
+        _start = M66Clock::now();
+    }
+
+private:
+    uint32_t _start;
+    uint32_t _ms;
+};
+
+#endif
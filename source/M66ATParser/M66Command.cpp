@@ -0,0 +1,177 @@
+/*
+ * ubirch#1 M66 Modem AT command table.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "mbed.h"
+#include "M66Command.h"
+
+/*
+ * One line per M66CommandId, in its order. The timeouts are the maximum
+ * response times of the M66 AT manual, 0 is M66_COMMAND_TIMEOUT_MS. Only
+ * command() retries, the loops around streamed commands are in the parser.
+ * The settings that M66ATParser::batch() puts in one command line are
+ * marked COMMAND_CONCATENATE.
+ */
+static const M66Command commands[] = {
+//   verb            arguments                      response                       final                 timeout  retry         flags
+    {"",            NULL,                           NULL,                          "OK",                 0,      RETRY_NONE,   0},
+    {"E0",          NULL,                           NULL,                          "OK",                 0,      RETRY_NONE,   COMMAND_CONCATENATE},
+    {"V0",          NULL,                           NULL,                          "0",                  0,      RETRY_NONE,   0},
+    {"V1",          NULL,                           NULL,                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QIURC",      "=1",                           NULL,                          "OK",                 0,      RETRY_NONE,   COMMAND_CONCATENATE},
+    {"+CMEE",       "=1",                           NULL,                          "OK",                 0,      RETRY_NONE,   COMMAND_CONCATENATE},
+    {"+QIMUX",      "=1",                           NULL,                          "OK",                 0,      RETRY_NONE,   COMMAND_CONCATENATE},
+    {"+QISHOWRA",   "=1",                           NULL,                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QPOWD",      "=1",                           NULL,                          "NORMAL POWER DOWN",  20000,  RETRY_NONE,   0},
+    {"+CGATT?",     NULL,                           "+CGATT: %d",                  "OK",                 0,      RETRY_NONE,   0},
+    {"+CGATT",      "=1",                           NULL,                          "OK",                 75000,  RETRY_ATTACH, 0},
+    {"+CREG?",      NULL,                           "+CREG: %d,%d",                "OK",                 300,    RETRY_NONE,   0},
+    {"+CGREG?",     NULL,                           "+CGREG: %d,%d",               "OK",                 300,    RETRY_NONE,   0},
+    {"+QNITZ",      "=1",                           NULL,                          "OK",                 0,      RETRY_NONE,   COMMAND_CONCATENATE},
+    {"+CTZU",       "=2",                           NULL,                          "OK",                 0,      RETRY_NONE,   COMMAND_CONCATENATE},
+    {"+CFUN",       "=1",                           NULL,                          "OK",                 15000,  RETRY_NONE,   COMMAND_CONCATENATE},
+    {"+CCLK",       "=\"70/01/01,00:00:00+00\"",    NULL,                          "OK",                 0,      RETRY_NONE,   COMMAND_CONCATENATE},
+    {"+CCLK?",      NULL,                           "+CCLK: \"%d/%d/%d,%d:%d:%d%d\"", "OK",              0,      RETRY_NONE,   0},
+    {"+QNTP",       "=\"%s\"",                      "+QNTP: %d",                   "OK",                 30000,  RETRY_NONE,   COMMAND_RESPONSE_AFTER_FINAL},
+    {"+QIDEACT",    NULL,                           NULL,                          "DEACT OK",           40000,  RETRY_NONE,   0},
+    {"+QIFGCNT",    "=0",                           NULL,                          "OK",                 0,      RETRY_NONE,   COMMAND_CONCATENATE},
+    {"+QICSGP",     "=1,\"%s\",\"%s\",\"%s\"",      NULL,                          "OK",                 0,      RETRY_NONE,   COMMAND_CONCATENATE},
+    {"+QIREGAPP",   NULL,                           NULL,                          "OK",                 0,      RETRY_NONE,   COMMAND_CONCATENATE},
+    {"+QIACT",      NULL,                           NULL,                          "OK",                 150000, RETRY_NONE,   0},
+    {"+QILOCIP",    NULL,                           "%s",                          NULL,                 0,      RETRY_NONE,   0},
+    {"+GSN",        NULL,                           "%s",                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QCCID",      NULL,                           "%s",                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QCELLLOC",   "=1",                           "+QCELLLOC: %s,%s",            "OK",                 30000,  RETRY_NONE,   0},
+    {"+CBC",        NULL,                           "+CBC: %d,%d,%d",              "OK",                 0,      RETRY_NONE,   0},
+    {"+QIDNSGIP",   "=\"%s\"",                      "%s",                          "OK",                 20000,  RETRY_DNS,    COMMAND_RESPONSE_AFTER_FINAL},
+    {"+QISTATE",    NULL,                           "%d",                          NULL,                 0,      RETRY_NONE,   0},
+    {"+QIDNSIP",    "=0",                           NULL,                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QIOPEN",     "=%d,\"%s\",\"%s\",\"%d\"",     NULL,                          "OK",                 75000,  RETRY_NONE,   0},
+    {"+QICLOSE",    "=%d",                          "%d, CLOSE OK",                NULL,                 10000,  RETRY_CLOSE,  0},
+    {"+QISRVC",     "=1",                           NULL,                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QISEND",     "=%d,%d",                       NULL,                          NULL,                 10000,  RETRY_NONE,   0},
+    {"+QHTTPURL",   "=%d,%d",                       NULL,                          "CONNECT",            10000,  RETRY_NONE,   0},
+    {"+QHTTPGET",   "=%d",                          NULL,                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QHTTPPOST",  "=%d,50,%d",                    NULL,                          "CONNECT",            10000,  RETRY_NONE,   0},
+    {"+QHTTPREAD",  "=%d",                          NULL,                          "CONNECT",            0,      RETRY_NONE,   0},
+    {"+QFTPUSER",   "=\"%s\"",                      NULL,                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QFTPPASS",   "=\"%s\"",                      NULL,                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QFTPOPEN",   "=\"%s\",%d",                   NULL,                          "OK",                 10000,  RETRY_NONE,   0},
+    {"+QFTPPATH",   "=\"%s\"",                      NULL,                          "OK",                 10000,  RETRY_NONE,   0},
+    {"+QFTPCFG",    "=4,\"/UFS/\"",                 NULL,                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QFTPGET",    "=\"%s\"",                      NULL,                          "OK",                 10000,  RETRY_NONE,   0},
+    {"+QFTPCLOSE",  NULL,                           NULL,                          "OK",                 10000,  RETRY_NONE,   0},
+    {"+QFOPEN",     "=\"%s\",2",                    "+QFOPEN:%d",                  "OK",                 0,      RETRY_NONE,   0},
+    {"+QFREAD",     "=%d,%d",                       "CONNECT %d",                  NULL,                 0,      RETRY_NONE,   0},
+    {"+QFCLOSE",    "=%d",                          NULL,                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QFDEL",      "=\"%s\"",                      NULL,                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QSECWRITE",  "=\"RAM:ca.pem\",%d,100",       NULL,                          "CONNECT",            10000,  RETRY_NONE,   0},
+    {"+QSSLCFG",    "=\"%s\",%d,%s",                NULL,                          "OK",                 0,      RETRY_NONE,   0},
+    {"+QSSLOPEN",   "=%d,%d,\"%s\",%d,0",           NULL,                          "OK",                 10000,  RETRY_NONE,   0},
+    {"+QSSLSEND",   "=%d,%d",                       NULL,                          NULL,                 0,      RETRY_NONE,   0},
+    {"+QSSLRECV",   "=0,%d,%d",                     NULL,                          NULL,                 0,      RETRY_NONE,   0},
+    {"+QSSLCLOSE",  "=%d",                          NULL,                          "OK",                 10000,  RETRY_NONE,   0},
+};
+
+MBED_STATIC_ASSERT(sizeof(commands) / sizeof(commands[0]) == CMD_COUNT, "one descriptor per M66CommandId");
+
+const M66Command &M66Command::get(M66CommandId id) {
+    return commands[id];
+}
+
+M66CommandId M66Command::id() const {
+    return (M66CommandId) (this - commands);
+}
+
+const M66Command *M66Command::find(const char *line) {
+    // "AT+QIOPEN=0,..." is looked up as "+QIOPEN", "AT+CREG?" as "+CREG?"
+    const char *verb = line;
+    if (!strncmp("AT", verb, 2)) verb += 2;
+    const size_t length = strcspn(verb, "=");
+
+    for (size_t i = 0; i < CMD_COUNT; i++) {
+        const char *known = commands[i].verb;
+        if (!strncmp(known, verb, length) && !known[length]) return &commands[i];
+    }
+    return NULL;
+}
+
+size_t M66Command::format(char *line, size_t size, const char *format, va_list *args) {
+    size_t length = 0;
+
+    while (*format) {
+        char number[12];
+        const char *text = format;
+        size_t n = 1;
+        if (format[0] == '%' && format[1] == 'd') {
+            n = (size_t) snprintf(number, sizeof(number), "%d", va_arg(*args, int));
+            text = number;
+            format += 2;
+        } else if (format[0] == '%' && format[1] == 's') {
+            text = va_arg(*args, const char *);
+            n = strlen(text);
+            format += 2;
+        } else {
+            format++;
+        }
+
+        // like snprintf(), what does not fit is counted but not written
+        if (length < size) memcpy(line + length, text, MIN(n, size - length));
+        length += n;
+    }
+
+    if (size) line[MIN(length, size - 1)] = '\0';
+    return length;
+}
+
+bool M66Command::parse(const char *pattern, const char *text, M66Field *fields, size_t count) {
+    size_t used = 0;
+
+    while (*pattern) {
+        if (*pattern == ' ') {
+            // any number of spaces, also none
+            while (*text == ' ') text++;
+            pattern++;
+        } else if (pattern[0] == '%' && pattern[1] == 'd') {
+            if (used == count || !fields[used].number) return false;
+            char *end;
+            const long value = strtol(text, &end, 10);
+            if (end == text) return false;
+            *fields[used++].number = (int) value;
+            text = end;
+            pattern += 2;
+        } else if (pattern[0] == '%' && pattern[1] == 's') {
+            if (used == count || !fields[used].text) return false;
+            // up to the literal following it, the buffer keeps room for the terminator
+            const char stop[2] = {pattern[2], '\0'};
+            const size_t length = stop[0] ? strcspn(text, stop) : strlen(text);
+            if (!length || length >= fields[used].size) return false;
+            memcpy(fields[used].text, text, length);
+            fields[used++].text[length] = '\0';
+            text += length;
+            pattern += 2;
+        } else if (*pattern++ != *text++) {
+            return false;
+        }
+    }
+
+    return used == count;
+}
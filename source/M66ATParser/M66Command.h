@@ -0,0 +1,185 @@
+/*!
+ * @file
+ * @brief Table of the AT commands the driver sends to the M66.
+ *
+ * Every command is described once: its verb, the format of its
+ * arguments, the pattern of its information response, the final result that
+ * ends it, its maximum response time and its retry policy. The parser runs
+ * them with M66ATParser::command(), several in one command line with
+ * batch(), or sends them with tx() when the answer is streamed data.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+#ifndef M66COMMAND_H
+#define M66COMMAND_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "M66Retry.h"
+
+/** The commands of the table, in the order of their descriptors */
+enum M66CommandId {
+    CMD_AT = 0,          //!< AT, is the modem alive
+    CMD_ECHO_OFF,        //!< ATE0
+    CMD_NUMERIC,         //!< ATV0, numeric result codes
+    CMD_VERBOSE,         //!< ATV1, verbose result codes
+    CMD_URC,             //!< AT+QIURC=1, report the start up URC
+    CMD_ERRORS,          //!< AT+CMEE=1, numeric +CME ERROR codes
+    CMD_MUX,             //!< AT+QIMUX=1, several connections
+    CMD_SHOW_ADDRESS,    //!< AT+QISHOWRA=1, sender of received data
+    CMD_POWER_DOWN,      //!< AT+QPOWD=1
+    CMD_ATTACHED,        //!< AT+CGATT?, int attached
+    CMD_ATTACH,          //!< AT+CGATT=1
+    CMD_REGISTRATION,    //!< AT+CREG?, int mode, int status
+    CMD_GPRS_REGISTRATION, //!< AT+CGREG?, int mode, int status
+    CMD_NITZ,            //!< AT+QNITZ=1, network time
+    CMD_ZONE_UPDATE,     //!< AT+CTZU=2, update the time zone
+    CMD_FUNCTION,        //!< AT+CFUN=1, full functionality
+    CMD_SET_CLOCK,       //!< AT+CCLK="70/01/01,00:00:00+00", mark the clock unset
+    CMD_CLOCK,           //!< AT+CCLK?, int year, month, day, hour, minute, second, zone
+    CMD_NTP,             //!< AT+QNTP="<server>", int result after OK
+    CMD_DEACTIVATE,      //!< AT+QIDEACT
+    CMD_FOREGROUND,      //!< AT+QIFGCNT=0
+    CMD_APN,             //!< AT+QICSGP=1,"<apn>","<user>","<password>"
+    CMD_REGISTER_APP,    //!< AT+QIREGAPP
+    CMD_ACTIVATE,        //!< AT+QIACT
+    CMD_LOCAL_IP,        //!< AT+QILOCIP, string address
+    CMD_IMEI,            //!< AT+GSN, string IMEI
+    CMD_ICCID,           //!< AT+QCCID, string ICCID
+    CMD_LOCATION,        //!< AT+QCELLLOC=1, string longitude, string latitude
+    CMD_BATTERY,         //!< AT+CBC, int status, int level, int voltage
+    CMD_RESOLVE,         //!< AT+QIDNSGIP="<host>", string address after OK
+    CMD_STATE,           //!< AT+QISTATE, int state (numeric result codes)
+    CMD_DNS_ADDRESS,     //!< AT+QIDNSIP=0, connect to addresses
+    CMD_OPEN,            //!< AT+QIOPEN=<id>,"<type>","<address>","<port>"
+    CMD_CLOSE,           //!< AT+QICLOSE=<id>, int id
+    CMD_CLIENT,          //!< AT+QISRVC=1, client service
+    CMD_SEND,            //!< AT+QISEND=<id>,<length>, the data follows the prompt
+    CMD_HTTP_URL,        //!< AT+QHTTPURL=<length>,<timeout>, the URL follows CONNECT
+    CMD_HTTP_GET,        //!< AT+QHTTPGET=<timeout>
+    CMD_HTTP_POST,       //!< AT+QHTTPPOST=<length>,50,<timeout>, the body follows CONNECT
+    CMD_HTTP_READ,       //!< AT+QHTTPREAD=<timeout>, the body follows CONNECT
+    CMD_FTP_USER,        //!< AT+QFTPUSER="<user>"
+    CMD_FTP_PASSWORD,    //!< AT+QFTPPASS="<password>"
+    CMD_FTP_OPEN,        //!< AT+QFTPOPEN="<host>",<port>, +QFTPOPEN: follows
+    CMD_FTP_PATH,        //!< AT+QFTPPATH="<path>", +QFTPPATH: follows
+    CMD_FTP_STORAGE,     //!< AT+QFTPCFG=4,"/UFS/", download to the file system
+    CMD_FTP_GET,         //!< AT+QFTPGET="<file>", +QFTPGET: follows
+    CMD_FTP_CLOSE,       //!< AT+QFTPCLOSE, +QFTPCLOSE: follows
+    CMD_FILE_OPEN,       //!< AT+QFOPEN="<file>",2, int handle
+    CMD_FILE_READ,       //!< AT+QFREAD=<handle>,<length>, the data follows CONNECT <length>
+    CMD_FILE_CLOSE,      //!< AT+QFCLOSE=<handle>
+    CMD_FILE_DELETE,     //!< AT+QFDEL="<file>"
+    CMD_SSL_WRITE_CA,    //!< AT+QSECWRITE="RAM:ca.pem",<length>,100, the certificate follows CONNECT
+    CMD_SSL_CONFIG,      //!< AT+QSSLCFG="<option>",<context>,<value>, value formatted by the caller
+    CMD_SSL_OPEN,        //!< AT+QSSLOPEN=<id>,<context>,"<address>",<port>,0, +QSSLOPEN: follows
+    CMD_SSL_SEND,        //!< AT+QSSLSEND=<id>,<length>, the data follows the prompt
+    CMD_SSL_RECEIVE,     //!< AT+QSSLRECV=0,<id>,<length>, the data follows +QSSLRECV:
+    CMD_SSL_CLOSE,       //!< AT+QSSLCLOSE=<id>
+    CMD_COUNT
+};
+
+/** Flags of a command descriptor */
+enum M66CommandFlags {
+    COMMAND_RESPONSE_AFTER_FINAL = 1, //!< the information response follows the final result (AT+QIDNSGIP)
+    COMMAND_CONCATENATE = 2           //!< may share a command line with others, it ends with OK
+};
+
+/** Where a field of a response goes, a number or a string of known size */
+struct M66Field {
+    /** A decimal number, "%d" in the response pattern */
+    M66Field(int *number) : number(number), text(NULL), size(0) {}
+
+    /** A string, "%s" in the response pattern, never longer than the buffer */
+    template<size_t N>
+    M66Field(char (&text)[N]) : number(NULL), text(text), size(N) {}
+
+    /** A string, "%s" in the response pattern, for a buffer of the given size */
+    M66Field(char *text, size_t size) : number(NULL), text(text), size(size) {}
+
+    int *number;
+    char *text;
+    size_t size;
+};
+
+/** Descriptor of a command, the table of all commands is in M66Command.cpp */
+struct M66Command {
+    const char *verb;      //!< after "AT", e.g. "+CREG?", "E0" or "" for AT
+    const char *arguments; //!< appended to the verb, "%d" and "%s" take the arguments, NULL without
+    const char *response;  //!< pattern of the information response, NULL without one
+    const char *final;     //!< final result of success, NULL if the command ends with the response
+    uint32_t timeout;      //!< time in ms from sending to the final result, 0 for M66_COMMAND_TIMEOUT_MS
+    uint8_t retry;         //!< M66RetryOp of failed attempts in command(), RETRY_NONE for one
+    uint8_t flags;         //!< M66CommandFlags
+
+    /**
+     * @param id the command
+     * @return its descriptor
+     */
+    static const M66Command &get(M66CommandId id);
+
+    /**
+     * Find the descriptor of a command line by its verb.
+     *
+     * @param line the command line, e.g. "AT+QIOPEN=0,..." is found as "+QIOPEN"
+     * @return the descriptor or NULL for an unknown verb
+     */
+    static const M66Command *find(const char *line);
+
+    /**
+     * @return the id of a descriptor of the table
+     */
+    M66CommandId id() const;
+
+    /**
+     * Format the arguments of a command like snprintf(), only "%d" (int) and
+     * "%s" (const char *) are known. The arguments are taken from the list,
+     * so that several commands can take theirs from the same list in turn.
+     *
+     * @param line where the text goes, NULL if size is 0
+     * @param size the size of the buffer
+     * @param format the arguments of the descriptor
+     * @param args the argument list, left after the last argument taken
+     * @return the length of the complete text, size or more if it was cut
+     */
+    static size_t format(char *line, size_t size, const char *format, va_list *args);
+
+    /**
+     * Parse a response line into typed fields. The pattern is literal text
+     * with "%d" for a decimal number and "%s" for a string, which ends at the
+     * character following it in the pattern or at the end of the line. A
+     * space matches any number of spaces. A string that does not fit its
+     * buffer fails the parse rather than being cut.
+     *
+     * @param pattern the pattern, e.g. "+CREG: %d,%d"
+     * @param text the line
+     * @param fields where the numbers and strings go, in the order of the pattern
+     * @param count the number of fields, must be the number of conversions
+     * @return true if the whole pattern matched and every field was set
+     */
+    static bool parse(const char *pattern, const char *text, M66Field *fields, size_t count);
+};
+
+/** A command of a concatenated command line, see M66ATParser::batch() */
+struct M66Step {
+    M66CommandId id;
+    M66Field *fields;   //!< where its response goes, NULL without one
+    size_t count;       //!< the number of fields
+};
+
+#endif
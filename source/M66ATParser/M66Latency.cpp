@@ -0,0 +1,103 @@
+/*
+ * ubirch#1 M66 Modem command latency histograms.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include <string.h>
+#include "M66Latency.h"
+
+M66Latency::M66Latency() : _start(0), _last(0), _current(-1) {
+    memset(_entries, 0, sizeof(_entries));
+}
+
+void M66Latency::start(const char *command) {
+    finish();
+
+    // "AT+QIOPEN=0,..." is counted as "+QIOPEN", "AT+CREG?" as "+CREG?"
+    const char *verb = command;
+    if (!strncmp("AT", verb, 2)) verb += 2;
+    size_t length = strcspn(verb, "=");
+    if (!length) {
+        verb = "AT";
+        length = 2;
+    }
+
+    _current = slot(verb, length);
+    _start = _last = us_ticker_read();
+}
+
+void M66Latency::answer() {
+    if (_current >= 0) _last = us_ticker_read();
+}
+
+void M66Latency::finish() {
+    if (_current < 0) return;
+
+    M66LatencyEntry &e = _entries[_current];
+    _current = -1;
+    // sent but never waited for (datagrams, data written after a prompt)
+    if (_last == _start) return;
+
+    const uint32_t ms = (_last - _start) / 1000;
+    int bucket = 0;
+    while (bucket < M66_LATENCY_BUCKETS - 1 && ms >= (1u << bucket)) bucket++;
+
+    e.buckets[bucket]++;
+    e.count++;
+    if (ms > e.maxMs) e.maxMs = ms;
+}
+
+const M66LatencyEntry *M66Latency::entry(int index) const {
+    if (index < 0 || index >= M66_LATENCY_VERBS || !_entries[index].verb[0]) return NULL;
+    return &_entries[index];
+}
+
+void M66Latency::dump() const {
+    for (int i = 0; i < M66_LATENCY_VERBS && _entries[i].verb[0]; i++) {
+        const M66LatencyEntry &e = _entries[i];
+        printf("M66 %-11s n=%lu max=%lums |", e.verb, (unsigned long) e.count, (unsigned long) e.maxMs);
+        for (int b = 0; b < M66_LATENCY_BUCKETS; b++) printf(" %lu", (unsigned long) e.buckets[b]);
+        printf("\r\n");
+    }
+}
+
+void M66Latency::reset() {
+    memset(_entries, 0, sizeof(_entries));
+    _current = -1;
+}
+
+int M66Latency::slot(const char *verb, size_t length) {
+    if (length >= M66_LATENCY_VERB_SIZE) length = M66_LATENCY_VERB_SIZE - 1;
+
+    for (int i = 0; i < M66_LATENCY_VERBS; i++) {
+        M66LatencyEntry &e = _entries[i];
+        if (!e.verb[0]) {
+            // the last entry collects all verbs that did not get one of their own
+            if (i == M66_LATENCY_VERBS - 1) {
+                strcpy(e.verb, "*");
+            } else {
+                memcpy(e.verb, verb, length);
+                e.verb[length] = '\0';
+            }
+            return i;
+        }
+        if (i == M66_LATENCY_VERBS - 1 || (!strncmp(e.verb, verb, length) && !e.verb[length])) return i;
+    }
+
+    return M66_LATENCY_VERBS - 1;
+}
@@ -0,0 +1,99 @@
+/*!
+ * @file
+ * @brief Latency histograms of the M66 AT commands.
+ *
+ * Every command is timed from sending it to the last answer read for it
+ * and counted in a histogram of its verb ("+QIOPEN", "+CREG?", ...). The
+ * buckets are powers of two in ms, the memory is fixed: M66_LATENCY_VERBS
+ * verbs, further verbs are counted as "*".
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+#ifndef M66LATENCY_H
+#define M66LATENCY_H
+
+#include "mbed.h"
+#include <stdint.h>
+
+#ifndef M66_LATENCY
+#  define M66_LATENCY         1
+#endif
+#ifndef M66_LATENCY_VERBS
+#  define M66_LATENCY_VERBS   16
+#endif
+#ifndef M66_LATENCY_BUCKETS
+#  define M66_LATENCY_BUCKETS 18
+#endif
+
+#define M66_LATENCY_VERB_SIZE 12
+
+/** Histogram of a single command verb */
+struct M66LatencyEntry {
+    char verb[M66_LATENCY_VERB_SIZE];       //!< "+QIOPEN", "+CREG?", "E0", "*" for the overflow
+    uint32_t count;                         //!< number of commands
+    uint32_t maxMs;                         //!< longest latency seen
+    uint32_t buckets[M66_LATENCY_BUCKETS];  //!< [0] < 1 ms, [i] < 2^i ms, the last one the rest
+};
+
+/** Collects the latency histograms of the commands sent */
+class M66Latency {
+public:
+    M66Latency();
+
+    /**
+     * A command was sent, the previous one is finished.
+     *
+     * @param command the command line, "AT+QIOPEN=..."
+     */
+    void start(const char *command);
+
+    /**
+     * An answer (or a timeout) for the current command was read.
+     */
+    void answer();
+
+    /**
+     * Record the current command, if it got an answer.
+     */
+    void finish();
+
+    /**
+     * @param index index of the verb, from 0
+     * @return the histogram or NULL if there is no verb with this index
+     */
+    const M66LatencyEntry *entry(int index) const;
+
+    /**
+     * Print all histograms, one line per verb.
+     */
+    void dump() const;
+
+    /**
+     * Forget all histograms.
+     */
+    void reset();
+
+private:
+    M66LatencyEntry _entries[M66_LATENCY_VERBS];
+    // us_ticker_read() values
+    uint32_t _start, _last;
+    int _current;
+
+    int slot(const char *verb, size_t length);
+};
+
+#endif
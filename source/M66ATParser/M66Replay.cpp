@@ -0,0 +1,146 @@
+/*
+ * ubirch#1 M66 Modem capture replay.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include <string.h>
+#include "M66Replay.h"
+#include "M66Interface.h"
+#include "M66Clock.h"
+
+#define CAPTURE_HEADER_SIZE 4
+#define RECORD_HEADER_SIZE  4
+#define DUMP_LINE_SIZE      32
+
+M66Replay::M66Replay(M66ATParser &parser)
+    : _parser(parser), _thread(osPriorityNormal, M66_REPLAY_THREAD_STACK_SIZE), _done(0),
+      _capture(NULL), _length(0), _position(0), _speed(1), _started(false), _offline(false), _complete(false) {
+}
+
+M66Replay::M66Replay(M66Interface &modem)
+    : _parser(modem._m66), _thread(osPriorityNormal, M66_REPLAY_THREAD_STACK_SIZE), _done(0),
+      _capture(NULL), _length(0), _position(0), _speed(1), _started(false), _offline(false), _complete(false) {
+}
+
+M66Replay::~M66Replay() {
+    if (_started) _thread.terminate();
+    if (_offline) {
+        _parser._serial.tap(NULL);
+        _parser._serial.offline(false);
+    }
+}
+
+bool M66Replay::start(const uint8_t *capture, size_t length, uint32_t speed) {
+    if (_started || length < CAPTURE_HEADER_SIZE || memcmp(capture, "M66C", CAPTURE_HEADER_SIZE)) return false;
+
+    _capture = capture;
+    _length = length;
+    _position = CAPTURE_HEADER_SIZE;
+    _speed = speed;
+    _started = true;
+
+    _offline = true;
+    _parser._serial.offline(true);
+    _thread.start(callback(this, &M66Replay::run));
+    return true;
+}
+
+bool M66Replay::wait(uint32_t timeout) {
+    if (!_started) return false;
+    if (_done.wait(timeout) > 0) _done.release();
+    return _complete;
+}
+
+size_t M66Replay::inject(const void *data, size_t length) {
+    _offline = true;
+    _parser._serial.offline(true);
+    return _parser._serial.inject(data, length);
+}
+
+void M66Replay::attachTransmit(Callback<void(char)> func) {
+    _offline = true;
+    _parser._serial.offline(true);
+    _parser._serial.tap(func);
+}
+
+size_t M66Replay::position() const {
+    return _position;
+}
+
+void M66Replay::dump(const uint8_t *capture, size_t length) {
+#if M66_DEBUG
+    for (size_t offset = 0; offset < length; offset += DUMP_LINE_SIZE) {
+        printf("M66C ");
+        for (size_t i = offset; i < length && i < offset + DUMP_LINE_SIZE; i++) printf("%02x", capture[i]);
+        printf("\r\n");
+    }
+#endif
+}
+
+void M66Replay::run() {
+    BufferedSerial &serial = _parser._serial;
+    // only count what the parser writes from now on
+    const uint32_t base = serial.transmitted();
+    uint32_t expected = 0;
+    bool failed = false;
+
+    while (!failed && _position + RECORD_HEADER_SIZE <= _length) {
+        const uint8_t *record = _capture + _position;
+        const size_t length = record[1];
+        const uint16_t stamp = (uint16_t) (record[2] | record[3] << 8);
+        if (_position + RECORD_HEADER_SIZE + length > _length) break;
+
+        if (record[0] == BufferedSerial::CaptureTx) {
+            expected += length;
+        } else if (record[0] == BufferedSerial::CaptureRx) {
+            // the answer must not overtake the command it answers
+            M66Timer timer;
+            while (serial.transmitted() - base < expected && !(failed = timer.read_ms() > M66_REPLAY_TX_TIMEOUT)) {
+                M66Clock::sleep(1);
+            }
+            if (failed) break;
+
+            if (_speed) {
+                const uint32_t delay = (stamp & 0x8000) ? (stamp & 0x7FFFu) * 1000 : stamp;
+                if (delay / _speed >= 1000) M66Clock::sleep(delay / _speed / 1000);
+                else wait_us((int) (delay / _speed));
+            }
+            failed = !receive(record + RECORD_HEADER_SIZE, length);
+        }
+        _position += RECORD_HEADER_SIZE + length;
+    }
+
+    _complete = !failed && _position == _length;
+    _done.release();
+}
+
+bool M66Replay::receive(const uint8_t *data, size_t length) {
+    BufferedSerial &serial = _parser._serial;
+    M66Timer timer;
+
+    // wait for the parser to make room, a replay without delays is faster than the UART
+    size_t taken = 0;
+    while (taken < length) {
+        taken += serial.inject(data + taken, length - taken);
+        if (taken < length) {
+            if (timer.read_ms() > M66_REPLAY_TX_TIMEOUT) return false;
+            M66Clock::sleep(1);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,143 @@
+/*!
+ * @file
+ * @brief Replay of recorded modem traffic into the M66 parser.
+ *
+ * A capture taken with M66Interface::startCapture() holds both directions
+ * of the UART. The replayer feeds the received side back into the parser,
+ * as if the modem was answering, while everything the parser writes is
+ * discarded. Each received record waits until the parser has written as
+ * many bytes as were sent before it in the capture, so the answers never
+ * overtake the commands, and then for its recorded delay divided by the
+ * speed. Field captures become repeatable test cases and benchmarks this way.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+#ifndef M66REPLAY_H
+#define M66REPLAY_H
+
+#include "mbed.h"
+#include "M66ATParser.h"
+
+class M66Interface;
+
+#ifndef M66_REPLAY_TX_TIMEOUT
+#  define M66_REPLAY_TX_TIMEOUT      10000
+#endif
+#ifndef M66_REPLAY_THREAD_STACK_SIZE
+#  define M66_REPLAY_THREAD_STACK_SIZE 1024
+#endif
+
+/** Replays a capture into a parser.
+ *
+ * Example:
+ * @code
+ *  M66ATParser parser(GSM_UART_TX, GSM_UART_RX, GSM_PWRKEY, GSM_POWER);
+ *  M66Replay replay(parser);
+ *
+ *  replay.start(capture, sizeof(capture), 10);  // ten times faster
+ *  parser.send(0, "hello", 5);                 // answered from the capture
+ *  bool complete = replay.wait(1000);
+ * @endcode
+ *
+ * The modem should be off, its output would mix with the replay. A replayer
+ * runs one capture, use a new instance for the next.
+ */
+class M66Replay {
+public:
+    /**
+     * @param parser the parser to answer, once started nothing it writes reaches the modem until the replayer is destroyed
+     */
+    M66Replay(M66ATParser &parser);
+
+    /**
+     * @param modem the interface whose parser to answer
+     */
+    M66Replay(M66Interface &modem);
+
+    ~M66Replay();
+
+    /**
+     * Start replaying in the background.
+     *
+     * @param capture the capture, it must stay valid until the replay ended
+     * @param length  its size
+     * @param speed   divisor of the recorded delays, 0 replays without delays
+     * @return false if this is no capture or the replayer was used before
+     */
+    bool start(const uint8_t *capture, size_t length, uint32_t speed = 1);
+
+    /**
+     * Wait for the end of the replay.
+     *
+     * @param timeout time to wait in ms
+     * @return true if the whole capture was replayed, false on timeout or if the
+     *         parser did not write what the capture expects in M66_REPLAY_TX_TIMEOUT
+     */
+    bool wait(uint32_t timeout);
+
+    /**
+     * Feed data to the parser right away, as if the modem had sent it. Like
+     * during a replay, everything the parser writes is discarded from now
+     * on until the replayer is destroyed.
+     *
+     * @param data   the data
+     * @param length its size
+     * @return the amount taken, less than length if the receive buffer is full
+     */
+    size_t inject(const void *data, size_t length);
+
+    /**
+     * Call a function with every byte the parser writes, e.g. to simulate
+     * a modem that answers with inject(). Like during a replay, nothing the
+     * parser writes reaches the modem from now on until the replayer is destroyed.
+     *
+     * @param func called in the context of the writing thread, 0 to set as none
+     */
+    void attachTransmit(Callback<void(char)> func);
+
+    /**
+     * @return the offset of the next record to replay
+     */
+    size_t position() const;
+
+    /**
+     * Print a capture as hex lines ("M66C <hex>"), the lines can be cut from
+     * a console log and fed to tools/m66capture.py. Does nothing without
+     * M66_DEBUG.
+     *
+     * @param capture the capture
+     * @param length  its size
+     */
+    static void dump(const uint8_t *capture, size_t length);
+
+private:
+    M66ATParser &_parser;
+    Thread _thread;
+    Semaphore _done;
+    const uint8_t *_capture;
+    size_t _length;
+    volatile size_t _position;
+    uint32_t _speed;
+    bool _started;
+    bool _offline;
+    volatile bool _complete;
+
+    void run();
+    bool receive(const uint8_t *data, size_t length);
+};
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * ubirch#1 M66 Modem retry and backoff policy.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include "M66Retry.h"
+#include "M66Stats.h"
+
+static const M66RetryPolicy policies[RETRY_OP_COUNT] = {
+    {M66_RETRY_REGISTER_ATTEMPTS, M66_RETRY_REGISTER_BUDGET_MS},
+    {M66_RETRY_ATTACH_ATTEMPTS, M66_RETRY_ATTACH_BUDGET_MS},
+    {M66_RETRY_CONNECT_ATTEMPTS, M66_RETRY_CONNECT_BUDGET_MS},
+    {M66_RETRY_OPEN_ATTEMPTS, M66_RETRY_OPEN_BUDGET_MS},
+    {M66_RETRY_CLOSE_ATTEMPTS, M66_RETRY_CLOSE_BUDGET_MS},
+    {M66_RETRY_SEND_ATTEMPTS, M66_RETRY_SEND_BUDGET_MS},
+    {M66_RETRY_DNS_ATTEMPTS, M66_RETRY_DNS_BUDGET_MS},
+    {M66_RETRY_TIME_ATTEMPTS, M66_RETRY_TIME_BUDGET_MS},
+};
+
+volatile uint32_t M66Retry::_seed = 0;
+volatile uint32_t M66Retry::_retries = 0;
+
+M66Retry::M66Retry(M66RetryOp op, const M66Retry *parent)
+    : _policy(policies[op]),
+      _budgetMs(parent ? MIN(policies[op].budgetMs, parent->remainingMs()) : policies[op].budgetMs),
+      _attempts(0),
+      _random(_seed ^ (uint32_t) (uintptr_t) this) {
+}
+
+bool M66Retry::next() {
+    if (_attempts >= _policy.attempts || expired()) return false;
+
+    if (_attempts > 0) {
+        // never sleep past the deadline, there would be no time left for the attempt
+        const uint32_t delay = backoffMs();
+        const uint32_t remaining = remainingMs();
+        if (delay >= remaining) return false;
+        M66Clock::sleep(delay);
+        M66_STAT(core_util_atomic_incr_u32(&_retries, 1));
+    }
+
+    _attempts++;
+    return true;
+}
+
+int M66Retry::attempts() const {
+    return _attempts;
+}
+
+uint32_t M66Retry::retries() {
+    return _retries;
+}
+
+bool M66Retry::expired() const {
+    return remainingMs() == 0;
+}
+
+uint32_t M66Retry::remainingMs() const {
+    // the budget of a nested operation is already cut to that of its parent
+    const uint32_t elapsed = _timer.read_ms();
+    return elapsed < _budgetMs ? _budgetMs - elapsed : 0;
+}
+
+uint32_t M66Retry::clamp(uint32_t ms) const {
+    return MIN(ms, remainingMs());
+}
+
+void M66Retry::seed(uint32_t seed) {
+    core_util_critical_section_enter();
+    _seed ^= seed;
+    core_util_critical_section_exit();
+}
+
+uint32_t M66Retry::backoffMs() {
+    // base * 2^(attempt - 1), capped
+    uint32_t delay = M66_RETRY_BASE_DELAY_MS;
+    for (int i = 1; i < _attempts && delay < M66_RETRY_MAX_DELAY_MS; i++) delay <<= 1;
+    delay = MIN(delay, (uint32_t) M66_RETRY_MAX_DELAY_MS);
+
+    const uint32_t jitter = delay * M66_RETRY_JITTER_PERCENT / 100;
+    if (jitter) delay -= random() % (jitter + 1);
+
+    return delay;
+}
+
+uint32_t M66Retry::random() {
+    // xorshift32 of this operation, mixed with the ticker so an unseeded state still differs per call
+    uint32_t x = _random ^ us_ticker_read();
+    if (!x) x = 0x9E3779B9;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    _random = x;
+    return x;
+}
@@ -0,0 +1,194 @@
+/*!
+ * @file
+ * @brief Retry and backoff policy for M66 AT command sequences.
+ *
+ * All retry loops of the parser go through this class, so the number of
+ * attempts, the delay between them and the time an operation may block
+ * are configured in one place (see mbed_lib.json, "retry-*").
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+#ifndef M66RETRY_H
+#define M66RETRY_H
+
+#include "mbed.h"
+#include <stdint.h>
+#include "M66Clock.h"
+
+#ifndef M66_RETRY_BASE_DELAY_MS
+#  define M66_RETRY_BASE_DELAY_MS    500
+#endif
+#ifndef M66_RETRY_MAX_DELAY_MS
+#  define M66_RETRY_MAX_DELAY_MS     4000
+#endif
+#ifndef M66_RETRY_JITTER_PERCENT
+#  define M66_RETRY_JITTER_PERCENT   50
+#endif
+
+#ifndef M66_RETRY_REGISTER_ATTEMPTS
+#  define M66_RETRY_REGISTER_ATTEMPTS 20
+#endif
+#ifndef M66_RETRY_REGISTER_BUDGET_MS
+#  define M66_RETRY_REGISTER_BUDGET_MS 60000
+#endif
+#ifndef M66_RETRY_ATTACH_ATTEMPTS
+#  define M66_RETRY_ATTACH_ATTEMPTS  20
+#endif
+#ifndef M66_RETRY_ATTACH_BUDGET_MS
+#  define M66_RETRY_ATTACH_BUDGET_MS 60000
+#endif
+#ifndef M66_RETRY_CONNECT_ATTEMPTS
+#  define M66_RETRY_CONNECT_ATTEMPTS 3
+#endif
+#ifndef M66_RETRY_CONNECT_BUDGET_MS
+#  define M66_RETRY_CONNECT_BUDGET_MS 180000
+#endif
+#ifndef M66_RETRY_OPEN_ATTEMPTS
+#  define M66_RETRY_OPEN_ATTEMPTS    3
+#endif
+#ifndef M66_RETRY_OPEN_BUDGET_MS
+#  define M66_RETRY_OPEN_BUDGET_MS   60000
+#endif
+#ifndef M66_RETRY_CLOSE_ATTEMPTS
+#  define M66_RETRY_CLOSE_ATTEMPTS   2
+#endif
+#ifndef M66_RETRY_CLOSE_BUDGET_MS
+#  define M66_RETRY_CLOSE_BUDGET_MS  5000
+#endif
+#ifndef M66_RETRY_SEND_ATTEMPTS
+#  define M66_RETRY_SEND_ATTEMPTS    2
+#endif
+#ifndef M66_RETRY_SEND_BUDGET_MS
+#  define M66_RETRY_SEND_BUDGET_MS   30000
+#endif
+#ifndef M66_RETRY_DNS_ATTEMPTS
+#  define M66_RETRY_DNS_ATTEMPTS     3
+#endif
+#ifndef M66_RETRY_DNS_BUDGET_MS
+#  define M66_RETRY_DNS_BUDGET_MS    15000
+#endif
+#ifndef M66_RETRY_TIME_ATTEMPTS
+#  define M66_RETRY_TIME_ATTEMPTS    3
+#endif
+#ifndef M66_RETRY_TIME_BUDGET_MS
+#  define M66_RETRY_TIME_BUDGET_MS   10000
+#endif
+
+/** Operations with their own retry policy */
+enum M66RetryOp {
+    RETRY_REGISTER = 0, //!< network registration polling (AT+CREG?, AT+CGREG?)
+    RETRY_ATTACH,       //!< GPRS attach (AT+CGATT=1)
+    RETRY_CONNECT,      //!< complete connect sequence, the overall deadline
+    RETRY_OPEN,         //!< opening a connection (AT+QIOPEN)
+    RETRY_CLOSE,        //!< closing a connection (AT+QICLOSE)
+    RETRY_SEND,         //!< sending a chunk of data (AT+QISEND)
+    RETRY_DNS,          //!< host name lookup (AT+QIDNSGIP)
+    RETRY_TIME,         //!< reading the network time (AT+CCLK?)
+    RETRY_OP_COUNT,
+    RETRY_NONE = RETRY_OP_COUNT //!< a single attempt, for the command table
+};
+
+/** Limits of a single retried operation */
+struct M66RetryPolicy {
+    uint16_t attempts;  //!< maximum number of attempts
+    uint32_t budgetMs;  //!< no new attempt is started after this time
+};
+
+/** Retry state of a single operation.
+ *
+ * Example:
+ * @code
+ *  M66Retry retry(RETRY_CLOSE);
+ *  while (retry.next()) {
+ *      if (tx("AT+QICLOSE=%d", id) && rx("CLOSE OK")) return true;
+ *  }
+ *  return false;
+ * @endcode
+ *
+ * The delay before every attempt but the first grows exponentially from
+ * M66_RETRY_BASE_DELAY_MS up to M66_RETRY_MAX_DELAY_MS and is randomly
+ * shortened by up to M66_RETRY_JITTER_PERCENT, so that devices which lost
+ * the network at the same time do not retry in lockstep.
+ *
+ * A nested operation gets what is left of the budget of the enclosing one
+ * at most, and the deadline of an attempt is cut with clamp(). Every
+ * operation has its own jitter state, retries of several threads do not
+ * share one.
+ */
+class M66Retry {
+public:
+    /** Start retrying an operation
+     * @param op     the operation, selects the policy
+     * @param parent enclosing operation, its remaining budget limits this one
+     */
+    M66Retry(M66RetryOp op, const M66Retry *parent = NULL);
+
+    /**
+     * Wait for the backoff delay and account for a new attempt.
+     *
+     * @return true if the attempt may be made, false if attempts or time are exhausted
+     */
+    bool next();
+
+    /**
+     * @return the number of attempts made so far
+     */
+    int attempts() const;
+
+    /**
+     * @return true if this or an enclosing operation ran out of time
+     */
+    bool expired() const;
+
+    /**
+     * @return time left until the budget of this or an enclosing operation is used up
+     */
+    uint32_t remainingMs() const;
+
+    /**
+     * @param ms the time an attempt may take
+     * @return the time cut to the budget left, so an attempt does not outlive the operation
+     */
+    uint32_t clamp(uint32_t ms) const;
+
+    /**
+     * Seed the jitter generator, use something unique to the device (e.g. the IMEI).
+     *
+     * @param seed the seed value, mixed into the current state
+     */
+    static void seed(uint32_t seed);
+
+    /**
+     * @return the number of attempts repeated by any operation so far
+     */
+    static uint32_t retries();
+
+private:
+    const M66RetryPolicy &_policy;
+    uint32_t _budgetMs;
+    M66Timer _timer;
+    int _attempts;
+    uint32_t _random;
+
+    uint32_t backoffMs();
+
+    uint32_t random();
+    static volatile uint32_t _seed;
+    static volatile uint32_t _retries;
+};
+
+#endif
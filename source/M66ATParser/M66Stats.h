@@ -0,0 +1,75 @@
+/*!
+ * @file
+ * @brief Counters of the M66 driver.
+ *
+ * The parser and the interface count what they do on their hot paths,
+ * M66Interface::getStats() takes a snapshot. The counters only grow (and
+ * wrap), send the snapshot with your telemetry and compare it with the
+ * previous one. Set M66_STATS to 0 to compile the counting out.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+#ifndef M66STATS_H
+#define M66STATS_H
+
+#include <stdint.h>
+#include "M66Types.h"
+#include "M66Command.h"
+
+#ifndef M66_STATS
+#  define M66_STATS 1
+#endif
+
+/** Evaluate a counting statement only if the statistics are compiled in */
+#if M66_STATS
+#  define M66_STAT(statement) do { statement; } while (0)
+#else
+#  define M66_STAT(statement) do { } while (0)
+#endif
+
+/** Kinds of unsolicited result codes */
+enum M66UrcType {
+    URC_RECEIVE = 0,    //!< "+RECEIVE: n, len", received data
+    URC_SEND_RESULT,    //!< "SEND OK"/"SEND FAIL" of a datagram in flight
+    URC_RECV_FROM,      //!< "RECV FROM:ip:port", sender of the next data
+    URC_LINK_STATE,     //!< "n, CONNECT OK", "n, CLOSED", ...
+    URC_SSL,            //!< "+QSSLURC: ...", TLS data or close
+    URC_STATUS,         //!< status messages that are ignored, "Call Ready", "+PDP DEACT", ...
+    URC_TYPE_COUNT
+};
+
+/** Snapshot of the driver counters */
+struct M66Stats {
+    uint32_t commands;                  //!< AT commands sent
+    uint32_t timeouts;                  //!< answers that did not come in time
+    uint32_t errors;                    //!< answers with ERROR or +CME ERROR
+    uint32_t retries;                   //!< attempts repeated by a retry policy
+    uint32_t urcs[URC_TYPE_COUNT];      //!< unsolicited result codes by type
+    uint32_t rxOverflows;               //!< bytes lost because the RX ring was full
+    uint32_t allocFailures;             //!< received packets dropped, the packet store was full
+    uint64_t blockedUs;                 //!< time spent waiting for answers in rx() and scan()
+    struct {
+        uint16_t timeouts;              //!< answers that did not come in time
+        uint16_t errors;                //!< answers with ERROR or +CME ERROR
+    } byCommand[CMD_COUNT + 1];         //!< by M66CommandId, the last for commands not in the table
+    struct {
+        uint32_t sent;                  //!< payload bytes sent
+        uint32_t received;              //!< payload bytes received
+    } sockets[M66_SOCKET_COUNT];        //!< traffic by socket id
+};
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * ubirch#1 M66 Modem binary trace recorder.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include "mbed.h"
+#include "M66Trace.h"
+#include "M66Types.h"
+
+#define TRACE_HEADER_SIZE 8
+#define TRACE_MAX_ARGS    8
+
+uint8_t M66Trace::_ring[M66_TRACE_BUFFER_SIZE];
+size_t M66Trace::_head = 0;
+size_t M66Trace::_tail = 0;
+size_t M66Trace::_used = 0;
+uint32_t M66Trace::_dropped = 0;
+
+void M66Trace::info(uint16_t line, const char *format, ...) {
+    int32_t args[TRACE_MAX_ARGS];
+    int count = 0;
+
+    // take one int per conversion, the messages only use integer arguments
+    va_list ap;
+    va_start(ap, format);
+    for (const char *p = format; *p && count < TRACE_MAX_ARGS; p++) {
+        if (*p != '%') continue;
+        p++;
+        while (*p && strchr("-+ #0123456789.l", *p)) p++;
+        if (!*p) break;
+        if (*p == '%') continue;
+        args[count++] = (*p == 's') ? (int32_t) (va_arg(ap, const char *) != NULL) : (int32_t) va_arg(ap, int);
+    }
+    va_end(ap);
+
+    record(TRACE_INFO, line, args, count * sizeof(int32_t));
+}
+
+void M66Trace::text(M66TraceEvent event, uint16_t line, const char *text) {
+    const size_t length = strlen(text);
+    record(event, line, text, length < M66_TRACE_LINE_SIZE ? length : M66_TRACE_LINE_SIZE);
+}
+
+void M66Trace::data(uint16_t line, const void *data, size_t size) {
+    uint8_t payload[2 + M66_TRACE_DATA_SIZE];
+    const size_t length = size < M66_TRACE_DATA_SIZE ? size : M66_TRACE_DATA_SIZE;
+
+    payload[0] = (uint8_t) size;
+    payload[1] = (uint8_t) (size >> 8);
+    memcpy(payload + 2, data, length);
+    record(TRACE_DATA, line, payload, 2 + length);
+}
+
+size_t M66Trace::read(void *buffer, size_t size) {
+    uint8_t *out = (uint8_t *) buffer;
+    size_t copied = 0;
+
+    core_util_critical_section_enter();
+    while (_used) {
+        const size_t length = TRACE_HEADER_SIZE + _ring[(_tail + 5) % M66_TRACE_BUFFER_SIZE];
+        if (copied + length > size) break;
+
+        for (size_t i = 0; i < length; i++) out[copied++] = _ring[(_tail + i) % M66_TRACE_BUFFER_SIZE];
+        _tail = (_tail + length) % M66_TRACE_BUFFER_SIZE;
+        _used -= length;
+    }
+    core_util_critical_section_exit();
+
+    return copied;
+}
+
+void M66Trace::dump() {
+#if M66_DEBUG
+    // room for the largest record, printing must not happen in the critical section
+    uint8_t chunk[TRACE_HEADER_SIZE + 255];
+    size_t length;
+
+    while ((length = read(chunk, sizeof(chunk)))) {
+        printf("M66T ");
+        for (size_t i = 0; i < length; i++) printf("%02x", chunk[i]);
+        printf("\r\n");
+    }
+#endif
+}
+
+uint32_t M66Trace::dropped() {
+    return _dropped;
+}
+
+void M66Trace::record(M66TraceEvent event, uint16_t line, const void *payload, size_t length) {
+    const uint32_t now = us_ticker_read();
+    const uint8_t header[TRACE_HEADER_SIZE] = {
+        (uint8_t) now, (uint8_t) (now >> 8), (uint8_t) (now >> 16), (uint8_t) (now >> 24),
+        (uint8_t) event, (uint8_t) length, (uint8_t) line, (uint8_t) (line >> 8)
+    };
+
+    core_util_critical_section_enter();
+    // make room, the oldest records go first
+    while (_used && _used + TRACE_HEADER_SIZE + length > M66_TRACE_BUFFER_SIZE) drop();
+    put(header, sizeof(header));
+    put(payload, length);
+    core_util_critical_section_exit();
+}
+
+void M66Trace::put(const void *bytes, size_t length) {
+    const uint8_t *in = (const uint8_t *) bytes;
+    for (size_t i = 0; i < length; i++) {
+        _ring[_head] = in[i];
+        _head = (_head + 1) % M66_TRACE_BUFFER_SIZE;
+    }
+    _used += length;
+}
+
+void M66Trace::drop() {
+    const size_t length = TRACE_HEADER_SIZE + _ring[(_tail + 5) % M66_TRACE_BUFFER_SIZE];
+    _tail = (_tail + length) % M66_TRACE_BUFFER_SIZE;
+    _used -= length;
+    _dropped++;
+}
@@ -0,0 +1,128 @@
+/*!
+ * @file
+ * @brief Binary trace recorder of the M66 parser.
+ *
+ * Instead of printing, the parser writes compact binary records into a
+ * fixed RAM ring: a timestamp, the event, the source line and a few
+ * arguments or the first bytes of an AT line. When the ring is full the
+ * oldest records are dropped, so it always holds the recent history.
+ * Read the ring with M66Trace::read() or print it with M66Trace::dump()
+ * and decode it offline with tools/m66trace.py.
+ *
+ * M66_TRACE_LEVEL selects what is recorded:
+ * - 0 nothing
+ * - 1 status messages (connects, resets, failures)
+ * - 2 and the AT lines sent and received
+ * - 3 and the payload of sent and received data
+ *
+ * Record layout (little endian):
+ * ```
+ * uint32 timestamp (us) | uint8 event | uint8 length | uint16 source line | length bytes
+ * ```
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+#ifndef M66TRACE_H
+#define M66TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef M66_TRACE_LEVEL
+#  define M66_TRACE_LEVEL       2
+#endif
+#ifndef M66_TRACE_BUFFER_SIZE
+#  define M66_TRACE_BUFFER_SIZE 2048
+#endif
+#ifndef M66_TRACE_LINE_SIZE
+#  define M66_TRACE_LINE_SIZE   48
+#endif
+#ifndef M66_TRACE_DATA_SIZE
+#  define M66_TRACE_DATA_SIZE   16
+#endif
+
+/** Trace record types */
+enum M66TraceEvent {
+    TRACE_INFO = 1, //!< status message, int32 arguments of the format at the source line
+    TRACE_TX,       //!< AT line sent, the first M66_TRACE_LINE_SIZE bytes
+    TRACE_RX,       //!< line received as answer
+    TRACE_DROP,     //!< line received but not expected, dropped
+    TRACE_DATA,     //!< payload, uint16 total length and the first M66_TRACE_DATA_SIZE bytes
+};
+
+/** The trace ring, shared by all parser instances */
+class M66Trace {
+public:
+    /**
+     * Record a status message. Only the integer arguments are kept, the
+     * decoder finds the format string by the source line.
+     *
+     * @param line the source line of the message
+     * @param format printf format, %d, %u and %x arguments are recorded
+     */
+    static void info(uint16_t line, const char *format, ...);
+
+    /**
+     * Record a line of text.
+     *
+     * @param event TRACE_TX, TRACE_RX or TRACE_DROP
+     * @param line the source line
+     * @param text the line, truncated to M66_TRACE_LINE_SIZE
+     */
+    static void text(M66TraceEvent event, uint16_t line, const char *text);
+
+    /**
+     * Record payload data.
+     *
+     * @param line the source line
+     * @param data the data, truncated to M66_TRACE_DATA_SIZE
+     * @param size its full size
+     */
+    static void data(uint16_t line, const void *data, size_t size);
+
+    /**
+     * Move the oldest records out of the ring, only whole records are copied.
+     *
+     * @param buffer where to copy the records
+     * @param size size of the buffer
+     * @return the number of bytes copied
+     */
+    static size_t read(void *buffer, size_t size);
+
+    /**
+     * Print the content of the ring as hex lines ("M66T <hex>") and empty it,
+     * the lines can be cut from a console log and fed to the decoder.
+     * Does nothing without M66_DEBUG.
+     */
+    static void dump();
+
+    /**
+     * @return the number of records dropped because the ring was full
+     */
+    static uint32_t dropped();
+
+private:
+    static void record(M66TraceEvent event, uint16_t line, const void *payload, size_t length);
+    static void put(const void *bytes, size_t length);
+    static void drop();
+
+    static uint8_t _ring[M66_TRACE_BUFFER_SIZE];
+    static size_t _head, _tail, _used;
+    static uint32_t _dropped;
+};
+
+#endif
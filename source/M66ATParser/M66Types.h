@@ -38,6 +38,51 @@ enum QISTATUS{
 //                              "PDP DEACT" };
 
 
+/* number of sockets M66Interface offers */
+#define M66_SOCKET_COUNT 5
+
+/* number of connections the modem multiplexes (AT+QIMUX=1), ids 0-5 */
+#define M66_LINK_COUNT 6
+
+/* maximum payload of a single AT+QISEND */
+#define M66_MAX_SEND_BYTES 1400
+
+/* optional parts of the driver, see "time-sync" to "mqtt" in mbed_lib.json */
+#ifndef M66_TIME_SYNC
+#  define M66_TIME_SYNC 1
+#endif
+#ifndef M66_LOCATION
+#  define M66_LOCATION  1
+#endif
+#ifndef M66_BATTERY
+#  define M66_BATTERY   1
+#endif
+#ifndef M66_DEBUG
+#  define M66_DEBUG     1
+#endif
+#ifndef M66_UDP
+#  define M66_UDP       1
+#endif
+#ifndef M66_MQTT
+#  define M66_MQTT      1
+#endif
+
+/* state of a single modem connection, driven by the QIOPEN/QICLOSE URCs */
+enum LINKSTATUS{
+    LINK_CLOSED = 0,  // no connection or closed by either side
+    LINK_CONNECTING,  // AT+QIOPEN accepted, waiting for "n, CONNECT OK"
+    LINK_CONNECTED,   // "n, CONNECT OK" or "n, ALREADY CONNECT" received
+    LINK_FAILED,      // "n, CONNECT FAIL" received
+};
+
+/* outcome of the last AT+QSSLOPEN */
+enum SSLRESULT{
+    SSL_OK = 0,       // "+QSSLOPEN: n,0"
+    SSL_REJECTED,     // AT+QSSLOPEN answered ERROR, e.g. without an active PDP context
+    SSL_TIMEOUT,      // no +QSSLOPEN within the handshake time
+    SSL_HANDSHAKE,    // "+QSSLOPEN: n,<err>", the handshake or the certificate check failed
+};
+
 /*what if +PDP DEACT*/
 
 /**/
@@ -0,0 +1,76 @@
+/*
+ * ubirch#1 M66 Modem FTP download offload.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include "M66Ftp.h"
+
+M66Ftp::M66Ftp(M66Interface *modem) : _modem(modem) {
+}
+
+nsapi_size_or_error_t M66Ftp::download(const char *host, int port, const char *user, const char *password,
+                                       const char *path, const char *file) {
+    M66ScopedLock lock(_modem->_m66);
+
+    if (!_modem->_m66.ftpOpen(host, port, user, password, M66_FTP_TIMEOUT)) {
+        _modem->_m66.ftpClose();
+        return NSAPI_ERROR_AUTH_FAILURE;
+    }
+
+    // start clean, an earlier copy of the file may still be stored
+    _modem->_m66.fileDelete(file);
+
+    const int32_t size = _modem->_m66.ftpGet(path, file, M66_FTP_DOWNLOAD_TIMEOUT);
+    _modem->_m66.ftpClose();
+    if (size < 0) {
+        return NSAPI_ERROR_DEVICE_ERROR;
+    }
+
+    return size;
+}
+
+nsapi_size_or_error_t M66Ftp::retrieve(const char *file, char *chunk, size_t size, M66Sink sink) {
+    M66ScopedLock lock(_modem->_m66);
+
+    const int handle = _modem->_m66.fileOpen(file);
+    if (handle < 0) {
+        return NSAPI_ERROR_PARAMETER;
+    }
+
+    nsapi_size_or_error_t total = 0;
+    for (;;) {
+        const int32_t length = _modem->_m66.fileRead(handle, chunk, (uint32_t) size, M66_FTP_TIMEOUT);
+        if (length < 0) {
+            total = NSAPI_ERROR_DEVICE_ERROR;
+            break;
+        }
+        if (!length) break;
+
+        if (!sink(chunk, (size_t) length)) break;
+        total += length;
+    }
+
+    _modem->_m66.fileClose(handle);
+    return total;
+}
+
+nsapi_error_t M66Ftp::remove(const char *file) {
+    M66ScopedLock lock(_modem->_m66);
+
+    return _modem->_m66.fileDelete(file) ? NSAPI_ERROR_OK : NSAPI_ERROR_DEVICE_ERROR;
+}
@@ -0,0 +1,104 @@
+/*!
+ * @file
+ * @brief Firmware and file downloads handled by the FTP client built into the M66.
+ *
+ * The modem downloads the file into its own storage, the MCU idles until
+ * it is complete and then pulls it in chunks of its own size. The RAM
+ * needed on the MCU does not depend on the size of the file.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#ifndef M66_FTP_H
+#define M66_FTP_H
+
+#include "mbed.h"
+#include "M66Interface.h"
+
+#ifndef M66_FTP_TIMEOUT
+#  define M66_FTP_TIMEOUT          60
+#endif
+#ifndef M66_FTP_DOWNLOAD_TIMEOUT
+#  define M66_FTP_DOWNLOAD_TIMEOUT 600
+#endif
+
+/** FTP client offloaded to the modem.
+ *
+ * Example:
+ * @code
+ *  bool program(const char *data, size_t length) {
+ *      bool ok = flash.program(data, address, length) == 0;
+ *      address += length;
+ *      return ok;
+ *  }
+ *
+ *  M66Ftp ftp(&modem);
+ *  char chunk[512];
+ *  int size = ftp.download("ftp.example.com", 21, "user", "secret", "/firmware/", "image.bin");
+ *  if (size > 0 && ftp.retrieve("image.bin", chunk, sizeof(chunk), program) == size) {
+ *      // image complete
+ *  }
+ *  ftp.remove("image.bin");
+ * @endcode
+ *
+ * The modem is locked while a download runs, sockets wait for it.
+ */
+class M66Ftp {
+public:
+    /**
+     * @param modem the modem, it must be connected
+     */
+    M66Ftp(M66Interface *modem);
+
+    /**
+     * Download a file into the modem storage (UFS), it keeps its name.
+     *
+     * @param host     the server host name or IP address
+     * @param port     the server port, usually 21
+     * @param user     the user name
+     * @param password the password
+     * @param path     the directory on the server, ending with '/'
+     * @param file     the file name
+     * @return the size of the file or a negative error
+     */
+    nsapi_size_or_error_t download(const char *host, int port, const char *user, const char *password,
+                                   const char *path, const char *file);
+
+    /**
+     * Read a file from the modem storage and hand it to sink chunk by chunk.
+     *
+     * @param file  the file name
+     * @param chunk buffer for one chunk
+     * @param size  size of the chunk buffer
+     * @param sink  called for every chunk in order, returns false to stop
+     * @return the number of bytes handed to sink or a negative error
+     */
+    nsapi_size_or_error_t retrieve(const char *file, char *chunk, size_t size, M66Sink sink);
+
+    /**
+     * Delete a file from the modem storage.
+     *
+     * @param file the file name
+     * @return 0 on success or a negative error
+     */
+    nsapi_error_t remove(const char *file);
+
+private:
+    M66Interface *_modem;
+};
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * ubirch#1 M66 Modem HTTP client offload.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include "M66Http.h"
+
+M66Http::M66Http(M66Interface *modem) : _modem(modem) {
+}
+
+nsapi_size_or_error_t M66Http::get(const char *url, char *chunk, size_t size, M66Sink sink) {
+    M66ScopedLock lock(_modem->_m66);
+
+    if (!_modem->_m66.httpUrl(url, M66_HTTP_TIMEOUT)) {
+        return NSAPI_ERROR_PARAMETER;
+    }
+    if (!_modem->_m66.httpGet(M66_HTTP_TIMEOUT)) {
+        return NSAPI_ERROR_CONNECTION_TIMEOUT;
+    }
+
+    return read(chunk, size, sink);
+}
+
+nsapi_size_or_error_t M66Http::post(const char *url, const void *body, size_t length,
+                                    char *chunk, size_t size, M66Sink sink) {
+    M66ScopedLock lock(_modem->_m66);
+
+    if (!_modem->_m66.httpUrl(url, M66_HTTP_TIMEOUT)) {
+        return NSAPI_ERROR_PARAMETER;
+    }
+    if (!_modem->_m66.httpPost(body, (uint32_t) length, M66_HTTP_TIMEOUT)) {
+        return NSAPI_ERROR_CONNECTION_TIMEOUT;
+    }
+
+    return read(chunk, size, sink);
+}
+
+nsapi_size_or_error_t M66Http::read(char *chunk, size_t size, M66Sink sink) {
+    const int32_t length = _modem->_m66.httpRead(chunk, size, sink, M66_HTTP_TIMEOUT);
+    if (length < 0) {
+        return NSAPI_ERROR_DEVICE_ERROR;
+    }
+
+    return length;
+}
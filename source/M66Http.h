@@ -0,0 +1,91 @@
+/*!
+ * @file
+ * @brief HTTP requests handled by the HTTP client built into the M66.
+ *
+ * The modem connects, sends the request and keeps the response, the MCU
+ * only hands over the URL (and body) and reads the response in chunks of
+ * its own size. No HTTP stack and no buffer for the whole response are
+ * needed on the MCU.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#ifndef M66_HTTP_H
+#define M66_HTTP_H
+
+#include "mbed.h"
+#include "M66Interface.h"
+
+#ifndef M66_HTTP_TIMEOUT
+#  define M66_HTTP_TIMEOUT 60
+#endif
+
+/** HTTP client offloaded to the modem.
+ *
+ * Example:
+ * @code
+ *  bool store(const char *data, size_t length) {
+ *      return flash.program(data, address, length) == 0;
+ *  }
+ *
+ *  M66Http http(&modem);
+ *  char chunk[128];
+ *  int size = http.get("http://example.com/config.json", chunk, sizeof(chunk), store);
+ * @endcode
+ *
+ * The body is passed on without the response headers. A body containing
+ * "\r\nOK\r\n" is cut short there, the modem marks the end of the data
+ * that way.
+ */
+class M66Http {
+public:
+    /**
+     * @param modem the modem, it must be connected
+     */
+    M66Http(M66Interface *modem);
+
+    /**
+     * Send a GET request and stream the response body.
+     *
+     * @param url   the complete URL, "http://host[:port]/path"
+     * @param chunk buffer for one chunk of the body, larger than 6 bytes
+     * @param size  size of the chunk buffer
+     * @param sink  called for every chunk, returns false to drop the rest
+     * @return the size of the body or a negative error
+     */
+    nsapi_size_or_error_t get(const char *url, char *chunk, size_t size, M66Sink sink);
+
+    /**
+     * Send a POST request and stream the response body.
+     *
+     * @param url    the complete URL, "http://host[:port]/path"
+     * @param body   the request body
+     * @param length the size of the request body
+     * @param chunk  buffer for one chunk of the response body, larger than 6 bytes
+     * @param size   size of the chunk buffer
+     * @param sink   called for every chunk, returns false to drop the rest
+     * @return the size of the response body or a negative error
+     */
+    nsapi_size_or_error_t post(const char *url, const void *body, size_t length, char *chunk, size_t size, M66Sink sink);
+
+private:
+    M66Interface *_modem;
+
+    nsapi_size_or_error_t read(char *chunk, size_t size, M66Sink sink);
+};
+
+#endif
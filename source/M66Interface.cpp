@@ -25,43 +25,53 @@
 #include <fsl_rtc.h>
 #include "M66Interface.h"
 
-// Various timeouts for different M66 operations
-#define M66_CONNECT_TIMEOUT 15000
-#define M66_SEND_TIMEOUT    15000
+// the AT commands have their own deadlines, see M66ATParser::commandTimeout()
+// time recv waits in the parser for data, the M66_RECV_WAIT option sets it per socket
 #define M66_RECV_TIMEOUT    40000
-#define M66_MISC_TIMEOUT    40000
 
 // M66Interface implementation
 M66Interface::M66Interface(PinName tx, PinName rx, PinName rstPin, PinName pwrPin)
-    : _m66(tx, rx, rstPin, pwrPin), _sockets(), _apn(), _userName(), _passPhrase(), _imei(), _cbs()
+    : _m66(tx, rx, rstPin, pwrPin), _sockets(), _apn(), _userName(), _passPhrase(), _imei(), _cbs(), _dns(),
+      _thread(osPriorityNormal, sizeof(_threadStack), (unsigned char *) _threadStack),
+      _queue(sizeof(_queueBuffer), _queueBuffer), _threadStarted(false),
+      _eventPending(false), _pendingEvents(0), _lruClock(0), _caCert(NULL), _sent(), _received()
 {
+    memset(_linkOwner, -1, sizeof(_linkOwner));
+    memset(_coalesce, 0, sizeof(_coalesce));
     memset(_sockets, 0, sizeof(_sockets));
     memset(_cbs, 0, sizeof(_cbs));
 
     _m66.attach(this, &M66Interface::event);
+    _m66.attachLinkEvent(Callback<void(int)>(this, &M66Interface::link_event));
 }
 
 bool M66Interface::powerUpModem(){
+    M66ScopedLock lock(_m66);
     return _m66.startup();
 }
 
 bool M66Interface::reset() {
+    M66ScopedLock lock(_m66);
     return _m66.reset();
 }
 
 bool M66Interface::powerDown(){
+    M66ScopedLock lock(_m66);
     return _m66.powerDown();
 }
 
 bool M66Interface::isModemAlive() {
+    M66ScopedLock lock(_m66);
     return _m66.isModemAlive();
 }
 
 int M66Interface::checkGPRS() {
+    M66ScopedLock lock(_m66);
     return _m66.checkGPRS();
 }
 
 int M66Interface::set_imei(){
+    M66ScopedLock lock(_m66);
     if(!_m66.getIMEI(_imei)){
         return NSAPI_ERROR_DEVICE_ERROR;
     }
@@ -80,7 +90,7 @@ nsapi_error_t M66Interface::connect(const char *sim_pin, const char *apn, const
 
 int M66Interface::connect()
 {
-    _m66.setTimeout(M66_CONNECT_TIMEOUT);
+    M66ScopedLock lock(_m66);
 
     if (!_m66.startup()) {
         return NSAPI_ERROR_DEVICE_ERROR;
@@ -97,6 +107,18 @@ int M66Interface::connect()
     if(set_imei()){
         return NSAPI_ERROR_DEVICE_ERROR;
     }
+
+    // lookups that failed while we were offline are worth another try now
+    _dnsLock.lock();
+    for (int i = 0; i < M66_DNS_CACHE_SIZE; i++) {
+        if (_dns[i].negative) _dns[i].host[0] = '\0';
+    }
+    _dnsLock.unlock();
+
+    if (strlen(M66_DNS_PREFETCH_HOSTS)) {
+        start_event_thread();
+        _queue.call(this, &M66Interface::dns_prefetch);
+    }
     return NSAPI_ERROR_OK;
 }
 
@@ -114,7 +136,7 @@ void M66Interface::set_credentials(const char *apn, const char *userName, const
 
 int M66Interface::disconnect()
 {
-    _m66.setTimeout(M66_MISC_TIMEOUT);
+    M66ScopedLock lock(_m66);
 
     if (!_m66.disconnect()) {
         return NSAPI_ERROR_DEVICE_ERROR;
@@ -125,35 +147,73 @@ int M66Interface::disconnect()
 
 const char *M66Interface::get_ip_address()
 {
+    M66ScopedLock lock(_m66);
     return _m66.getIPAddress();
 }
 
 bool M66Interface::get_location(char *lon, char *lat) {
+    M66ScopedLock lock(_m66);
     return _m66.getLocation(lon, lat);
 }
 
 bool M66Interface::getDateTime(tm *dateTime, int *zone) {
+    M66ScopedLock lock(_m66);
     return _m66.getDateTime(dateTime, zone);
 }
 
 bool M66Interface::getUnixTime(time_t *t) {
+    M66ScopedLock lock(_m66);
     return _m66.getUnixTime(t);
 }
 
-bool M66Interface::queryIP(const char *url, const char *theIP){
-    return _m66.queryIP(url, theIP);
+bool M66Interface::queryIP(const char *url, char *theIP){
+    return resolve(url, theIP) == NSAPI_ERROR_OK;
 }
 
 bool M66Interface::getModemBattery(uint8_t *status, int *level, int *voltage){
+    M66ScopedLock lock(_m66);
     return _m66.modem_battery(status, level, voltage);
 }
 
-struct m66_socket {
-    int id;
-    nsapi_protocol_t proto;
-    bool connected;
-    SocketAddress addr;
-};
+void M66Interface::set_ca_certificate(const char *pem) {
+    M66ScopedLock lock(_m66);
+    _caCert = pem;
+}
+
+void M66Interface::getStats(M66Stats *stats) {
+    M66ScopedLock lock(_m66);
+    _m66.getStats(stats);
+
+    for (int i = 0; i < M66_SOCKET_COUNT; i++) {
+        stats->sockets[i].sent = _sent[i];
+        stats->sockets[i].received = _received[i];
+    }
+}
+
+bool M66Interface::getLatency(int index, M66LatencyEntry *entry) {
+    M66ScopedLock lock(_m66);
+    return _m66.getLatency(index, entry);
+}
+
+void M66Interface::dumpLatency() {
+    M66ScopedLock lock(_m66);
+    _m66.dumpLatency();
+}
+
+void M66Interface::resetLatency() {
+    M66ScopedLock lock(_m66);
+    _m66.resetLatency();
+}
+
+void M66Interface::startCapture(uint8_t *buffer, size_t size) {
+    M66ScopedLock lock(_m66);
+    _m66.startCapture(buffer, size);
+}
+
+size_t M66Interface::stopCapture() {
+    M66ScopedLock lock(_m66);
+    return _m66.stopCapture();
+}
 
 nsapi_error_t M66Interface::gethostbyname(const char *host, SocketAddress *address, nsapi_version_t version) {
 
@@ -165,21 +225,129 @@ nsapi_error_t M66Interface::gethostbyname(const char *host, SocketAddress *addre
         return NSAPI_ERROR_OK;
     }
 
-    char *ipbuff = new char[NSAPI_IP_SIZE];
-    int ret = 0;
+    // the M66 only resolves IPv4 addresses
+    if (version == NSAPI_IPv6) {
+        return NSAPI_ERROR_DNS_FAILURE;
+    }
 
-    if(!_m66.queryIP(host, ipbuff)) {
-        ret = NSAPI_ERROR_DEVICE_ERROR;
-    } else {
-        address->set_ip_address(ipbuff);
+    char ip[NSAPI_IPv4_SIZE];
+    nsapi_error_t ret = resolve(host, ip);
+    if (ret == NSAPI_ERROR_OK) {
+        address->set_ip_address(ip);
     }
 
-    delete[] ipbuff;
     return ret;
 }
 
+struct M66Interface::dns_entry *M66Interface::dns_lookup(const char *host) {
+    for (int i = 0; i < M66_DNS_CACHE_SIZE; i++) {
+        if (_dns[i].host[0] && !strncmp(_dns[i].host, host, sizeof(_dns[i].host))) {
+            return &_dns[i];
+        }
+    }
+    return NULL;
+}
+
+nsapi_error_t M66Interface::resolve(const char *host, char *ip) {
+    // a hit only takes the cache lock, the parser may be busy with a long command
+    _dnsLock.lock();
+    struct dns_entry *entry = dns_lookup(host);
+    if (entry && !entry->expires.expired()) {
+        const bool negative = entry->negative;
+        if (!negative) strcpy(ip, entry->ip);
+        _dnsLock.unlock();
+        return negative ? NSAPI_ERROR_DNS_FAILURE : NSAPI_ERROR_OK;
+    }
+    _dnsLock.unlock();
+
+    bool found;
+    {
+        M66ScopedLock lock(_m66);
+        found = _m66.queryIP(host, ip);
+    }
+
+    // names that do not fit are simply not cached
+    if (strlen(host) < sizeof(_dns[0].host)) {
+        _dnsLock.lock();
+        // the slot may have changed while the modem was asked
+        entry = dns_lookup(host);
+        if (!entry) {
+            // take a free or expired slot, or else the one expiring first
+            entry = &_dns[0];
+            for (int i = 0; i < M66_DNS_CACHE_SIZE; i++) {
+                if (!_dns[i].host[0] || _dns[i].expires.expired()) {
+                    entry = &_dns[i];
+                    break;
+                }
+                if (_dns[i].expires.remaining() < entry->expires.remaining()) entry = &_dns[i];
+            }
+        }
+
+        strcpy(entry->host, host);
+        entry->negative = !found;
+        if (found) strcpy(entry->ip, ip);
+        entry->expires = M66Deadline(found ? M66_DNS_TTL_MS : M66_DNS_NEGATIVE_TTL_MS);
+        _dnsLock.unlock();
+    }
+
+    return found ? NSAPI_ERROR_OK : NSAPI_ERROR_DNS_FAILURE;
+}
+
+bool M66Interface::resolved_host(const char *ip, char *host) {
+    // the most recent name resolved to the address, TCPSocket::connect(host) comes through resolve()
+    _dnsLock.lock();
+    const struct dns_entry *entry = NULL;
+    for (int i = 0; i < M66_DNS_CACHE_SIZE; i++) {
+        if (_dns[i].host[0] && !_dns[i].negative && !strcmp(_dns[i].ip, ip)
+            && (!entry || _dns[i].expires.remaining() > entry->expires.remaining())) {
+            entry = &_dns[i];
+        }
+    }
+
+    if (entry) strcpy(host, entry->host);
+    _dnsLock.unlock();
+    return entry != NULL;
+}
+
+void M66Interface::dns_prefetch() {
+    const char *hosts = M66_DNS_PREFETCH_HOSTS;
+    char host[M66_DNS_HOST_SIZE];
+    char ip[NSAPI_IPv4_SIZE];
+
+    while (*hosts) {
+        size_t len = strcspn(hosts, ",");
+        if (len && len < sizeof(host)) {
+            memcpy(host, hosts, len);
+            host[len] = '\0';
+
+            // on the event thread, do not wait for a socket call talking to the modem;
+            // come back later, the names resolved so far are then cache hits
+            if (!_m66.trylock()) {
+                _queue.call_in(M66_EVENT_RETRY_MS, this, &M66Interface::dns_prefetch);
+                return;
+            }
+            resolve(host, ip);
+            _m66.unlock();
+        }
+        hosts += len;
+        if (*hosts == ',') hosts++;
+    }
+}
+
+void M66Interface::start_event_thread() {
+    if (!_threadStarted) {
+        _thread.start(callback(&_queue, &EventQueue::dispatch_forever));
+        _threadStarted = true;
+    }
+}
+
 int M66Interface::socket_open(void **handle, nsapi_protocol_t proto)
 {
+    M66ScopedLock lock(_m66);
+    if (proto == NSAPI_UDP && !M66_UDP) {
+        return NSAPI_ERROR_UNSUPPORTED;
+    }
+
     // Look for an unused socket
     int id = -1;
 
@@ -195,30 +363,42 @@ int M66Interface::socket_open(void **handle, nsapi_protocol_t proto)
         return NSAPI_ERROR_NO_SOCKET;
     }
 
-    struct m66_socket *socket = new struct m66_socket;
-    if (!socket) {
-        return NSAPI_ERROR_NO_SOCKET;
-    }
+    // socket events are dispatched from the event thread
+    start_event_thread();
 
+    struct m66_socket *socket = &_socketSlots[id];
     socket->id = id;
     socket->proto = proto;
     socket->connected = false;
+    socket->tls = false;
+    socket->host[0] = '\0';
+    socket->recvTimeout = M66_RECV_TIMEOUT;
+    for (int i = 0; i < M66_UDP_PEER_COUNT; i++) {
+        socket->peers[i].link = -1;
+        socket->peers[i].used = 0;
+    }
     *handle = socket;
     return 0;
 }
 
 int M66Interface::socket_close(void *handle)
 {
+    M66ScopedLock lock(_m66);
     struct m66_socket *socket = (struct m66_socket *)handle;
     int err = 0;
-    _m66.setTimeout(M66_MISC_TIMEOUT);
 
-    if (!_m66.close(socket->id)) {
-        err = NSAPI_ERROR_DEVICE_ERROR;
+    if (_coalesce[socket->id].buffer) {
+        coalesce_flush(socket->id);
+        memset(&_coalesce[socket->id], 0, sizeof(_coalesce[socket->id]));
+    }
+
+    for (int i = 0; i < M66_UDP_PEER_COUNT; i++) {
+        if (socket->peers[i].link >= 0 && !free_link(socket->peers[i].link)) {
+            err = NSAPI_ERROR_DEVICE_ERROR;
+        }
     }
 
     _sockets[socket->id] = false;
-    delete socket;
     return err;
 }
 
@@ -234,11 +414,100 @@ int M66Interface::socket_listen(void *handle, int backlog)
 
 int M66Interface::socket_connect(void *handle, const SocketAddress &addr)
 {
+    M66ScopedLock lock(_m66);
     struct m66_socket *socket = (struct m66_socket *)handle;
-    _m66.setTimeout(M66_MISC_TIMEOUT);
 
-    const char *proto = (socket->proto == NSAPI_UDP) ? "UDP" : "TCP";
-    if (!_m66.open(proto, socket->id, addr.get_ip_address(), addr.get_port())) {
+    // a connected UDP socket only selects the default peer
+    if (M66_UDP && socket->proto == NSAPI_UDP) {
+        int link = udp_link(socket, addr);
+        if (link < 0) {
+            return link;
+        }
+        socket->addr = addr;
+        socket->connected = true;
+        return 0;
+    }
+
+    int link = socket->peers[0].link;
+    if (link >= 0) {
+        // pick up a "n, CONNECT OK" or "n, CONNECT FAIL" that arrived since the last call
+        _m66.process();
+
+        switch (_m66.linkStatus(link)) {
+            case LINK_CONNECTING:
+                // the modem may never report, give up after the time of a blocking open
+                if (!socket->opening.expired()) {
+                    return NSAPI_ERROR_ALREADY;
+                }
+                free_link(link);
+                socket->peers[0].link = -1;
+                return NSAPI_ERROR_CONNECTION_TIMEOUT;
+            case LINK_CONNECTED:
+                socket->connected = true;
+                return NSAPI_ERROR_IS_CONNECTED;
+            case LINK_FAILED:
+                free_link(link);
+                socket->peers[0].link = -1;
+                return NSAPI_ERROR_NO_CONNECTION;
+            default:
+                free_link(link);
+                socket->peers[0].link = -1;
+                break;
+        }
+    }
+
+    link = alloc_link(socket);
+    if (link < 0) {
+        return NSAPI_ERROR_NO_SOCKET;
+    }
+    socket->peers[0].link = link;
+    socket->addr = addr;
+
+    // the handshake is done by the modem, send and recv see plain data
+    if (socket->tls) {
+        if (!_m66.sslSetup(_caCert)) {
+            free_link(link);
+            socket->peers[0].link = -1;
+            return NSAPI_ERROR_DEVICE_ERROR;
+        }
+
+        // the name goes to the modem for SNI and the certificate check
+        char host[M66_DNS_HOST_SIZE];
+        if (socket->host[0]) {
+            strcpy(host, socket->host);
+        } else if (!resolved_host(addr.get_ip_address(), host)) {
+            strcpy(host, addr.get_ip_address());
+        }
+
+        if (!_m66.sslOpen(link, host, addr.get_port(), M66_TLS_TIMEOUT)) {
+            free_link(link);
+            socket->peers[0].link = -1;
+            switch (_m66.sslResult()) {
+                case SSL_HANDSHAKE:
+                    return NSAPI_ERROR_AUTH_FAILURE;
+                case SSL_TIMEOUT:
+                    return NSAPI_ERROR_CONNECTION_TIMEOUT;
+                default:
+                    return _m66.isConnected() ? NSAPI_ERROR_DEVICE_ERROR : NSAPI_ERROR_NO_CONNECTION;
+            }
+        }
+        socket->connected = true;
+        return 0;
+    }
+
+    if (M66_NONBLOCKING_CONNECT) {
+        if (!_m66.startOpen("TCP", link, addr.get_ip_address(), addr.get_port())) {
+            free_link(link);
+            socket->peers[0].link = -1;
+            return NSAPI_ERROR_DEVICE_ERROR;
+        }
+        socket->opening = M66Deadline(M66ATParser::commandTimeout("AT+QIOPEN"));
+        return NSAPI_ERROR_IN_PROGRESS;
+    }
+
+    if (!_m66.open("TCP", link, addr.get_ip_address(), addr.get_port())) {
+        free_link(link);
+        socket->peers[0].link = -1;
         return NSAPI_ERROR_DEVICE_ERROR;
     }
 
@@ -253,61 +522,379 @@ int M66Interface::socket_accept(void *server, void **socket, SocketAddress *addr
 
 int M66Interface::socket_send(void *handle, const void *data, unsigned size)
 {
+    M66ScopedLock lock(_m66);
     struct m66_socket *socket = (struct m66_socket *)handle;
-    _m66.setTimeout(M66_SEND_TIMEOUT);
 
-    if (!_m66.send(socket->id, data, size)) {
+    if (M66_UDP && socket->proto == NSAPI_UDP) {
+        if (!socket->connected) {
+            return NSAPI_ERROR_NO_ADDRESS;
+        }
+        return socket_sendto(socket, socket->addr, data, size);
+    }
+
+    if (socket->peers[0].link < 0) {
+        return NSAPI_ERROR_NO_CONNECTION;
+    }
+
+    // a non-blocking connect may still be in progress, pick up its result
+    if (_m66.linkStatus(socket->peers[0].link) == LINK_CONNECTING) {
+        _m66.process();
+    }
+    if (_m66.linkStatus(socket->peers[0].link) != LINK_CONNECTED) {
+        return NSAPI_ERROR_NO_CONNECTION;
+    }
+
+    if (_coalesce[socket->id].buffer) {
+        if (_coalesce[socket->id].error) {
+            const nsapi_error_t err = _coalesce[socket->id].error;
+            _coalesce[socket->id].error = 0;
+            return err;
+        }
+
+        // make room, what does not fit into an empty buffer is sent right away
+        if (_coalesce[socket->id].length + size > M66_COALESCE_BUFFER_SIZE) {
+            const nsapi_error_t err = coalesce_flush(socket->id);
+            if (err) return err;
+        }
+        if (size < M66_COALESCE_BUFFER_SIZE) {
+            memcpy(_coalesce[socket->id].buffer + _coalesce[socket->id].length, data, size);
+            _coalesce[socket->id].length += size;
+            _coalesce[socket->id].link = socket->peers[0].link;
+
+            if (_coalesce[socket->id].length == M66_COALESCE_BUFFER_SIZE) {
+                const nsapi_error_t err = coalesce_flush(socket->id);
+                if (err) return err;
+            } else if (!_coalesce[socket->id].event) {
+                _coalesce[socket->id].event = _queue.call_in(M66_COALESCE_DELAY_MS, this,
+                                                             &M66Interface::coalesce_timeout, socket->id);
+            }
+            M66_STAT(_sent[socket->id] += size);
+            return size;
+        }
+    }
+
+    if (!_m66.send(socket->peers[0].link, data, size)) {
         return NSAPI_ERROR_DEVICE_ERROR;
     }
 
+    M66_STAT(_sent[socket->id] += size);
     return size;
 }
 
 int M66Interface::socket_recv(void *handle, void *data, unsigned size)
 {
+    M66ScopedLock lock(_m66);
     struct m66_socket *socket = (struct m66_socket *)handle;
-    _m66.setTimeout(M66_RECV_TIMEOUT);
 
-    int32_t recv = _m66.recv(socket->id, data, size);
+    if (M66_UDP && socket->proto == NSAPI_UDP) {
+        return socket_recvfrom(socket, NULL, data, size);
+    }
+
+    if (socket->peers[0].link < 0) {
+        return NSAPI_ERROR_NO_CONNECTION;
+    }
+
+    // whoever waits for an answer has finished the request
+    if (_coalesce[socket->id].length) {
+        const nsapi_error_t err = coalesce_flush(socket->id);
+        if (err) return err;
+    }
+
+    _m66.setTimeout(socket->recvTimeout);
+    int32_t recv = _m66.recv(socket->peers[0].link, data, size);
+    // the data before a gap is delivered, then the stream ends with an error
+    if (recv <= 0 && _m66.dataLost(socket->peers[0].link)) {
+        return NSAPI_ERROR_CONNECTION_LOST;
+    }
     if (recv < 0) {
         return NSAPI_ERROR_WOULD_BLOCK;
     }
 
+    M66_STAT(_received[socket->id] += recv);
     return recv;
 }
 
 int M66Interface::socket_sendto(void *handle, const SocketAddress &addr, const void *data, unsigned size)
 {
+    M66ScopedLock lock(_m66);
     struct m66_socket *socket = (struct m66_socket *)handle;
 
-    if (socket->connected && socket->addr != addr) {
-        _m66.setTimeout(M66_MISC_TIMEOUT);
-        if (!_m66.close(socket->id)) {
+    if (socket->proto == NSAPI_TCP) {
+        return socket_send(socket, data, size);
+    }
+    if (!M66_UDP) {
+        return NSAPI_ERROR_UNSUPPORTED;
+    }
+
+    if (M66_UDP_FAST_SEND && size > M66_MAX_SEND_BYTES) {
+        return NSAPI_ERROR_PARAMETER;
+    }
+
+    // every peer keeps its own modem connection, switching between them costs nothing
+    int link = udp_link(socket, addr);
+    if (link < 0) {
+        return link;
+    }
+
+    if (M66_UDP_FAST_SEND) {
+        // report a SEND FAIL of an earlier datagram, the sender did not wait for it
+        if (_m66.sendFailed(link) || !_m66.sendDatagram(link, data, size)) {
             return NSAPI_ERROR_DEVICE_ERROR;
         }
-        socket->connected = false;
+    } else if (!_m66.send(link, data, size)) {
+        return NSAPI_ERROR_DEVICE_ERROR;
     }
 
-    if (!socket->connected) {
-        int err = socket_connect(socket, addr);
-        if (err < 0) {
-            return err;
+    M66_STAT(_sent[socket->id] += size);
+    return size;
+}
+
+int M66Interface::socket_recvfrom(void *handle, SocketAddress *addr, void *data, unsigned size)
+{
+    M66ScopedLock lock(_m66);
+    struct m66_socket *socket = (struct m66_socket *)handle;
+
+    if (!M66_UDP) {
+        return NSAPI_ERROR_UNSUPPORTED;
+    }
+
+    uint32_t links = 0;
+    for (int i = 0; i < M66_UDP_PEER_COUNT; i++) {
+        if (socket->peers[i].link >= 0) links |= 1u << socket->peers[i].link;
+    }
+    // nothing sent yet or every peer evicted, no data can arrive, waiting would never end
+    if (!links) {
+        return NSAPI_ERROR_NO_SOCKET;
+    }
+
+    int link = -1, port = 0;
+    char ip[NSAPI_IPv4_SIZE];
+    _m66.setTimeout(socket->recvTimeout);
+    int32_t recv = _m66.recvfrom(links, &link, data, size, ip, &port, true);
+    if (recv < 0) {
+        return NSAPI_ERROR_WOULD_BLOCK;
+    }
+    // every link closed, e.g. with the PDP context, waiting would never end;
+    // 0 bytes from a link are an empty datagram
+    if (link < 0) {
+        return NSAPI_ERROR_NO_CONNECTION;
+    }
+
+    if (addr) {
+        for (int i = 0; i < M66_UDP_PEER_COUNT; i++) {
+            if (socket->peers[i].link == link) *addr = socket->peers[i].addr;
+        }
+        // the sender reported by the modem (AT+QISHOWRA) wins over the connected peer
+        if (ip[0]) {
+            addr->set_ip_address(ip);
+            addr->set_port((uint16_t) port);
         }
-        socket->addr = addr;
     }
 
-    return socket_send(socket, data, size);
+    M66_STAT(_received[socket->id] += recv);
+    return recv;
 }
 
-int M66Interface::socket_recvfrom(void *handle, SocketAddress *addr, void *data, unsigned size)
+int M66Interface::alloc_link(struct m66_socket *socket)
+{
+    for (int i = 0; i < M66_LINK_COUNT; i++) {
+        if (_linkOwner[i] < 0) {
+            _linkOwner[i] = (int8_t) socket->id;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+bool M66Interface::free_link(int link)
+{
+    bool ok = true;
+
+    if (_m66.linkStatus(link) == LINK_CONNECTED || _m66.linkStatus(link) == LINK_CONNECTING) {
+        ok = _m66.close(link);
+    }
+
+    _m66.clearLinkStatus(link);
+    // the next owner of the id must not get the data of this one
+    _m66.discard(link);
+    _linkOwner[link] = -1;
+    return ok;
+}
+
+int M66Interface::udp_link(struct m66_socket *socket, const SocketAddress &addr)
+{
+    int slot = -1;
+
+    for (int i = 0; i < M66_UDP_PEER_COUNT; i++) {
+        if (socket->peers[i].link >= 0 && socket->peers[i].addr == addr) {
+            if (_m66.linkStatus(socket->peers[i].link) == LINK_CONNECTED) {
+                socket->peers[i].used = ++_lruClock;
+                return socket->peers[i].link;
+            }
+            // known peer, but the connection is gone
+            slot = i;
+            break;
+        }
+    }
+
+    // a free slot, or else the least recently used peer gives up its connection
+    for (int i = 0; slot < 0 && i < M66_UDP_PEER_COUNT; i++) {
+        if (socket->peers[i].link < 0) slot = i;
+    }
+    if (slot < 0) {
+        slot = 0;
+        for (int i = 1; i < M66_UDP_PEER_COUNT; i++) {
+            if (socket->peers[i].used < socket->peers[slot].used) slot = i;
+        }
+    }
+
+    if (socket->peers[slot].link >= 0) {
+        free_link(socket->peers[slot].link);
+        socket->peers[slot].link = -1;
+    }
+
+    const int link = alloc_link(socket);
+    if (link < 0) {
+        return NSAPI_ERROR_NO_SOCKET;
+    }
+
+    if (!_m66.open("UDP", link, addr.get_ip_address(), addr.get_port())) {
+        free_link(link);
+        return NSAPI_ERROR_DEVICE_ERROR;
+    }
+
+    socket->peers[slot].link = link;
+    socket->peers[slot].addr = addr;
+    socket->peers[slot].used = ++_lruClock;
+    return link;
+}
+
+nsapi_error_t M66Interface::setsockopt(void *handle, int level, int optname, const void *optval, unsigned optlen)
 {
     struct m66_socket *socket = (struct m66_socket *)handle;
-    int ret = socket_recv(socket, data, size);
-    if (ret >= 0 && addr) {
-        *addr = socket->addr;
+
+    if (level != M66_SOCKET_LEVEL) {
+        return NSAPI_ERROR_UNSUPPORTED;
     }
 
-    return ret;
+    M66ScopedLock lock(_m66);
+    switch (optname) {
+        case M66_COALESCE: {
+            if (!optval || optlen != sizeof(int)) {
+                return NSAPI_ERROR_PARAMETER;
+            }
+            if (socket->proto != NSAPI_TCP) {
+                return NSAPI_ERROR_UNSUPPORTED;
+            }
+
+            if (*(const int *) optval) {
+                if (!_coalesce[socket->id].buffer) {
+                    _coalesce[socket->id].buffer = coalesce_buffer();
+                    if (!_coalesce[socket->id].buffer) {
+                        return NSAPI_ERROR_NO_MEMORY;
+                    }
+                }
+            } else if (_coalesce[socket->id].buffer) {
+                const nsapi_error_t err = coalesce_flush(socket->id);
+                memset(&_coalesce[socket->id], 0, sizeof(_coalesce[socket->id]));
+                return err;
+            }
+            return NSAPI_ERROR_OK;
+        }
+        case M66_FLUSH:
+            return coalesce_flush(socket->id);
+        case M66_TLS:
+            if (!optval || optlen != sizeof(int)) {
+                return NSAPI_ERROR_PARAMETER;
+            }
+            if (socket->proto != NSAPI_TCP) {
+                return NSAPI_ERROR_UNSUPPORTED;
+            }
+            if (socket->peers[0].link >= 0) {
+                return NSAPI_ERROR_IS_CONNECTED;
+            }
+            socket->tls = *(const int *) optval != 0;
+            return NSAPI_ERROR_OK;
+        case M66_TLS_HOSTNAME: {
+            // with or without the terminator
+            const size_t length = optval ? strnlen((const char *) optval, optlen) : 0;
+            if (!length || length >= sizeof(socket->host)) {
+                return NSAPI_ERROR_PARAMETER;
+            }
+            if (socket->peers[0].link >= 0) {
+                return NSAPI_ERROR_IS_CONNECTED;
+            }
+            memcpy(socket->host, optval, length);
+            socket->host[length] = '\0';
+            return NSAPI_ERROR_OK;
+        }
+        case M66_RECV_WAIT:
+            if (!optval || optlen != sizeof(int) || *(const int *) optval < 0) {
+                return NSAPI_ERROR_PARAMETER;
+            }
+            socket->recvTimeout = (uint32_t) *(const int *) optval;
+            return NSAPI_ERROR_OK;
+        default:
+            return NSAPI_ERROR_UNSUPPORTED;
+    }
+}
+
+char *M66Interface::coalesce_buffer()
+{
+    for (int i = 0; i < M66_COALESCE_BUFFER_COUNT; i++) {
+        bool used = false;
+        for (int id = 0; id < M66_SOCKET_COUNT; id++) {
+            if (_coalesce[id].buffer == _coalescePool[i]) used = true;
+        }
+        if (!used) return _coalescePool[i];
+    }
+    return NULL;
+}
+
+nsapi_error_t M66Interface::coalesce_flush(int id)
+{
+    M66ScopedLock lock(_m66);
+
+    if (_coalesce[id].event) {
+        _queue.cancel(_coalesce[id].event);
+        _coalesce[id].event = 0;
+    }
+    if (!_coalesce[id].length) {
+        return NSAPI_ERROR_OK;
+    }
+
+    const unsigned length = _coalesce[id].length;
+    _coalesce[id].length = 0;
+
+    if (!_m66.send(_coalesce[id].link, _coalesce[id].buffer, length)) {
+        return NSAPI_ERROR_DEVICE_ERROR;
+    }
+
+    return NSAPI_ERROR_OK;
+}
+
+void M66Interface::coalesce_timeout(int id)
+{
+    // like process_events(), the event thread does not wait for a socket call
+    // talking to the modem, the other sockets' events would wait with it
+    if (!_m66.trylock()) {
+        _coalesce[id].event = _queue.call_in(M66_EVENT_RETRY_MS, this, &M66Interface::coalesce_timeout, id);
+        return;
+    }
+
+    // the socket may have been closed or flushed in the meantime
+    _coalesce[id].event = 0;
+    if (_coalesce[id].buffer) {
+        const nsapi_error_t err = coalesce_flush(id);
+        if (err) {
+            // nobody waits for this send, fail the next one
+            _coalesce[id].error = err;
+            link_event(_coalesce[id].link);
+        }
+    }
+
+    _m66.unlock();
 }
 
 void M66Interface::socket_attach(void *handle, void (*callback)(void *), void *data)
@@ -318,8 +905,56 @@ void M66Interface::socket_attach(void *handle, void (*callback)(void *), void *d
 }
 
 void M66Interface::event() {
+    // called from the RX interrupt for every byte, defer the work and do it once per burst
+    post_events(0);
+}
+
+void M66Interface::link_event(int link) {
+    if (link < 0 || link >= M66_LINK_COUNT || _linkOwner[link] < 0) return;
+
+    core_util_critical_section_enter();
+    _pendingEvents |= 1u << _linkOwner[link];
+    core_util_critical_section_exit();
+
+    post_events(0);
+}
+
+void M66Interface::post_events(int delay) {
+    bool post = false;
+
+    core_util_critical_section_enter();
+    if (!_eventPending) {
+        _eventPending = true;
+        post = true;
+    }
+    core_util_critical_section_exit();
+
+    if (post) {
+        if (delay) _queue.call_in(delay, this, &M66Interface::process_events);
+        else _queue.call(this, &M66Interface::process_events);
+    }
+}
+
+void M66Interface::process_events() {
+    // bytes arriving from now on need another run
+    _eventPending = false;
+
+    // unsolicited lines are handled here unless another thread is talking to the modem,
+    // which then handles them itself; look again later in case it is not reading
+    if (_m66.trylock()) {
+        _m66.process();
+        _m66.unlock();
+    } else if (_m66.readable()) {
+        post_events(M66_EVENT_RETRY_MS);
+    }
+
+    core_util_critical_section_enter();
+    const uint32_t pending = _pendingEvents;
+    _pendingEvents = 0;
+    core_util_critical_section_exit();
+
     for (int i = 0; i < M66_SOCKET_COUNT; i++) {
-        if (_cbs[i].callback) {
+        if ((pending & (1u << i)) && _cbs[i].callback) {
             _cbs[i].callback(_cbs[i].data);
         }
     }
@@ -330,6 +965,7 @@ void M66Interface::set_sim_pin(const char *sim_pin) {
 }
 
 bool M66Interface::is_connected() {
+    M66ScopedLock lock(_m66);
     return _m66.isConnected();
 }
 
@@ -342,7 +978,9 @@ const char *M66Interface::get_gateway() {
 }
 
 const char *M66Interface::get_iccid() {
-    if (!(_m66.tx("AT+QCCID") && _m66.scan("%22s", _iccid))) {
+    M66ScopedLock lock(_m66);
+    M66Field iccid[] = {_iccid};
+    if (!_m66.command(CMD_ICCID, iccid, 1)) {
         return NULL;
     }
     return _iccid;
@@ -32,7 +32,68 @@
 #include "fsl_rtc.h"
 #include "M66ATParser.h"
 
-#define M66_SOCKET_COUNT 5
+#ifndef M66_UDP_PEER_COUNT
+#  define M66_UDP_PEER_COUNT 2
+#endif
+#ifndef M66_UDP_FAST_SEND
+#  define M66_UDP_FAST_SEND  1
+#endif
+
+#ifndef M66_COALESCE_BUFFER_SIZE
+#  define M66_COALESCE_BUFFER_SIZE M66_MAX_SEND_BYTES
+#endif
+#ifndef M66_COALESCE_BUFFER_COUNT
+#  define M66_COALESCE_BUFFER_COUNT 1
+#endif
+#ifndef M66_COALESCE_DELAY_MS
+#  define M66_COALESCE_DELAY_MS   20
+#endif
+
+/** Socket option level for the M66 specific options */
+#define M66_SOCKET_LEVEL 0x4D36
+
+/** M66 specific socket options, set with Socket::setsockopt(M66_SOCKET_LEVEL, ...) */
+enum m66_socket_option {
+    M66_COALESCE = 1, /*!< int, 1 collects small sends of a TCP socket into one AT+QISEND */
+    M66_FLUSH,        /*!< no value, send what has been collected right now */
+    M66_TLS,          /*!< int, 1 lets the modem terminate TLS for a TCP socket, set before connect */
+    M66_RECV_WAIT,    /*!< int, time in ms recv waits in the driver for data (40 s), 0 leaves the waiting to the socket timeout */
+    M66_TLS_HOSTNAME, /*!< char[], server name sent for SNI and checked against the certificate, set before connect */
+};
+
+#ifndef M66_TLS_TIMEOUT
+#  define M66_TLS_TIMEOUT 90
+#endif
+
+#ifndef M66_NONBLOCKING_CONNECT
+#  define M66_NONBLOCKING_CONNECT 1
+#endif
+
+#ifndef M66_EVENT_THREAD_STACK_SIZE
+#  define M66_EVENT_THREAD_STACK_SIZE 3072
+#endif
+#ifndef M66_EVENT_QUEUE_SIZE
+#  define M66_EVENT_QUEUE_SIZE (16 * EVENTS_EVENT_SIZE)
+#endif
+#ifndef M66_EVENT_RETRY_MS
+#  define M66_EVENT_RETRY_MS      10
+#endif
+
+#ifndef M66_DNS_CACHE_SIZE
+#  define M66_DNS_CACHE_SIZE      4
+#endif
+#ifndef M66_DNS_HOST_SIZE
+#  define M66_DNS_HOST_SIZE       64
+#endif
+#ifndef M66_DNS_TTL_MS
+#  define M66_DNS_TTL_MS          3600000
+#endif
+#ifndef M66_DNS_NEGATIVE_TTL_MS
+#  define M66_DNS_NEGATIVE_TTL_MS 30000
+#endif
+#ifndef M66_DNS_PREFETCH_HOSTS
+#  define M66_DNS_PREFETCH_HOSTS  ""
+#endif
 
 /** M66Interface class
  *  Implementation of the NetworkStack for the M66 GSM Modem
@@ -138,15 +199,23 @@ public:
      * @param lat latitude
      * @param lon longitude
      * @param datetime struct contains date and time
-     * @return null-teriminated IP address or null if no IP address is assigned
+     * @return null-teriminated IP address or null if no IP address is assigned, false without M66_LOCATION
      */
     bool get_location(char *lon, char *lat);
 
+    // the network time, both return false without M66_TIME_SYNC
     bool getDateTime(tm * dateTime, int * zone);
 
     bool getUnixTime(time_t *t);
 
-    bool queryIP(const char *url, const char *theIP);
+    /**
+     * Resolve a host name, answered from the DNS cache if possible
+     *
+     * @param url the host name
+     * @param theIP buffer for the IP address, at least NSAPI_IPv4_SIZE bytes
+     * @return true if the host name was resolved
+     */
+    bool queryIP(const char *url, char *theIP);
 
     /**
      * Get the Battery status, level and voltage of the device
@@ -154,10 +223,61 @@ public:
      * @param status battery status
      * @param level battery level
      * @param voltage battery voltage
-     * @return return false if
+     * @return return false if the modem did not answer or without M66_BATTERY
      */
     bool getModemBattery(uint8_t *status, int *level, int *voltage);
 
+    /**
+     * Set the CA certificate for TCP sockets with the M66_TLS option. It is
+     * loaded into the modem with the first TLS connect and stays there until
+     * the modem is reset. Without one, the server is not verified.
+     *
+     * @param pem the certificate in PEM format, must stay valid
+     */
+    void set_ca_certificate(const char *pem);
+
+    /**
+     * Take a snapshot of the driver counters, see M66Stats
+     *
+     * @param stats where to put the snapshot
+     */
+    void getStats(M66Stats *stats);
+
+    /**
+     * Copy the latency histogram of an AT command verb, see M66Latency
+     *
+     * @param index index of the verb, from 0
+     * @param entry where to put the histogram
+     * @return false if there is no verb with this index
+     */
+    bool getLatency(int index, M66LatencyEntry *entry);
+
+    /**
+     * Print the latency histograms of all AT command verbs, needs M66_DEBUG
+     */
+    void dumpLatency();
+
+    /**
+     * Forget the latency histograms, e.g. after tuning the timeouts
+     */
+    void resetLatency();
+
+    /**
+     * Record the UART traffic with the modem, e.g. to turn a field problem
+     * into a test case, see M66Replay and tools/m66capture.py
+     *
+     * @param buffer where to record, it must stay valid until stopCapture()
+     * @param size size of the buffer, recording stops when it is full
+     */
+    void startCapture(uint8_t *buffer, size_t size);
+
+    /**
+     * Stop recording the UART traffic
+     *
+     * @return the size of the capture
+     */
+    size_t stopCapture();
+
     virtual void set_sim_pin(const char *sim_pin);
 
     virtual bool is_connected();
@@ -171,8 +291,10 @@ public:
      *  The hostname may be either a domain name or an IP address. If the
      *  hostname is an IP address, no network transactions will be performed.
      *
-     *  If no stack-specific DNS resolution is provided, the hostname
-     *  will be resolve using a UDP socket on the stack.
+     *  Results are kept in a small cache for M66_DNS_TTL_MS, failed lookups
+     *  for M66_DNS_NEGATIVE_TTL_MS. A cached name does not wait for a command
+     *  the modem is busy with. The hosts in M66_DNS_PREFETCH_HOSTS are
+     *  resolved in the background after every connect.
      *
      *  @param address  Destination for the host SocketAddress
      *  @param host     Hostname to resolve
@@ -192,7 +314,7 @@ public:
 protected:
     /** Open a socket
      *  @param handle       Handle in which to store new socket
-     *  @param proto        Type of socket to open, NSAPI_TCP or NSAPI_UDP
+     *  @param proto        Type of socket to open, NSAPI_TCP or NSAPI_UDP (needs M66_UDP)
      *  @return             0 on success, negative on failure
      */
     virtual int socket_open(void **handle, nsapi_protocol_t proto);
@@ -221,6 +343,19 @@ protected:
     virtual int socket_listen(void *handle, int backlog);
 
     /** Connects this TCP socket to the server
+     *
+     *  With M66_NONBLOCKING_CONNECT a TCP connect returns NSAPI_ERROR_IN_PROGRESS
+     *  as soon as the modem accepted AT+QIOPEN. Further calls return
+     *  NSAPI_ERROR_ALREADY until "n, CONNECT OK" arrived, then NSAPI_ERROR_IS_CONNECTED.
+     *  The socket callback is called when the result arrives.
+     *
+     *  A TLS connect sends the M66_TLS_HOSTNAME of the socket to the modem,
+     *  without one the name the address was last resolved from, so that SNI
+     *  works for a connect by name. A failed handshake or certificate check
+     *  returns NSAPI_ERROR_AUTH_FAILURE, no answer in M66_TLS_TIMEOUT seconds
+     *  NSAPI_ERROR_CONNECTION_TIMEOUT and a modem without a PDP context
+     *  NSAPI_ERROR_NO_CONNECTION.
+     *
      *  @param handle       Socket handle
      *  @param address      SocketAddress to connect to
      *  @return             0 on success, negative on failure
@@ -257,6 +392,14 @@ protected:
     virtual int socket_recv(void *handle, void *data, unsigned size);
 
     /** Send a packet to a remote endpoint
+     *
+     *  A UDP socket keeps a modem connection open for each of its last
+     *  M66_UDP_PEER_COUNT peers, alternating between them needs no reconnect.
+     *
+     *  With M66_UDP_FAST_SEND every call is sent as exactly one datagram of at
+     *  most M66_MAX_SEND_BYTES and returns without waiting for SEND OK. The socket
+     *  callback is called when the result arrives, a SEND FAIL fails the next call.
+     *
      *  @param handle       Socket handle
      *  @param address      The remote SocketAddress
      *  @param data         The packet to be sent
@@ -268,6 +411,12 @@ protected:
     virtual int socket_sendto(void *handle, const SocketAddress &address, const void *data, unsigned size);
 
     /** Receive a packet from a remote endpoint
+     *
+     *  The address is the sender reported by the modem (AT+QISHOWRA), or the
+     *  peer of the connection the packet arrived on. Data only arrives on the
+     *  connections opened by sendto, without any NSAPI_ERROR_NO_SOCKET is
+     *  returned.
+     *
      *  @param handle       Socket handle
      *  @param address      Destination for the remote SocketAddress or null
      *  @param buffer       The buffer for storing the incoming packet data
@@ -280,11 +429,37 @@ protected:
      */
     virtual int socket_recvfrom(void *handle, SocketAddress *address, void *buffer, unsigned size);
 
+    /** Set a socket option
+     *
+     *  With M66_COALESCE small sends are collected into a buffer of
+     *  M66_COALESCE_BUFFER_SIZE bytes. It is sent when full, on M66_FLUSH,
+     *  before receiving or M66_COALESCE_DELAY_MS after the first collected
+     *  byte, later if another call is talking to the modem then. An error
+     *  of a delayed send is returned by the next send.
+     *  The buffers come from a pool of M66_COALESCE_BUFFER_COUNT, with
+     *  all in use the option fails with NSAPI_ERROR_NO_MEMORY.
+     *
+     *  With M66_RECV_WAIT 0 recv only drains what is buffered and returns
+     *  NSAPI_ERROR_WOULD_BLOCK, the socket then waits for its event with
+     *  its own timeout. MQTTNetwork sets it to keep the client's deadlines.
+     *
+     *  @param handle       Socket handle
+     *  @param level        Option level, only M66_SOCKET_LEVEL is supported
+     *  @param optname      Option name, m66_socket_option
+     *  @param optval       Option value
+     *  @param optlen       Length of the option value
+     *  @return             0 on success, negative error code on failure
+     */
+    virtual nsapi_error_t setsockopt(void *handle, int level, int optname, const void *optval, unsigned optlen);
+
     /** Register a callback on state change of the socket
+     *
+     *  The callback is called from the interface event thread, once for a
+     *  burst of received data, and only for the socket the data is for.
+     *
      *  @param handle       Socket handle
      *  @param callback     Function to call on state change
      *  @param data         Argument to pass to callback
-     *  @note Callback may be called in an interrupt context.
      */
     virtual void socket_attach(void *handle, void (*callback)(void *), void *data);
 
@@ -297,9 +472,32 @@ protected:
     }
 
 private:
+    // modem services beyond sockets use the parser directly
+    friend class M66Http;
+    friend class M66Ftp;
+    friend class M66Replay;
+
     M66ATParser _m66;
     bool _sockets[M66_SOCKET_COUNT];
 
+    struct m66_socket {
+        int id;
+        nsapi_protocol_t proto;
+        bool connected;
+        bool tls;
+        char host[M66_DNS_HOST_SIZE];
+        uint32_t recvTimeout;
+        SocketAddress addr;
+        // end of a non-blocking connect
+        M66Deadline opening;
+        // modem connections, TCP only uses the first one, UDP one per recently used peer
+        struct {
+            int link;
+            SocketAddress addr;
+            uint32_t used;
+        } peers[M66_UDP_PEER_COUNT];
+    } _socketSlots[M66_SOCKET_COUNT];
+
     char _apn[10];
     char _userName[10];
     char _passPhrase[10];
@@ -308,11 +506,78 @@ private:
 
     void event();
 
+    void link_event(int link);
+
+    int alloc_link(struct m66_socket *socket);
+
+    bool free_link(int link);
+
+    int udp_link(struct m66_socket *socket, const SocketAddress &addr);
+
+    void post_events(int delay);
+
+    void process_events();
+
+    char *coalesce_buffer();
+
+    nsapi_error_t coalesce_flush(int id);
+
+    void coalesce_timeout(int id);
+
+    nsapi_error_t resolve(const char *host, char *ip);
+
+    bool resolved_host(const char *ip, char *host);
+
+    void dns_prefetch();
+
+    void start_event_thread();
+
     struct {
         void (*callback)(void *);
 
         void *data;
     } _cbs[M66_SOCKET_COUNT];
+
+    struct dns_entry {
+        char host[M66_DNS_HOST_SIZE];
+        char ip[NSAPI_IPv4_SIZE];
+        M66Deadline expires;
+        bool negative;
+    } _dns[M66_DNS_CACHE_SIZE];
+    // a hit does not wait for the parser, the expiry is on the driver clock
+    Mutex _dnsLock;
+
+    struct dns_entry *dns_lookup(const char *host);
+
+    // the event thread works in memory of the interface, nothing is allocated
+    uint64_t _threadStack[(M66_EVENT_THREAD_STACK_SIZE + 7) / 8];
+    unsigned char _queueBuffer[M66_EVENT_QUEUE_SIZE];
+    Thread _thread;
+    EventQueue _queue;
+    bool _threadStarted;
+
+    volatile bool _eventPending;
+    volatile uint32_t _pendingEvents;
+
+    // collected sends of each socket, in a buffer taken from the pool
+    struct {
+        char *buffer;
+        unsigned length;
+        int link;
+        int event;
+        nsapi_error_t error;
+    } _coalesce[M66_SOCKET_COUNT];
+    char _coalescePool[M66_COALESCE_BUFFER_COUNT][M66_COALESCE_BUFFER_SIZE];
+
+    // socket owning each modem connection, or -1
+    int8_t _linkOwner[M66_LINK_COUNT];
+    uint32_t _lruClock;
+
+    const char *_caCert;
+
+    // payload bytes by socket id, the rest of M66Stats is counted by the parser
+    uint32_t _sent[M66_SOCKET_COUNT];
+    uint32_t _received[M66_SOCKET_COUNT];
 };
 
 #endif
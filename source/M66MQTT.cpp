@@ -0,0 +1,227 @@
+/*
+ * ubirch#1 M66 Modem MQTT transport.
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
+#include <string.h>
+#include "M66MQTT.h"
+
+#if M66_MQTT
+
+// MQTT control packet types (upper nibble of the fixed header)
+#define MQTT_CONNACK 2
+#define MQTT_PUBLISH 3
+#define MQTT_PUBACK  4
+#define MQTT_DUP     0x08
+
+MQTTNetwork::MQTTNetwork(M66Interface* aNetwork)
+    : network(aNetwork), opened(false), resendPending(false), messages()
+{
+    memset(&in, 0, sizeof(in));
+}
+
+MQTTNetwork::~MQTTNetwork() {
+    disconnect();
+}
+
+int MQTTNetwork::read(unsigned char* buffer, int len, int timeout) {
+    M66Deadline deadline(timeout > 0 ? timeout : 0);
+
+    int received = 0;
+    while (received < len) {
+        const int left = (int) deadline.remaining();
+        if (left <= 0) break;
+
+        socket.set_timeout(left);
+        const int r = socket.recv(buffer + received, (nsapi_size_t) (len - received));
+        if (r == NSAPI_ERROR_WOULD_BLOCK) break;
+        if (r < 0) return r;
+        // the broker closed the connection
+        if (r == 0) return received ? received : NSAPI_ERROR_NO_CONNECTION;
+        received += r;
+    }
+
+    track_in(buffer, received);
+    return received;
+}
+
+int MQTTNetwork::write(unsigned char* buffer, int len, int timeout) {
+    // the messages of the last connection go first, they are older
+    if (resendPending) {
+        const int r = resend();
+        if (r < 0) return r;
+    }
+
+    // keep it before sending, a message lost with the connection is resent after reconnecting
+    const int r = track_out(buffer, len);
+    if (r < 0) return r;
+    return send(buffer, len, timeout);
+}
+
+int MQTTNetwork::connect(const char* hostname, int port) {
+    if (!network->is_connected()) {
+        const int r = network->connect();
+        if (r != NSAPI_ERROR_OK) return r;
+    }
+
+    if (opened) socket.close();
+    const int r = socket.open(network);
+    if (r != NSAPI_ERROR_OK) return r;
+    opened = true;
+
+    // recv must not wait in the driver past the deadlines of MQTT::Client
+    const int wait = 0;
+    socket.setsockopt(M66_SOCKET_LEVEL, M66_RECV_WAIT, &wait, sizeof(wait));
+
+    memset(&in, 0, sizeof(in));
+    resendPending = false;
+    return socket.connect(hostname, (uint16_t) port);
+}
+
+void MQTTNetwork::disconnect() {
+    if (opened) {
+        socket.close();
+        opened = false;
+    }
+}
+
+int MQTTNetwork::resend() {
+    resendPending = false;
+
+    int resent = 0;
+    for (int i = 0; i < M66_MQTT_OUTBOX_SIZE; i++) {
+        message *m = messages[i];
+        if (!m) continue;
+
+        m->data[0] |= MQTT_DUP;
+        const int r = send(m->data, m->length, M66_MQTT_RESEND_TIMEOUT);
+        if (r < 0) return r;
+        if (r != m->length) return NSAPI_ERROR_WOULD_BLOCK;
+        resent++;
+    }
+    return resent;
+}
+
+int MQTTNetwork::outbox() const {
+    int count = 0;
+    for (int i = 0; i < M66_MQTT_OUTBOX_SIZE; i++) {
+        if (messages[i]) count++;
+    }
+    return count;
+}
+
+int MQTTNetwork::send(const unsigned char* buffer, int len, int timeout) {
+    if (!opened) return NSAPI_ERROR_NO_CONNECTION;
+
+    M66Deadline deadline(timeout > 0 ? timeout : 0);
+
+    int sent = 0;
+    while (sent < len) {
+        const int left = (int) deadline.remaining();
+        if (left <= 0) break;
+
+        socket.set_timeout(left);
+        const int r = socket.send(buffer + sent, (nsapi_size_t) (len - sent));
+        if (r == NSAPI_ERROR_WOULD_BLOCK) break;
+        if (r < 0) return r;
+        sent += r;
+    }
+
+    return sent;
+}
+
+void MQTTNetwork::track_in(const unsigned char* buffer, int len) {
+    // MQTT::Client reads the fixed header, the length and the rest in separate calls
+    for (int i = 0; i < len; i++) {
+        const unsigned char c = buffer[i];
+        switch (in.state) {
+            case 0:
+                in.header = c;
+                in.remaining = 0;
+                in.multiplier = 1;
+                in.received = 0;
+                in.state = 1;
+                break;
+            case 1:
+                in.remaining += (c & 0x7F) * in.multiplier;
+                in.multiplier *= 128;
+                if (!(c & 0x80)) {
+                    if (in.remaining) in.state = 2;
+                    else packet_in();
+                }
+                break;
+            default:
+                if (in.received < sizeof(in.body)) in.body[in.received] = c;
+                if (++in.received == in.remaining) packet_in();
+                break;
+        }
+    }
+}
+
+void MQTTNetwork::packet_in() {
+    const int type = in.header >> 4;
+    in.state = 0;
+
+    if (in.remaining < 2) return;
+
+    if (type == MQTT_PUBACK) {
+        const uint16_t id = (uint16_t) ((in.body[0] << 8) | in.body[1]);
+        for (int i = 0; i < M66_MQTT_OUTBOX_SIZE; i++) {
+            if (messages[i] && messages[i]->id == id) {
+                pool.free(messages[i]);
+                messages[i] = NULL;
+            }
+        }
+    } else if (type == MQTT_CONNACK && in.body[1] == 0) {
+        // not from within read(), MQTT::Client is still in the middle of connect()
+        resendPending = true;
+    }
+}
+
+int MQTTNetwork::track_out(const unsigned char* buffer, int len) {
+    // only QoS 1 PUBLISH packets
+    if (len < 2 || (buffer[0] >> 4) != MQTT_PUBLISH || ((buffer[0] >> 1) & 0x03) != 1) return 0;
+
+    // skip the fixed header (1 byte + variable length) and the topic
+    int pos = 1;
+    while (pos < len && pos < 5 && (buffer[pos] & 0x80)) pos++;
+    pos++;
+    if (pos + 2 > len) return 0;
+    pos += 2 + ((buffer[pos] << 8) | buffer[pos + 1]);
+    if (pos + 2 > len) return 0;
+    const uint16_t id = (uint16_t) ((buffer[pos] << 8) | buffer[pos + 1]);
+
+    int slot = -1;
+    for (int i = 0; i < M66_MQTT_OUTBOX_SIZE; i++) {
+        // a retry of MQTT::Client, already kept
+        if (messages[i] && messages[i]->id == id) return 0;
+        if (!messages[i] && slot < 0) slot = i;
+    }
+    // a message that could not be resent is not sent at all
+    if (slot < 0 || len > M66_MQTT_OUTBOX_MESSAGE_SIZE) return NSAPI_ERROR_NO_MEMORY;
+
+    message *m = pool.alloc();
+    if (!m) return NSAPI_ERROR_NO_MEMORY;
+    m->id = id;
+    m->length = (uint16_t) len;
+    memcpy(m->data, buffer, (size_t) len);
+    messages[slot] = m;
+    return 0;
+}
+
+#endif // M66_MQTT
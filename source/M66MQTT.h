@@ -1,38 +1,163 @@
+/*!
+ * @file
+ * @brief MQTT transport for the Paho embedded client over the M66.
+ *
+ * Implements the read/write/connect/disconnect interface MQTT::Client
+ * expects and adds what a long running client needs on a cellular link:
+ * deadlines for every read and write and an outbox that keeps QoS 1
+ * messages until they are acknowledged, across reconnects. Keepalive pings
+ * are left to MQTT::Client::yield().
+ *
+ * @copyright &copy; 2015, 2016, 2017 ubirch GmbH (https://ubirch.com)
+ *
+ * ```
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * ```
+ */
+
 #ifndef _MQTTNETWORK_H_
 #define _MQTTNETWORK_H_
 
+#include "mbed.h"
 #include "M66Interface.h"
 
+// the helper is left out of builds without M66_MQTT
+#if M66_MQTT
+
+#ifndef M66_MQTT_OUTBOX_SIZE
+#  define M66_MQTT_OUTBOX_SIZE         4
+#endif
+#ifndef M66_MQTT_OUTBOX_MESSAGE_SIZE
+#  define M66_MQTT_OUTBOX_MESSAGE_SIZE 256
+#endif
+#ifndef M66_MQTT_RESEND_TIMEOUT
+#  define M66_MQTT_RESEND_TIMEOUT      10000
+#endif
+
+/** MQTT network transport.
+ *
+ * Example:
+ * @code
+ *  MQTTNetwork network(&modem);
+ *  MQTT::Client<MQTTNetwork, Countdown> client(network);
+ *
+ *  network.connect("broker.example.com", 1883);
+ *  client.connect(options);
+ *  network.resend();                    // unacknowledged QoS 1 messages of the last connection
+ *  while (client.isConnected()) {
+ *      client.yield(100);               // sends the keepalive pings
+ *  }
+ * @endcode
+ *
+ * Keep the MQTT::Client instance across reconnects, its packet ids
+ * continue where they were and do not collide with the ones in the outbox.
+ */
 class MQTTNetwork {
 public:
-    MQTTNetwork(M66Interface* aNetwork) : network(aNetwork) {
-        socket = new TCPSocket();
-    }
+    /**
+     * Create a transport over a modem interface.
+     * @param aNetwork the modem, connect() brings it up if necessary
+     */
+    MQTTNetwork(M66Interface* aNetwork);
+
+    ~MQTTNetwork();
 
-    ~MQTTNetwork() {
-        delete socket;
-    }
+    /**
+     * Read exactly len bytes unless the deadline passes.
+     *
+     * @param buffer  where to put the data
+     * @param len     number of bytes wanted
+     * @param timeout deadline in ms
+     * @return the number of bytes read (less than len on timeout) or a negative error
+     */
+    int read(unsigned char* buffer, int len, int timeout);
 
-    int read(unsigned char* buffer, int len, int timeout) {
-        return socket->recv(buffer, len);
-    }
+    /**
+     * Write a complete MQTT packet, QoS 1 PUBLISH packets are kept in the outbox
+     * until their PUBACK arrives. A QoS 1 PUBLISH longer than
+     * M66_MQTT_OUTBOX_MESSAGE_SIZE, or one arriving with all
+     * M66_MQTT_OUTBOX_SIZE slots taken, is not sent.
+     *
+     * @param buffer  the packet
+     * @param len     its length
+     * @param timeout deadline in ms, checked before every chunk handed to the modem
+     * @return the number of bytes written or a negative error,
+     *         NSAPI_ERROR_NO_MEMORY if a QoS 1 PUBLISH does not fit into the outbox
+     */
+    int write(unsigned char* buffer, int len, int timeout);
 
-    int write(unsigned char* buffer, int len, int timeout) {
-        return socket->send(buffer, len);
-    }
+    /**
+     * Connect to the broker. The modem connection (PDP context) is only
+     * established if it is down and the address comes from the DNS cache
+     * when the host was resolved before.
+     *
+     * @param hostname the broker host name or IP address
+     * @param port     the broker port
+     * @return 0 on success or a negative error
+     */
+    int connect(const char* hostname, int port);
 
-    int connect(const char* hostname, int port) {
-        socket->open(network);
-        return socket->connect(hostname, port);
-    }
+    /**
+     * Close the connection to the broker, the outbox is kept.
+     */
+    void disconnect();
 
-    void disconnect() {
+    /**
+     * Resend the QoS 1 messages of the outbox with DUP set, once the broker
+     * accepted the connection. The next write() does it if not called.
+     *
+     * @return the number of messages resent or a negative error
+     */
+    int resend();
 
-    }
+    /**
+     * @return the number of QoS 1 messages waiting for their PUBACK
+     */
+    int outbox() const;
 
 private:
+    /** A QoS 1 PUBLISH waiting for its PUBACK */
+    struct message {
+        uint16_t id;
+        uint16_t length;
+        unsigned char data[M66_MQTT_OUTBOX_MESSAGE_SIZE];
+    };
+
+    /** Parser state of the packet currently read */
+    struct incoming {
+        int state;
+        unsigned char header;
+        uint32_t remaining;
+        uint32_t multiplier;
+        uint32_t received;
+        unsigned char body[2];
+    };
+
     M66Interface* network;
-    TCPSocket* socket;
+    TCPSocket socket;
+    bool opened;
+    // a CONNACK was read, the outbox goes out before the next packet
+    bool resendPending;
+    MemoryPool<message, M66_MQTT_OUTBOX_SIZE> pool;
+    message *messages[M66_MQTT_OUTBOX_SIZE];
+    incoming in;
+
+    int send(const unsigned char* buffer, int len, int timeout);
+    void track_in(const unsigned char* buffer, int len);
+    int track_out(const unsigned char* buffer, int len);
+    void packet_in();
 };
 
+#endif // M66_MQTT
+
 #endif // _MQTTNETWORK_H_
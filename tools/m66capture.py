@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""
+Work with UART captures of the M66 (see BufferedSerial::capture()).
+
+A capture is "M66C" followed by records of consecutive bytes in one
+direction: uint8 type ('R' received, 'T' sent), uint8 length, uint16 delay
+since the previous record (us below 0x8000, else ms ored with 0x8000) and
+the bytes. The input is either a raw capture or a console log containing
+the "M66C <hex>" lines printed by M66Replay::dump().
+
+    tools/m66capture.py decode console.log
+    tools/m66capture.py encode session.txt -o session.bin
+    tools/m66capture.py header session.bin --name interleaved > recordings.h
+    tools/m66capture.py replay session.bin --port /dev/ttyUSB0 --speed 10
+
+A script for "encode" has one record per line, "> text" for what the
+parser sends and "< text" for what the modem answers, with Python string
+escapes and an optional delay in ms before the direction ("250 < OK\\r\\n").
+Lines starting with "#" are comments.
+
+"replay" plays the modem on a serial port wired to the board's modem UART,
+so a capture exercises the unmodified firmware. Like M66Replay on the
+target it sends a received record only after the board has written as many
+bytes as the capture holds before it. It needs pyserial.
+"""
+
+import argparse
+import ast
+import re
+import struct
+import sys
+import time
+
+MAGIC = b"M66C"
+RECORD = struct.Struct("<BBH")
+RX, TX = ord("R"), ord("T")
+
+
+def load(path, binary):
+    if binary:
+        with open(path, "rb") as f:
+            data = f.read()
+    else:
+        data = bytearray()
+        with open(path, encoding="utf-8", errors="replace") as f:
+            for line in f:
+                match = re.search(r"M66C ([0-9a-fA-F]+)", line)
+                if match:
+                    data += bytes.fromhex(match.group(1))
+        data = bytes(data)
+    if data[:len(MAGIC)] != MAGIC:
+        sys.exit("%s: no capture" % path)
+    return data
+
+
+def delay_us(stamp):
+    return (stamp & 0x7FFF) * 1000 if stamp & 0x8000 else stamp
+
+
+def stamp(us):
+    if us < 0x8000:
+        return us
+    return 0x8000 | min(us // 1000, 0x7FFF)
+
+
+def records(data):
+    offset = len(MAGIC)
+    while offset + RECORD.size <= len(data):
+        kind, length, delay = RECORD.unpack_from(data, offset)
+        offset += RECORD.size
+        payload = data[offset:offset + length]
+        offset += length
+        if len(payload) < length:
+            break
+        yield kind, delay_us(delay), payload
+
+
+def escaped(payload):
+    return payload.decode("latin-1").encode("unicode_escape").decode("ascii")
+
+
+def decode(data, out):
+    elapsed = 0
+    for kind, delay, payload in records(data):
+        elapsed += delay
+        out.write("%12.6f %s %s\n" % (elapsed / 1e6, "<" if kind == RX else ">", escaped(payload)))
+
+
+def encode(path):
+    data = bytearray(MAGIC)
+    with open(path, encoding="utf-8") as f:
+        for number, line in enumerate(f, 1):
+            line = line.rstrip("\n")
+            if not line.strip() or line.lstrip().startswith("#"):
+                continue
+            match = re.match(r"\s*(\d+)?\s*([<>]) ?(.*)$", line)
+            if not match:
+                sys.exit("%s:%d: expected '[delay] > text' or '[delay] < text'" % (path, number))
+            delay = int(match.group(1) or 0) * 1000
+            kind = RX if match.group(2) == "<" else TX
+            payload = ast.literal_eval('"%s"' % match.group(3).replace('"', '\\"')).encode("latin-1")
+            # a record holds at most 255 bytes, the rest follows without delay
+            for start in range(0, len(payload), 255):
+                chunk = payload[start:start + 255]
+                data += RECORD.pack(kind, len(chunk), stamp(delay if start == 0 else 0)) + chunk
+    return bytes(data)
+
+
+def header(data, name, out):
+    out.write("// generated by tools/m66capture.py, do not edit\n")
+    out.write("static const uint8_t %s[%d] = {\n" % (name, len(data)))
+    for offset in range(0, len(data), 16):
+        out.write("    " + ", ".join("0x%02x" % b for b in data[offset:offset + 16]) + ",\n")
+    out.write("};\n")
+
+
+def replay(data, port, baud, speed):
+    import serial
+
+    with serial.Serial(port, baud, timeout=0.01) as uart:
+        written, expected = 0, 0
+        for kind, delay, payload in records(data):
+            if kind == TX:
+                expected += len(payload)
+                continue
+            # the answer must not overtake the command it answers
+            while written < expected:
+                got = uart.read(expected - written)
+                if got:
+                    sys.stdout.write("> %s\n" % escaped(got))
+                    written += len(got)
+            if speed:
+                time.sleep(delay / 1e6 / speed)
+            uart.write(payload)
+            sys.stdout.write("< %s\n" % escaped(payload))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("command", choices=["decode", "encode", "header", "replay"])
+    parser.add_argument("input", help="console log with M66C lines, raw capture with --binary or script for encode")
+    parser.add_argument("--binary", action="store_true", help="the input is a raw capture (default for .bin files)")
+    parser.add_argument("-o", "--output", help="file for the encoded capture")
+    parser.add_argument("--name", default="capture", help="name of the C array")
+    parser.add_argument("--port", help="serial port wired to the modem UART of the board")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--speed", type=float, default=1, help="divisor of the recorded delays, 0 for none")
+    args = parser.parse_args()
+
+    if args.command == "encode":
+        data = encode(args.input)
+        if args.output:
+            with open(args.output, "wb") as f:
+                f.write(data)
+        else:
+            sys.stdout.buffer.write(data)
+        return
+
+    data = load(args.input, args.binary or args.input.endswith(".bin"))
+    if args.command == "decode":
+        decode(data, sys.stdout)
+    elif args.command == "header":
+        header(data, args.name, sys.stdout)
+    else:
+        if not args.port:
+            sys.exit("replay needs --port")
+        replay(data, args.port, args.baud, args.speed)
+
+
+if __name__ == "__main__":
+    main()
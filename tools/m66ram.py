@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""
+Report the RAM the driver takes in a build, read from the linker map file.
+
+The driver does not use the heap, all its buffers, socket slots, the packet
+store and the stack of the event thread are sized in mbed_lib.json and live
+in the driver's static data or in the M66Interface (or M66ATParser) object
+of the application. Name that object with --instance to count it as well:
+
+    mbed compile -t GCC_ARM
+    tools/m66ram.py BUILD/K64F/GCC_ARM/app.map --instance modem
+    tools/m66ram.py BUILD/K64F/GCC_ARM/app.map --instance modem --budget 24576
+
+The map only has sizes per section, build with -fdata-sections (the mbed
+profiles do) to see each variable on its own. With --budget the report
+fails when the total is larger, e.g. in CI.
+"""
+
+import argparse
+import re
+import sys
+
+DEFAULT_OBJECTS = r"(?:^|[/\\])(M66\w*|BufferedSerial|BufferedPrint|MyBuffer)\.o$"
+
+# input sections taking RAM
+DATA = r"\.bss|\.data|COMMON"
+
+# " .bss.name  0xaddress  0xsize  object", long names put the rest on the next line
+SECTION = r"^ (%s)(\.\S+)?(?:\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*))?$"
+PLACEMENT = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$")
+
+
+def sections(path, kinds=DATA):
+    """(kind, name, size, object) of every section of the kinds placed by the linker."""
+    section = re.compile(SECTION % kinds)
+    with open(path, encoding="utf-8", errors="replace") as f:
+        lines = f.read().splitlines()
+
+    # the discarded sections before the memory map look the same
+    start = next((i for i, line in enumerate(lines) if line.startswith("Linker script and memory map")), None)
+    if start is None:
+        sys.exit("%s: no memory map, is this a GNU ld map file?" % path)
+
+    pending = None
+    for line in lines[start:]:
+        if pending:
+            match = PLACEMENT.match(line)
+            if match:
+                yield pending[0], pending[1], int(match.group(2), 16), match.group(3).strip()
+            pending = None
+            continue
+        match = section.match(line)
+        if not match:
+            continue
+        kind, name = match.group(1), (match.group(2) or "")[1:]
+        if match.group(4):
+            yield kind, name, int(match.group(4), 16), match.group(5).strip()
+        else:
+            pending = (kind, name)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("map", help="linker map file of the application")
+    parser.add_argument("--instance", action="append", default=[],
+                        help="variable of the application holding a driver object, may be repeated")
+    parser.add_argument("--objects", default=DEFAULT_OBJECTS, help="regular expression selecting the driver objects")
+    parser.add_argument("--budget", type=int, help="fail when the driver takes more bytes")
+    args = parser.parse_args()
+
+    objects = re.compile(args.objects)
+    found = set()
+    rows = []
+    for kind, name, size, obj in sections(args.map):
+        if not size:
+            continue
+        if name in args.instance:
+            found.add(name)
+            rows.append((size, kind, name, "instance"))
+        elif objects.search(obj):
+            rows.append((size, kind, name or "(%s)" % obj.replace("\\", "/").split("/")[-1], "static"))
+
+    for name in args.instance:
+        if name not in found:
+            sys.exit("%s: no data section for the instance %s" % (args.map, name))
+    if not rows:
+        sys.exit("%s: no data of the driver found" % args.map)
+
+    print("%7s  %-6s %-9s %s" % ("bytes", "kind", "owner", "variable"))
+    for size, kind, name, owner in sorted(rows, reverse=True):
+        print("%7d  %-6s %-9s %s" % (size, kind.lstrip("."), owner, name))
+
+    total = sum(row[0] for row in rows)
+    print("%7d  total RAM of the driver, no heap" % total)
+    if args.budget is not None and total > args.budget:
+        sys.exit("over budget by %d bytes" % (total - args.budget))
+
+
+if __name__ == "__main__":
+    main()
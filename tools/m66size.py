@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""
+Report the flash the driver takes in a build, read from the linker map file.
+
+Code, constants and the initial values of data count, per object file of
+the driver. Parts of the driver not needed are switched off in the
+"features" of mbed_lib.json (time-sync, location, battery, debug, udp,
+mqtt), together with the diagnostics (stats, latency, trace-level 0,
+capture) that leaves a socket-only build:
+
+    mbed compile -t GCC_ARM
+    tools/m66size.py BUILD/K64F/GCC_ARM/app.map
+    tools/m66size.py BUILD/K64F/GCC_ARM/app.map --largest 20
+    tools/m66size.py BUILD/K64F/GCC_ARM/app.map --budget 32768
+
+The largest sections are single functions and constants when built with
+-ffunction-sections and -fdata-sections, as the mbed profiles do. The RAM
+is reported by tools/m66ram.py.
+"""
+
+import argparse
+import re
+import shutil
+import subprocess
+import sys
+
+from m66ram import DEFAULT_OBJECTS, sections
+
+# input sections taking flash, .data is copied from there at startup
+FLASH = r"\.text|\.rodata|\.data"
+
+
+def demangle(names):
+    tool = shutil.which("arm-none-eabi-c++filt") or shutil.which("c++filt")
+    if not tool or not names:
+        return names
+    result = subprocess.run([tool], input="\n".join(names), capture_output=True, text=True)
+    lines = result.stdout.splitlines()
+    return lines if result.returncode == 0 and len(lines) == len(names) else names
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("map", help="linker map file of the application")
+    parser.add_argument("--objects", default=DEFAULT_OBJECTS, help="regular expression selecting the driver objects")
+    parser.add_argument("--largest", type=int, default=0, help="also list the largest sections")
+    parser.add_argument("--budget", type=int, help="fail when the driver takes more bytes")
+    args = parser.parse_args()
+
+    objects = re.compile(args.objects)
+    per_object = {}
+    rows = []
+    for kind, name, size, obj in sections(args.map, FLASH):
+        if not size or not objects.search(obj):
+            continue
+        obj = obj.replace("\\", "/").split("/")[-1]
+        per_object.setdefault(obj, {".text": 0, ".rodata": 0, ".data": 0})[kind] += size
+        rows.append((size, kind, name, obj))
+    if not rows:
+        sys.exit("%s: no code of the driver found" % args.map)
+
+    print("%7s %7s %7s %7s  %s" % ("text", "rodata", "data", "total", "object"))
+    for obj, kinds in sorted(per_object.items(), key=lambda item: -sum(item[1].values())):
+        print("%7d %7d %7d %7d  %s" % (kinds[".text"], kinds[".rodata"], kinds[".data"],
+                                       sum(kinds.values()), obj))
+    total = sum(row[0] for row in rows)
+    print("%31d  total flash of the driver" % total)
+
+    if args.largest:
+        largest = sorted(rows, reverse=True)[:args.largest]
+        names = demangle([row[2] for row in largest])
+        print()
+        print("%7s  %-7s %s" % ("bytes", "kind", "section"))
+        for (size, kind, _, obj), name in zip(largest, names):
+            print("%7d  %-7s %s (%s)" % (size, kind.lstrip("."), name or "-", obj))
+
+    if args.budget is not None and total > args.budget:
+        sys.exit("over budget by %d bytes" % (total - args.budget))
+
+
+if __name__ == "__main__":
+    main()
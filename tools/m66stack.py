@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""
+Report the worst case stack use of the public entry points of the driver.
+
+The input is a build made with the stack usage profile, GCC writes the
+frame size of every function (.su) and its calls (.ci, GCC 10 and later)
+next to the object files:
+
+    mbed compile -t GCC_ARM --profile develop --profile tools/stack-usage.json
+    tools/m66stack.py BUILD/
+    tools/m66stack.py BUILD/ --entry "M66ATParser::rx" --path
+
+The stack of an entry point is its own frame plus the deepest chain of
+calls below it. Calls the report cannot follow are flagged: "?" a function
+without stack information (library code built without the profile), "*"
+an indirect call (callbacks, virtual functions) and "R" recursion. The
+numbers are a lower bound for flagged entries. Interrupt handlers and the
+RTOS need their own stack on top. GCC does not name varargs functions in
+the call graph, they are listed with their symbol, e.g. _ZN11M66ATParser2txEPKcz.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+DEFAULT_ENTRY = r"(?:^|\s)(M66ATParser|M66Interface|M66Http|M66Ftp|MQTTNetwork)::[a-z]\w*\("
+
+NODE = re.compile(r'node:\s*\{\s*title:\s*"((?:[^"\\]|\\.)*)"\s*label:\s*"((?:[^"\\]|\\.)*)"')
+EDGE = re.compile(r'edge:\s*\{\s*sourcename:\s*"((?:[^"\\]|\\.)*)"\s*targetname:\s*"((?:[^"\\]|\\.)*)"')
+BYTES = re.compile(r"(\d+) bytes \((\w+)")
+
+
+class Function:
+    def __init__(self, name):
+        self.name = name
+        self.frame = None
+        self.dynamic = False
+        self.calls = set()
+
+
+def load(root):
+    functions = {}
+    found = 0
+    for directory, _, files in os.walk(root):
+        for name in files:
+            if name.endswith(".ci"):
+                found += 1
+                with open(os.path.join(directory, name), encoding="utf-8", errors="replace") as f:
+                    text = f.read()
+                for title, label in NODE.findall(text):
+                    lines = label.split("\\n")
+                    function = functions.setdefault(title, Function(title))
+                    # GCC garbles the name of varargs functions, keep the symbol then
+                    if "(" in lines[0]:
+                        function.name = lines[0]
+                    match = BYTES.search(label)
+                    if match:
+                        function.frame = int(match.group(1))
+                        function.dynamic = match.group(2) != "static"
+                for source, target in EDGE.findall(text):
+                    functions.setdefault(source, Function(source)).calls.add(target)
+                    functions.setdefault(target, Function(target))
+    if not found:
+        sys.exit("%s: no .ci files, build with tools/stack-usage.json (GCC 10 or later)" % root)
+    return functions
+
+
+def analyse(functions):
+    """Worst case stack (bytes, flags, deepest callee) of every function."""
+    result = {}
+    active = set()
+
+    def visit(title):
+        if title in result:
+            return result[title]
+        if title in active:
+            return 0, "R", None
+        function = functions[title]
+        if function.frame is None:
+            flags = "*" if "indirect" in title else "?"
+            result[title] = (0, flags, None)
+            return result[title]
+
+        active.add(title)
+        deepest, flags, via = 0, "D" if function.dynamic else "", None
+        for callee in sorted(function.calls):
+            depth, callee_flags, _ = visit(callee)
+            flags += callee_flags
+            if depth > deepest:
+                deepest, via = depth, callee
+        active.discard(title)
+
+        result[title] = (function.frame + deepest, "".join(sorted(set(flags))), via)
+        return result[title]
+
+    for title in functions:
+        visit(title)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("build", help="build directory with the .ci and .su files")
+    parser.add_argument("--entry", default=DEFAULT_ENTRY, help="regular expression selecting the entry points")
+    parser.add_argument("--path", action="store_true", help="print the deepest call chain of every entry point")
+    args = parser.parse_args()
+
+    functions = load(args.build)
+    result = analyse(functions)
+    entry = re.compile(args.entry)
+
+    entries = [t for t, f in functions.items() if f.frame is not None and entry.search(f.name)]
+    if not entries:
+        sys.exit("no entry point matches %s" % args.entry)
+
+    print("%7s  %-5s %s" % ("bytes", "flags", "entry point"))
+    for title in sorted(entries, key=lambda t: (-result[t][0], functions[t].name)):
+        depth, flags, via = result[title]
+        print("%7d  %-5s %s" % (depth, flags, functions[title].name))
+        if args.path:
+            while via:
+                callee = functions[via]
+                print("%7s  %-5s   %s (%s)" % ("", "", callee.name, "?" if callee.frame is None else callee.frame))
+                via = result[via][2]
+
+
+if __name__ == "__main__":
+    main()
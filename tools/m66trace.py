@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""
+Decode the binary trace of the M66 parser (see source/M66ATParser/M66Trace.h).
+
+The input is either the raw bytes from M66Trace::read() or a console log
+containing the "M66T <hex>" lines printed by M66Trace::dump(). Status
+messages only carry their integer arguments, the format string is taken
+from the parser source at the recorded line.
+
+    tools/m66trace.py console.log
+    tools/m66trace.py --binary trace.bin --source source/M66ATParser/M66ATParser.cpp
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+EVENTS = {1: "INFO", 2: "TX", 3: "RX", 4: "DROP", 5: "DATA"}
+HEADER = struct.Struct("<IBBH")
+
+DEFAULT_SOURCE = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                              "..", "source", "M66ATParser", "M66ATParser.cpp")
+
+
+def load_formats(path):
+    """Map source lines to the format string of the CSTDEBUG() on or just before them."""
+    formats = {}
+    with open(path, encoding="utf-8", errors="replace") as f:
+        lines = f.readlines()
+    for number, line in enumerate(lines, 1):
+        match = re.search(r'CSTDEBUG\("((?:[^"\\]|\\.)*)"', line)
+        if match:
+            text = match.group(1).replace("\\r", "").replace("\\n", "").replace('\\"', '"')
+            # the compiler may report the line of the closing parenthesis
+            for offset in range(4):
+                formats.setdefault(number + offset, text)
+    return formats
+
+
+def read_records(data):
+    offset = 0
+    while offset + HEADER.size <= len(data):
+        timestamp, event, length, line = HEADER.unpack_from(data, offset)
+        offset += HEADER.size
+        payload = data[offset:offset + length]
+        offset += length
+        if len(payload) < length:
+            break
+        yield timestamp, event, line, payload
+
+
+def printable(payload):
+    return "".join(chr(b) if 0x20 <= b < 0x7f else "." for b in payload)
+
+
+def format_info(formats, line, payload):
+    args = struct.unpack("<%di" % (len(payload) // 4), payload[:len(payload) // 4 * 4])
+    text = formats.get(line)
+    if text is None:
+        return "line %d %s" % (line, " ".join(str(a) for a in args))
+    try:
+        # C formats with integer conversions only, %u is the same as %d here
+        return re.sub(r"%([-+ #0-9.]*)l*u", r"%\1d", text) % args
+    except (TypeError, ValueError):
+        return "%s %s" % (text, args)
+
+
+def decode(data, formats, out):
+    previous = None
+    elapsed = 0
+    for timestamp, event, line, payload in read_records(data):
+        # the timestamp is a 32 bit microsecond counter, it wraps after 71 minutes
+        if previous is not None:
+            elapsed += (timestamp - previous) & 0xFFFFFFFF
+        previous = timestamp
+
+        name = EVENTS.get(event, "?%d" % event)
+        if event == 1:
+            text = format_info(formats, line, payload)
+        elif event == 5:
+            size = payload[0] | payload[1] << 8 if len(payload) >= 2 else 0
+            text = "%d bytes %s %s" % (size, payload[2:].hex(), printable(payload[2:]))
+        else:
+            text = "'%s'" % printable(payload)
+
+        out.write("%12.6f %-4s %4d %s\n" % (elapsed / 1e6, name, line, text))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="console log with M66T lines, or raw trace with --binary")
+    parser.add_argument("--binary", action="store_true", help="the input holds the raw ring bytes")
+    parser.add_argument("--source", default=DEFAULT_SOURCE, help="M66ATParser.cpp the firmware was built from")
+    args = parser.parse_args()
+
+    if args.binary:
+        with open(args.input, "rb") as f:
+            data = f.read()
+    else:
+        data = bytearray()
+        with open(args.input, encoding="utf-8", errors="replace") as f:
+            for line in f:
+                match = re.search(r"M66T ([0-9a-fA-F]+)", line)
+                if match:
+                    data += bytes.fromhex(match.group(1))
+        data = bytes(data)
+
+    formats = load_formats(args.source) if os.path.exists(args.source) else {}
+    decode(data, formats, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()